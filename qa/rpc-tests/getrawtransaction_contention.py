@@ -0,0 +1,104 @@
+#!/usr/bin/env python2
+# Copyright (c) 2018-2020 The DAPS Project developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Benchmark getrawtransaction while the node reindexes with -txindex, which
+# keeps cs_main busy connecting blocks. Reports the throughput and latency of
+# the lookups during the reindex and once the node is idle again.
+# Not part of rpc-tests.sh, run it by hand:
+#   getrawtransaction_contention.py --srcdir=../../src --blocks=2000 --threads=8
+#
+from test_framework import BitcoinTestFramework
+from bitcoinrpc.authproxy import AuthServiceProxy, JSONRPCException
+from util import *
+import random
+import threading
+import time
+
+class Hammer(threading.Thread):
+    def __init__(self, url, txids, stop):
+        threading.Thread.__init__(self)
+        self.node = AuthServiceProxy(url)
+        self.txids = txids
+        self.stop = stop
+        self.latencies = []
+        self.found = 0
+
+    def run(self):
+        while not self.stop.is_set():
+            txid = random.choice(self.txids)
+            start = time.time()
+            try:
+                self.node.getrawtransaction(txid)
+                self.found += 1
+            except JSONRPCException:
+                # not reindexed yet
+                pass
+            self.latencies.append(time.time() - start)
+
+def report(name, hammers, elapsed):
+    latencies = sorted([l for h in hammers for l in h.latencies])
+    found = sum([h.found for h in hammers])
+    if not latencies:
+        print("%s: no calls in %.2fs" % (name, elapsed))
+        return
+    print("%s: %d calls (%d found) in %.2fs, %.0f calls/s, latency median %.2fms p99 %.2fms max %.2fms" % (
+        name, len(latencies), found, elapsed, len(latencies) / elapsed,
+        1000 * latencies[len(latencies) // 2], 1000 * latencies[len(latencies) * 99 // 100], 1000 * latencies[-1]))
+
+class GetRawTransactionContentionTest(BitcoinTestFramework):
+
+    def add_options(self, parser):
+        parser.add_option("--blocks", dest="blocks", default=1000, type="int",
+                          help="Blocks to mine before reindexing (default: %default)")
+        parser.add_option("--threads", dest="threads", default=8, type="int",
+                          help="Concurrent getrawtransaction callers (default: %default)")
+        parser.add_option("--seconds", dest="seconds", default=10, type="int",
+                          help="Length of the idle run (default: %default)")
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 1)
+
+    def setup_network(self):
+        self.nodes = []
+        self.is_network_split = False
+        self.nodes.append(start_node(0, self.options.tmpdir, ["-txindex"]))
+
+    def hammer(self, name, done):
+        stop = threading.Event()
+        hammers = [Hammer(self.nodes[0].url, self.txids, stop) for i in range(self.options.threads)]
+        start = time.time()
+        for h in hammers:
+            h.start()
+        while not done():
+            time.sleep(0.1)
+        stop.set()
+        for h in hammers:
+            h.join()
+        report(name, hammers, time.time() - start)
+
+    def run_test(self):
+        self.nodes[0].setgenerate(True, self.options.blocks)
+        self.txids = []
+        for height in range(1, self.options.blocks + 1):
+            self.txids += self.nodes[0].getblock(self.nodes[0].getblockhash(height))['tx']
+
+        stop_node(self.nodes[0], 0)
+        wait_bitcoinds()
+        self.nodes[0] = start_node(0, self.options.tmpdir, ["-txindex", "-reindex"])
+        self.hammer("during reindex", lambda: self.nodes[0].getblockcount() == self.options.blocks)
+        assert_equal(self.nodes[0].getblockcount(), self.options.blocks)
+
+        deadline = time.time() + self.options.seconds
+        self.hammer("idle", lambda: time.time() >= deadline)
+
+        # every lookup succeeds once the index is rebuilt
+        for txid in random.sample(self.txids, min(100, len(self.txids))):
+            assert_equal(self.nodes[0].getrawtransaction(txid, 1)['txid'], txid)
+        print "Success"
+
+if __name__ == '__main__':
+    GetRawTransactionContentionTest().main()
@@ -0,0 +1,160 @@
+// Copyright (c) 2018-2020 The DAPS Project developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilereader.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "crypto/common.h"
+#include "main.h"
+#include "serialize.h"
+#include "sync.h"
+#include "util.h"
+
+#include <list>
+#include <memory>
+#include <string.h>
+
+#ifndef WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+/** An open, read-only block or undo file. Readers keep it alive while they use it, even if it is evicted meanwhile. */
+class CBlockFileHandle
+{
+public:
+    const std::string strPrefix;
+    const int nFile;
+
+    CBlockFileHandle(const std::string& strPrefixIn, int nFileIn) : strPrefix(strPrefixIn), nFile(nFileIn)
+    {
+        const boost::filesystem::path path = GetBlockPosFilename(CDiskBlockPos(nFile, 0), strPrefix.c_str());
+#ifdef WIN32
+        file = fopen(path.string().c_str(), "rb");
+#else
+        fd = open(path.string().c_str(), O_RDONLY);
+#endif
+        if (!IsOpen())
+            LogPrintf("Unable to open file %s\n", path.string());
+    }
+
+    ~CBlockFileHandle()
+    {
+#ifdef WIN32
+        if (file)
+            fclose(file);
+#else
+        if (fd >= 0)
+            close(fd);
+#endif
+    }
+
+    bool IsOpen() const
+    {
+#ifdef WIN32
+        return file != NULL;
+#else
+        return fd >= 0;
+#endif
+    }
+
+    bool Read(unsigned int nPos, char* pch, size_t nSize)
+    {
+#ifdef WIN32
+        // No pread here, so reads of the same file take turns on the shared position
+        LOCK(cs);
+        if (fseek(file, nPos, SEEK_SET))
+            return false;
+        return fread(pch, 1, nSize, file) == nSize;
+#else
+        while (nSize > 0) {
+            const ssize_t nRead = pread(fd, pch, nSize, nPos);
+            if (nRead < 0 && errno == EINTR)
+                continue;
+            if (nRead <= 0)
+                return false;
+            pch += nRead;
+            nPos += nRead;
+            nSize -= nRead;
+        }
+        return true;
+#endif
+    }
+
+private:
+#ifdef WIN32
+    FILE* file;
+    RecursiveMutex cs;
+#else
+    int fd;
+#endif
+
+    CBlockFileHandle(const CBlockFileHandle&);
+    CBlockFileHandle& operator=(const CBlockFileHandle&);
+};
+
+RecursiveMutex cs_blockFileHandles;
+//! Most recently used first
+std::list<std::shared_ptr<CBlockFileHandle> > listBlockFileHandles;
+
+std::shared_ptr<CBlockFileHandle> GetBlockFileHandle(int nFile, const char* prefix)
+{
+    LOCK(cs_blockFileHandles);
+    for (std::list<std::shared_ptr<CBlockFileHandle> >::iterator it = listBlockFileHandles.begin(); it != listBlockFileHandles.end(); ++it) {
+        if ((*it)->nFile == nFile && (*it)->strPrefix == prefix) {
+            listBlockFileHandles.splice(listBlockFileHandles.begin(), listBlockFileHandles, it);
+            return listBlockFileHandles.front();
+        }
+    }
+
+    // Files that fail to open are not cached, they may show up later
+    std::shared_ptr<CBlockFileHandle> handle(new CBlockFileHandle(prefix, nFile));
+    if (!handle->IsOpen())
+        return std::shared_ptr<CBlockFileHandle>();
+    listBlockFileHandles.push_front(handle);
+    if (listBlockFileHandles.size() > MAX_OPEN_BLOCK_FILES)
+        listBlockFileHandles.pop_back();
+    return handle;
+}
+
+} // anon namespace
+
+bool ReadDiskFile(const CDiskBlockPos& pos, const char* prefix, char* pch, size_t nSize)
+{
+    if (pos.IsNull())
+        return false;
+    std::shared_ptr<CBlockFileHandle> handle = GetBlockFileHandle(pos.nFile, prefix);
+    if (!handle)
+        return false;
+    if (!handle->Read(pos.nPos, pch, nSize))
+        return error("%s : unable to read %u bytes at position %u of %s%05u.dat", __func__, nSize, pos.nPos, prefix, pos.nFile);
+    return true;
+}
+
+bool ReadDiskRecordSize(const CDiskBlockPos& pos, const char* prefix, unsigned int& nSize)
+{
+    const size_t nHeaderSize = MESSAGE_START_SIZE + sizeof(nSize);
+    if (pos.IsNull() || pos.nPos < nHeaderSize)
+        return false;
+
+    char header[nHeaderSize];
+    if (!ReadDiskFile(CDiskBlockPos(pos.nFile, pos.nPos - nHeaderSize), prefix, header, nHeaderSize))
+        return false;
+    if (memcmp(header, Params().MessageStart(), MESSAGE_START_SIZE) != 0)
+        return error("%s : no message start in front of position %u of %s%05u.dat", __func__, pos.nPos, prefix, pos.nFile);
+    nSize = ReadLE32((const unsigned char*)header + MESSAGE_START_SIZE);
+    if (nSize > MAX_SIZE)
+        return error("%s : record size %u too large at position %u of %s%05u.dat", __func__, nSize, pos.nPos, prefix, pos.nFile);
+    return true;
+}
+
+void CloseBlockFileReaders()
+{
+    LOCK(cs_blockFileHandles);
+    listBlockFileHandles.clear();
+}
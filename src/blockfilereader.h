@@ -0,0 +1,32 @@
+// Copyright (c) 2018-2020 The DAPS Project developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef PRCYCOIN_BLOCKFILEREADER_H
+#define PRCYCOIN_BLOCKFILEREADER_H
+
+#include <stddef.h>
+
+struct CDiskBlockPos;
+
+/** Maximum number of block and undo files kept open for reading */
+static const size_t MAX_OPEN_BLOCK_FILES = 16;
+
+/**
+ * Read-only access to the block ("blk") and undo ("rev") files. Descriptors of
+ * recently read files stay open in a small LRU and bytes are fetched with
+ * pread, so any thread can read a record without cs_main and without the
+ * open/seek/close of OpenBlockFile. Callers size a CDataStream and read into
+ * it directly, which deserializes without an intermediate copy.
+ */
+
+/** Read nSize bytes at pos into pch */
+bool ReadDiskFile(const CDiskBlockPos& pos, const char* prefix, char* pch, size_t nSize);
+
+/** Read the size of the record at pos, checking the message start written in front of it */
+bool ReadDiskRecordSize(const CDiskBlockPos& pos, const char* prefix, unsigned int& nSize);
+
+/** Close all cached descriptors */
+void CloseBlockFileReaders();
+
+#endif // PRCYCOIN_BLOCKFILEREADER_H
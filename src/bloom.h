@@ -52,6 +52,10 @@ private:
 
     unsigned int Hash(unsigned int nHashNum, const std::vector<unsigned char>& vDataToHash) const;
 
+    // Private constructor for CKeyImageView, no restrictions on size
+    CBloomFilter(unsigned int nElements, double nFPRate, unsigned int nTweak);
+    friend class CKeyImageView;
+
 public:
     /**
      * Creates a new bloom filter which will provide the given fp rate when filled with the given number of elements
@@ -80,3 +80,20 @@ uint256 CBlockIndex::GetBlockTrust() const
         return bnPoWTrust > 1 ? bnPoWTrust : 1;
     }
 }
+
+CBlockIndex* CBlockIndexArena::Allocate()
+{
+    if (nChunkUsed == CHUNK_SIZE) {
+        vChunks.emplace_back(new CBlockIndex[CHUNK_SIZE]);
+        nChunkUsed = 0;
+    }
+    return &vChunks.back()[nChunkUsed++];
+}
+
+void CBlockIndexArena::Splice(CBlockIndexArena& other)
+{
+    // In front of our own chunks, so that the last one keeps being filled
+    vChunks.insert(vChunks.begin(), std::make_move_iterator(other.vChunks.begin()), std::make_move_iterator(other.vChunks.end()));
+    other.vChunks.clear();
+    other.nChunkUsed = CHUNK_SIZE;
+}
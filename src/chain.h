@@ -14,6 +14,7 @@
 #include "uint256.h"
 #include "util.h"
 
+#include <memory>
 #include <vector>
 
 struct CDiskBlockPos {
@@ -95,6 +96,27 @@ enum BlockStatus {
     BLOCK_FAILED_VALID = 32, //! stage after last reached validness failed
     BLOCK_FAILED_CHILD = 64, //! descends from failed block
     BLOCK_FAILED_MASK = BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
+
+    //! PoS block whose ring signatures, bulletproofs and rewards were fully verified,
+    //! so a PoA block auditing it needs no ReVerifyPoSBlock
+    BLOCK_AUDITED = 128,
+};
+
+/**
+ * Header fields of a block index entry that are seldom read and null for all
+ * but PoA blocks and blocks carrying an accumulator checkpoint. They live out
+ * of line so that the common entry does not carry 128 bytes of zeros.
+ */
+struct CBlockIndexExtra {
+    uint256 nAccumulatorCheckpoint;
+    uint256 hashPoAMerkleRoot;
+    uint256 minedHash;
+    uint256 hashPrevPoABlock;
+
+    bool IsNull() const
+    {
+        return nAccumulatorCheckpoint == 0 && hashPoAMerkleRoot == 0 && minedHash == 0 && hashPrevPoABlock == 0;
+    }
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -105,24 +127,33 @@ enum BlockStatus {
 class CBlockIndex
 {
 public:
+    // The fields read while walking the chain (GetAncestor, FindFork, chain work
+    // comparisons) come first, so that a walk touches one or two cache lines per entry.
+
     //! pointer to the hash of the block, if any. memory is owned by this CBlockIndex
     const uint256* phashBlock;
 
     //! pointer to the index of the predecessor of this block
     CBlockIndex* pprev;
 
-    //! pointer to the index of the next block
-    CBlockIndex* pnext;
-
     //! pointer to the index of some further predecessor of this block
     CBlockIndex* pskip;
 
-    //ppcoin: trust score of block chain
-    uint256 bnChainTrust;
-
     //! height of the entry in the chain. The genesis block has height 0
     int nHeight;
 
+    //! Verification status of this block. See enum BlockStatus
+    unsigned int nStatus;
+
+    unsigned int nTime;
+    unsigned int nBits;
+
+    //! (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block
+    uint256 nChainWork;
+
+    //! pointer to the index of the next block
+    CBlockIndex* pnext;
+
     //! Which # file this block is stored in (blk?????.dat)
     int nFile;
 
@@ -132,9 +163,6 @@ public:
     //! Byte offset within rev?????.dat where this block's undo data is stored
     unsigned int nUndoPos;
 
-    //! (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block
-    uint256 nChainWork;
-
     //! Number of transactions in this block.
     //! Note: in a potential headers-first mode, this number cannot be relied upon
     unsigned int nTx;
@@ -144,9 +172,6 @@ public:
     //! Change to 64-bit type when necessary; won't happen before 2030
     unsigned int nChainTx;
 
-    //! Verification status of this block. See enum BlockStatus
-    unsigned int nStatus;
-
     unsigned int nFlags; // ppcoin: block index flags
     enum {
         BLOCK_PROOF_OF_STAKE = (1 << 0), // is proof-of-stake block
@@ -161,22 +186,16 @@ public:
     unsigned int nStakeModifierChecksum; // checksum of index; in-memeory only
     COutPoint prevoutStake;
     unsigned int nStakeTime;
-    uint256 hashProofOfStake;
     int64_t nMint;
     int64_t nMoneySupply;
 
     //! block header
     int nVersion;
     uint256 hashMerkleRoot;
-    unsigned int nTime;
-    unsigned int nBits;
     unsigned int nNonce;
-    uint256 nAccumulatorCheckpoint;
 
-    //! PoA block header
-    uint256 hashPoAMerkleRoot;
-    uint256 minedHash;
-    uint256 hashPrevPoABlock;
+    //! accumulator checkpoint and PoA block header, NULL when they are all null
+    std::shared_ptr<const CBlockIndexExtra> pextra;
 
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
@@ -209,11 +228,7 @@ public:
         nTime = 0;
         nBits = 0;
         nNonce = 0;
-        nAccumulatorCheckpoint = 0;
-
-        hashPoAMerkleRoot = uint256();
-        minedHash = uint256();
-        hashPrevPoABlock = uint256();
+        pextra.reset();
     }
 
     CBlockIndex()
@@ -230,23 +245,22 @@ public:
         nTime = block.nTime;
         nBits = block.nBits;
         nNonce = block.nNonce;
+        CBlockIndexExtra extra;
         if(block.nVersion > 3)
-            nAccumulatorCheckpoint = block.nAccumulatorCheckpoint;
+            extra.nAccumulatorCheckpoint = block.nAccumulatorCheckpoint;
 
         //Proof of Stake
-        bnChainTrust = uint256();
         nMint = 0;
         nMoneySupply = 0;
         nFlags = 0;
         nStakeModifier = 0;
         nStakeModifierChecksum = 0;
-        hashProofOfStake = uint256();
 
         if (block.IsProofOfAudit()) {
             SetProofOfAudit();
-            hashPrevPoABlock = block.hashPrevPoABlock;
-            minedHash = block.minedHash;
-            hashPoAMerkleRoot = block.hashPoAMerkleRoot;
+            extra.hashPrevPoABlock = block.hashPrevPoABlock;
+            extra.minedHash = block.minedHash;
+            extra.hashPoAMerkleRoot = block.hashPoAMerkleRoot;
             prevoutStake.SetNull();
             nStakeTime = 0;
         } else if (block.IsProofOfStake()) {
@@ -257,8 +271,22 @@ public:
             prevoutStake.SetNull();
             nStakeTime = 0;
         }
+        SetExtra(extra);
     }
-    
+
+    void SetExtra(const CBlockIndexExtra& extra)
+    {
+        if (extra.IsNull())
+            pextra.reset();
+        else
+            pextra = std::make_shared<const CBlockIndexExtra>(extra);
+    }
+
+    uint256 GetAccumulatorCheckpoint() const { return pextra ? pextra->nAccumulatorCheckpoint : uint256(); }
+    uint256 GetPoAMerkleRoot() const { return pextra ? pextra->hashPoAMerkleRoot : uint256(); }
+    uint256 GetMinedHash() const { return pextra ? pextra->minedHash : uint256(); }
+    uint256 GetPrevPoABlockHash() const { return pextra ? pextra->hashPrevPoABlock : uint256(); }
+
 
     CDiskBlockPos GetBlockPos() const
     {
@@ -285,9 +313,9 @@ public:
         CBlockHeader block;
         block.nVersion = nVersion;
         if (IsProofOfAudit()) {
-            block.hashPoAMerkleRoot = hashPoAMerkleRoot;
-            block.minedHash = minedHash;
-            block.hashPrevPoABlock = hashPrevPoABlock;
+            block.hashPoAMerkleRoot = GetPoAMerkleRoot();
+            block.minedHash = GetMinedHash();
+            block.hashPrevPoABlock = GetPrevPoABlockHash();
         }  
         if (pprev)
             block.hashPrevBlock = pprev->GetBlockHash();
@@ -295,7 +323,7 @@ public:
         block.nTime = nTime;
         block.nBits = nBits;
         block.nNonce = nNonce;
-        block.nAccumulatorCheckpoint = nAccumulatorCheckpoint;
+        block.nAccumulatorCheckpoint = GetAccumulatorCheckpoint();
         return block;
     }
 
@@ -424,12 +452,44 @@ public:
     const CBlockIndex* GetAncestor(int height) const;
 };
 
+/**
+ * Hands out block index entries from large chunks instead of one heap
+ * allocation each, which saves the allocator overhead per entry and keeps
+ * entries created one after the other next to each other in memory. Entries
+ * keep their address until the arena is destroyed. Not thread safe.
+ */
+class CBlockIndexArena
+{
+public:
+    CBlockIndexArena() : nChunkUsed(CHUNK_SIZE) {}
+
+    CBlockIndex* Allocate();
+
+    //! Take over the entries of another arena, which is left empty
+    void Splice(CBlockIndexArena& other);
+
+private:
+    static const size_t CHUNK_SIZE = 4096;
+
+    std::vector<std::unique_ptr<CBlockIndex[]> > vChunks;
+    size_t nChunkUsed;
+
+    CBlockIndexArena(const CBlockIndexArena&);
+    CBlockIndexArena& operator=(const CBlockIndexArena&);
+};
+
 /** Used to marshal pointers into hashes for db storage. */
 class CDiskBlockIndex : public CBlockIndex
 {
 public:
     uint256 hashPrev;
     uint256 hashNext;
+    uint256 nAccumulatorCheckpoint;
+
+    //! PoA block header
+    uint256 hashPoAMerkleRoot;
+    uint256 minedHash;
+    uint256 hashPrevPoABlock;
 
     CDiskBlockIndex()
     {
@@ -440,10 +500,11 @@ public:
     explicit CDiskBlockIndex(const CBlockIndex* pindex) : CBlockIndex(*pindex)
     {
         hashPrev = (pprev ? pprev->GetBlockHash() : uint256(0));
+        nAccumulatorCheckpoint = pindex->GetAccumulatorCheckpoint();
         if (IsProofOfAudit()) {
-            hashPoAMerkleRoot = pindex->hashPoAMerkleRoot;
-            minedHash = pindex->minedHash;
-            hashPrevPoABlock = pindex->hashPrevPoABlock;
+            hashPoAMerkleRoot = pindex->GetPoAMerkleRoot();
+            minedHash = pindex->GetMinedHash();
+            hashPrevPoABlock = pindex->GetPrevPoABlockHash();
         }
     }
 
@@ -481,7 +542,6 @@ public:
         } else {
             const_cast<CDiskBlockIndex*>(this)->prevoutStake.SetNull();
             const_cast<CDiskBlockIndex*>(this)->nStakeTime = 0;
-            const_cast<CDiskBlockIndex*>(this)->hashProofOfStake = uint256();
         }
 
         // block header
@@ -346,6 +346,22 @@ bool CCryptoKeyStore::GetPubKey(const CKeyID& address, CPubKey& vchPubKeyOut) co
     return false;
 }
 
+bool CCryptoKeyStore::EncryptWalletData(const CKeyingMaterial& vchPlaintext, const uint256& nIV, std::vector<unsigned char>& vchCiphertext) const
+{
+    LOCK(cs_KeyStore);
+    if (!IsCrypted() || vMasterKey.empty())
+        return false;
+    return EncryptSecret(vMasterKey, vchPlaintext, nIV, vchCiphertext);
+}
+
+bool CCryptoKeyStore::DecryptWalletData(const std::vector<unsigned char>& vchCiphertext, const uint256& nIV, CKeyingMaterial& vchPlaintext) const
+{
+    LOCK(cs_KeyStore);
+    if (!IsCrypted() || vMasterKey.empty())
+        return false;
+    return DecryptSecret(vMasterKey, vchCiphertext, nIV, vchPlaintext);
+}
+
 bool CCryptoKeyStore::EncryptKeys(CKeyingMaterial& vMasterKeyIn)
 {
     {
@@ -8,6 +8,10 @@
 
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 // Internal implementation code.
 namespace
 {
@@ -127,9 +131,137 @@ void Transform(uint32_t* s, const unsigned char* chunk)
     s[7] += h;
 }
 
+/** Write the SHA-256 state as a hash, big-endian. */
+void inline WriteState(unsigned char* out, const uint32_t* s)
+{
+    for (int i = 0; i < 8; i++)
+        WriteBE32(out + 4 * i, s[i]);
+}
+
+/** Double SHA-256 of one message given as a single padded block. */
+void DoubleTransform(unsigned char* out, const unsigned char* block)
+{
+    // the second hash is over the 32-byte first one, padded to a single block
+    unsigned char buf[64] = {0};
+    uint32_t s[8];
+    Initialize(s);
+    Transform(s, block);
+    WriteState(buf, s);
+    buf[32] = 0x80;
+    buf[62] = 0x01;
+    Initialize(s);
+    Transform(s, buf);
+    WriteState(out, s);
+}
+
+#if defined(__SSE2__)
+/** The same double hash, over four blocks at once with one block per 32-bit lane. */
+namespace sse2
+{
+typedef __m128i vec;
+
+vec inline K(uint32_t x) { return _mm_set1_epi32(x); }
+vec inline Add(vec x, vec y) { return _mm_add_epi32(x, y); }
+vec inline Add(vec x, vec y, vec z) { return Add(Add(x, y), z); }
+vec inline Add(vec x, vec y, vec z, vec w) { return Add(Add(x, y), Add(z, w)); }
+vec inline Xor(vec x, vec y) { return _mm_xor_si128(x, y); }
+vec inline Xor(vec x, vec y, vec z) { return Xor(Xor(x, y), z); }
+vec inline Or(vec x, vec y) { return _mm_or_si128(x, y); }
+vec inline And(vec x, vec y) { return _mm_and_si128(x, y); }
+vec inline ShR(vec x, int n) { return _mm_srli_epi32(x, n); }
+vec inline ShL(vec x, int n) { return _mm_slli_epi32(x, n); }
+vec inline RotR(vec x, int n) { return Or(ShR(x, n), ShL(x, 32 - n)); }
+
+vec inline Ch(vec x, vec y, vec z) { return Xor(z, And(x, Xor(y, z))); }
+vec inline Maj(vec x, vec y, vec z) { return Or(And(x, y), And(z, Or(x, y))); }
+vec inline Sigma0(vec x) { return Xor(RotR(x, 2), RotR(x, 13), RotR(x, 22)); }
+vec inline Sigma1(vec x) { return Xor(RotR(x, 6), RotR(x, 11), RotR(x, 25)); }
+vec inline sigma0(vec x) { return Xor(RotR(x, 7), RotR(x, 18), ShR(x, 3)); }
+vec inline sigma1(vec x) { return Xor(RotR(x, 17), RotR(x, 19), ShR(x, 10)); }
+
+const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+/** One SHA-256 transformation of four states by the four message schedules w, from the initial state. */
+void Transform(vec* s, vec* w)
+{
+    vec a = K(0x6a09e667ul), b = K(0xbb67ae85ul), c = K(0x3c6ef372ul), d = K(0xa54ff53aul);
+    vec e = K(0x510e527ful), f = K(0x9b05688cul), g = K(0x1f83d9abul), h = K(0x5be0cd19ul);
+    for (int i = 0; i < 64; i++) {
+        if (i >= 16)
+            w[i & 15] = Add(w[i & 15], sigma1(w[(i + 14) & 15]), w[(i + 9) & 15], sigma0(w[(i + 1) & 15]));
+        vec t1 = Add(Add(h, Sigma1(e)), Ch(e, f, g), K(k[i]), w[i & 15]);
+        vec t2 = Add(Sigma0(a), Maj(a, b, c));
+        h = g;
+        g = f;
+        f = e;
+        e = Add(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = Add(t1, t2);
+    }
+    s[0] = Add(a, K(0x6a09e667ul));
+    s[1] = Add(b, K(0xbb67ae85ul));
+    s[2] = Add(c, K(0x3c6ef372ul));
+    s[3] = Add(d, K(0xa54ff53aul));
+    s[4] = Add(e, K(0x510e527ful));
+    s[5] = Add(f, K(0x9b05688cul));
+    s[6] = Add(g, K(0x1f83d9abul));
+    s[7] = Add(h, K(0x5be0cd19ul));
+}
+
+void DoubleTransform4(unsigned char* out, const unsigned char* blocks)
+{
+    vec w[16], s[8];
+    for (int i = 0; i < 16; i++)
+        w[i] = _mm_set_epi32(ReadBE32(blocks + 192 + 4 * i), ReadBE32(blocks + 128 + 4 * i), ReadBE32(blocks + 64 + 4 * i), ReadBE32(blocks + 4 * i));
+    Transform(s, w);
+
+    for (int i = 0; i < 8; i++)
+        w[i] = s[i];
+    w[8] = K(0x80000000ul);
+    for (int i = 9; i < 15; i++)
+        w[i] = K(0);
+    w[15] = K(256);
+    Transform(s, w);
+
+    uint32_t lanes[4];
+    for (int i = 0; i < 8; i++) {
+        _mm_storeu_si128((vec*)lanes, s[i]);
+        for (int j = 0; j < 4; j++)
+            WriteBE32(out + 32 * j + 4 * i, lanes[j]);
+    }
+}
+} // namespace sse2
+#endif
+
 } // namespace sha256
 } // namespace
 
+void SHA256DSingleBlock(unsigned char* out, const unsigned char* blocks, size_t nBlocks)
+{
+#if defined(__SSE2__)
+    for (; nBlocks >= 4; nBlocks -= 4) {
+        sha256::sse2::DoubleTransform4(out, blocks);
+        out += 128;
+        blocks += 256;
+    }
+#endif
+    for (; nBlocks > 0; nBlocks--) {
+        sha256::DoubleTransform(out, blocks);
+        out += 32;
+        blocks += 64;
+    }
+}
+
 
 ////// SHA-256
 
@@ -25,4 +25,12 @@ public:
     CSHA256& Reset();
 };
 
+/**
+ * Double SHA-256 of nBlocks messages of at most 55 bytes each. Every message is
+ * passed as the 64-byte block holding it and its SHA-256 padding, the hashes are
+ * written one after the other to out. Four messages are hashed at once where SSE2
+ * is available.
+ */
+void SHA256DSingleBlock(unsigned char* out, const unsigned char* blocks, size_t nBlocks);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
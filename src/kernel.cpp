@@ -7,6 +7,8 @@
 
 #include <boost/assign/list_of.hpp>
 
+#include "crypto/common.h"
+#include "crypto/sha256.h"
 #include "db.h"
 #include "kernel.h"
 #include "script/interpreter.h"
@@ -240,11 +242,36 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeMod
     return true;
 }
 
+/** Kernel stake modifier of a block, valid as long as the block it was taken from is in the active chain */
+struct CKernelStakeModifier {
+    const CBlockIndex* pindexModifier;
+    uint64_t nStakeModifier;
+    int nStakeModifierHeight;
+    int64_t nStakeModifierTime;
+};
+
+static RecursiveMutex cs_kernelStakeModifiers;
+static std::map<uint256, CKernelStakeModifier> mapKernelStakeModifiers;
+/** Number of kernel stake modifiers kept before the cache is emptied */
+static const size_t MAX_KERNEL_STAKE_MODIFIERS = 100000;
+
 // The stake modifier used to hash for a stake kernel is chosen as the stake
 // modifier about a selection interval later than the coin generating the kernel
 bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
 {
     nStakeModifier = 0;
+    {
+        // the modifier only depends on the blocks up to the one it was taken from,
+        // which are all still in the active chain if that one is
+        LOCK(cs_kernelStakeModifiers);
+        std::map<uint256, CKernelStakeModifier>::const_iterator it = mapKernelStakeModifiers.find(hashBlockFrom);
+        if (it != mapKernelStakeModifiers.end() && chainActive.Contains(it->second.pindexModifier)) {
+            nStakeModifier = it->second.nStakeModifier;
+            nStakeModifierHeight = it->second.nStakeModifierHeight;
+            nStakeModifierTime = it->second.nStakeModifierTime;
+            return true;
+        }
+    }
     if (!mapBlockIndex.count(hashBlockFrom))
         return error("GetKernelStakeModifier() : block not indexed");
     const CBlockIndex* pindexFrom = mapBlockIndex[hashBlockFrom];
@@ -268,14 +295,52 @@ bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int
         }
     }
     nStakeModifier = pindex->nStakeModifier;
+
+    LOCK(cs_kernelStakeModifiers);
+    if (mapKernelStakeModifiers.size() >= MAX_KERNEL_STAKE_MODIFIERS)
+        mapKernelStakeModifiers.clear();
+    CKernelStakeModifier& entry = mapKernelStakeModifiers[hashBlockFrom];
+    entry.pindexModifier = pindex;
+    entry.nStakeModifier = nStakeModifier;
+    entry.nStakeModifierHeight = nStakeModifierHeight;
+    entry.nStakeModifierTime = nStakeModifierTime;
     return true;
 }
 
-uint256 stakeHash(unsigned int nTimeTx, CDataStream ss, unsigned int prevoutIndex, uint256 prevoutHash, unsigned int nTimeBlockFrom)
+const unsigned int CStakeKernel::BATCH_SIZE;
+
+CStakeKernel::CStakeKernel(uint64_t nStakeModifier, unsigned int nTimeBlockFrom, const COutPoint& prevout)
 {
     //Prcycoin will hash in the transaction hash and the index number in order to make sure each hash is unique
-    ss << nTimeBlockFrom << prevoutIndex << prevoutHash << nTimeTx;
-    return Hash(ss.begin(), ss.end());
+    memset(vchBlock, 0, sizeof(vchBlock));
+    WriteLE64(vchBlock, nStakeModifier);
+    WriteLE32(vchBlock + 8, nTimeBlockFrom);
+    WriteLE32(vchBlock + 12, prevout.n);
+    memcpy(vchBlock + 16, prevout.hash.begin(), 32);
+    //the timestamp goes at TIME_OFFSET, followed by the SHA-256 padding of the 52-byte preimage
+    vchBlock[TIME_OFFSET + 4] = 0x80;
+    WriteBE64(vchBlock + 56, (TIME_OFFSET + 4) * 8);
+}
+
+uint256 CStakeKernel::GetHash(unsigned int nTimeTx) const
+{
+    uint256 hash;
+    GetHashes(nTimeTx, 1, &hash);
+    return hash;
+}
+
+void CStakeKernel::GetHashes(unsigned int nTimeFirst, unsigned int nCount, uint256* hashes) const
+{
+    assert(nCount <= BATCH_SIZE);
+    unsigned char blocks[64 * BATCH_SIZE];
+    unsigned char out[32 * BATCH_SIZE];
+    for (unsigned int i = 0; i < nCount; i++) {
+        memcpy(blocks + 64 * i, vchBlock, 64);
+        WriteLE32(blocks + 64 * i + TIME_OFFSET, nTimeFirst - i);
+    }
+    SHA256DSingleBlock(out, blocks, nCount);
+    for (unsigned int i = 0; i < nCount; i++)
+        memcpy(hashes[i].begin(), out + 32 * i, 32);
 }
 
 //test hash vs target
@@ -302,6 +367,11 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlockHeader blockFrom, cons
     if (txPrev.IsCoinBase() || txPrev.IsCoinStake()) {
         nValueIn = txPrev.vout[prevout.n].nValue;
     }
+    return CheckStakeKernelHash(nBits, blockFrom, prevout, nValueIn, nTimeTx, nHashDrift, fCheck, hashProofOfStake, fPrintProofOfStake);
+}
+
+bool CheckStakeKernelHash(unsigned int nBits, const CBlockHeader& blockFrom, const COutPoint& prevout, CAmount nValueIn, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake)
+{
     unsigned int nTimeBlockFrom = blockFrom.GetBlockTime();
 
     if (nTimeTx < nTimeBlockFrom) // Transaction timestamp violation
@@ -312,6 +382,8 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlockHeader blockFrom, cons
     //grab difficulty
     uint256 bnTargetPerCoinDay;
     bnTargetPerCoinDay.SetCompact(nBits);
+    //the stake hash has to be below the coin weight times the target, as in stakeTargetHit
+    const uint256 bnTarget = (uint256(nValueIn) / 100) * bnTargetPerCoinDay;
 
     //grab stake modifier
     uint64_t nStakeModifier = 0;
@@ -322,46 +394,43 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlockHeader blockFrom, cons
         return false;
     }
 
-    //create data stream once instead of repeating it in the loop
-    CDataStream ss(SER_GETHASH, 0);
-    ss << nStakeModifier;
-    //LogPrintf("%s: stake modifier = %d", __func__, nStakeModifier);
+    //lay out the kernel once instead of repeating it in the loop
+    CStakeKernel kernel(nStakeModifier, nTimeBlockFrom, prevout);
     //if wallet is simply checking to make sure a hash is valid
     if (fCheck) {
-        hashProofOfStake = stakeHash(nTimeTx, ss, prevout.n, prevout.hash, nTimeBlockFrom);
-        return stakeTargetHit(hashProofOfStake, nValueIn, bnTargetPerCoinDay);
+        hashProofOfStake = kernel.GetHash(nTimeTx);
+        return hashProofOfStake < bnTarget;
     }
 
     bool fSuccess = false;
-    unsigned int nTryTime = 0;
-    unsigned int i;
     int nHeightStart = chainActive.Height();
-    for (i = 0; i < (nHashDrift); i++) //iterate the hashing
-    {
+    uint256 hashes[CStakeKernel::BATCH_SIZE];
+    //try nTimeTx + nHashDrift down to nTimeTx + 1, a batch of timestamps at a time
+    for (unsigned int i = 0; i < nHashDrift && !fSuccess; i += CStakeKernel::BATCH_SIZE) {
         //new block came in, move on
         if (chainActive.Height() != nHeightStart)
             break;
 
-        //hash this iteration
-        nTryTime = nTimeTx + nHashDrift - i;
-        hashProofOfStake = stakeHash(nTryTime, ss, prevout.n, prevout.hash, nTimeBlockFrom);
-
-        // if stake hash does not meet the target then continue to next iteration
-        if (!stakeTargetHit(hashProofOfStake, nValueIn, bnTargetPerCoinDay)) {
-            continue;
-        }
-
-        fSuccess = true; // if we make it this far then we have successfully created a stake hash
-        nTimeTx = nTryTime;
-
-        if (fDebug || fPrintProofOfStake) {
-                LogPrintf("CheckStakeKernelHash() : using modifier %s at height=%d timestamp=%s for block from height=%d timestamp=%s\n",
-                std::to_string(nStakeModifier).c_str(), nStakeModifierHeight,
-                DateTimeStrFormat("%Y-%m-%d %H:%M:%S", nStakeModifierTime).c_str(),
-                mapBlockIndex[blockFrom.GetHash()]->nHeight,
-                DateTimeStrFormat("%Y-%m-%d %H:%M:%S", blockFrom.GetBlockTime()).c_str());
+        const unsigned int nCount = std::min(nHashDrift - i, CStakeKernel::BATCH_SIZE);
+        kernel.GetHashes(nTimeTx + nHashDrift - i, nCount, hashes);
+        for (unsigned int j = 0; j < nCount; j++) {
+            // if stake hash does not meet the target then continue to next timestamp
+            if (!(hashes[j] < bnTarget))
+                continue;
+
+            fSuccess = true; // if we make it this far then we have successfully created a stake hash
+            hashProofOfStake = hashes[j];
+            nTimeTx = nTimeTx + nHashDrift - i - j;
+
+            if (fDebug || fPrintProofOfStake) {
+                    LogPrintf("CheckStakeKernelHash() : using modifier %s at height=%d timestamp=%s for block from height=%d timestamp=%s\n",
+                    std::to_string(nStakeModifier).c_str(), nStakeModifierHeight,
+                    DateTimeStrFormat("%Y-%m-%d %H:%M:%S", nStakeModifierTime).c_str(),
+                    mapBlockIndex[blockFrom.GetHash()]->nHeight,
+                    DateTimeStrFormat("%Y-%m-%d %H:%M:%S", blockFrom.GetBlockTime()).c_str());
+            }
+            break;
         }
-        break;
     }
 
     mapHashedBlocks.clear();
@@ -409,14 +478,14 @@ bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake)
 }
 
 // Get stake modifier checksum
-unsigned int GetStakeModifierChecksum(const CBlockIndex* pindex)
+unsigned int GetStakeModifierChecksum(const CBlockIndex* pindex, const uint256& hashProofOfStake)
 {
     assert(pindex->pprev || pindex->GetBlockHash() == Params().HashGenesisBlock());
     // Hash previous checksum with flags, hashProofOfStake and nStakeModifier
     CDataStream ss(SER_GETHASH, 0);
     if (pindex->pprev)
         ss << pindex->pprev->nStakeModifierChecksum;
-    ss << pindex->nFlags << pindex->hashProofOfStake << pindex->nStakeModifier;
+    ss << pindex->nFlags << hashProofOfStake << pindex->nStakeModifier;
     uint256 hashChecksum = Hash(ss.begin(), ss.end());
     hashChecksum >>= (256 - 32);
     return hashChecksum.Get64();
@@ -22,18 +22,37 @@ static const int MODIFIER_INTERVAL_RATIO = 3;
 // Compute the hash modifier for proof-of-stake
 bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeModifier, bool& fGeneratedStakeModifier);
 
+// Stake kernel hashes of one coin. The preimage is the stake modifier, the time of
+// the coin's block, the outpoint and the timestamp; everything but the timestamp is
+// laid out once in a padded SHA-256 block, and timestamps are hashed in batches.
+class CStakeKernel
+{
+public:
+    static const unsigned int BATCH_SIZE = 64;
+
+    CStakeKernel(uint64_t nStakeModifier, unsigned int nTimeBlockFrom, const COutPoint& prevout);
+    uint256 GetHash(unsigned int nTimeTx) const;
+    // hashes[i] = GetHash(nTimeFirst - i) for i < nCount, at most BATCH_SIZE
+    void GetHashes(unsigned int nTimeFirst, unsigned int nCount, uint256* hashes) const;
+
+private:
+    static const unsigned int TIME_OFFSET = 48;
+    unsigned char vchBlock[64];
+};
+
 // Check whether stake kernel meets hash target
 // Sets hashProofOfStake on success return
-uint256 stakeHash(unsigned int nTimeTx, CDataStream ss, unsigned int prevoutIndex, uint256 prevoutHash, unsigned int nTimeBlockFrom);
 bool stakeTargetHit(uint256 hashProofOfStake, int64_t nValueIn, uint256 bnTargetPerCoinDay);
 bool CheckStakeKernelHash(unsigned int nBits, const CBlockHeader blockFrom, const CTransaction txPrev, const COutPoint prevout, const unsigned char* encryptionKey, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake = false);
+// Same for a coin whose amount nValueIn is already known
+bool CheckStakeKernelHash(unsigned int nBits, const CBlockHeader& blockFrom, const COutPoint& prevout, CAmount nValueIn, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake = false);
 
 // Check kernel hash target and coinstake signature
 // Sets hashProofOfStake on success return
 bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake);
 
 // Get stake modifier checksum
-unsigned int GetStakeModifierChecksum(const CBlockIndex* pindex);
+unsigned int GetStakeModifierChecksum(const CBlockIndex* pindex, const uint256& hashProofOfStake);
 
 // Check stake modifier hard checkpoints
 bool CheckStakeModifierCheckpoints(int nHeight, unsigned int nStakeModifierChecksum);
@@ -9,6 +9,7 @@
 #include "main.h"
 
 #include "addrman.h"
+#include "blockfilereader.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -21,6 +22,8 @@
 #include "net.h"
 #include "obfuscation.h"
 #include "poa.h"
+#include "ringctcache.h"
+#include "startupprofile.h"
 #include "swifttx.h"
 #include "txdb.h"
 #include "txmempool.h"
@@ -29,6 +32,7 @@
 #include "utilmoneystr.h"
 #include "validationinterface.h"
 
+#include <memory>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -157,6 +161,13 @@ int nSyncStarted = 0;
 /** All pairs A->B, where A (or one if its ancestors) misses transactions, but B has transactions. */
 multimap<CBlockIndex*, CBlockIndex*> mapBlocksUnlinked;
 
+/**
+     * Holds all block index entries, which live for the lifetime of the process.
+     * Changed together with mapBlockIndex, under cs_main or while the block
+     * index is loaded.
+     */
+CBlockIndexArena blockIndexArena;
+
 RecursiveMutex cs_LastBlockFile;
 std::vector<CBlockFileInfo> vinfoBlockFile;
 int nLastBlockFile = 0;
@@ -260,19 +271,16 @@ double GetPriority(const CTransaction& tx, int nHeight)
     return 1000000000 + tx.ComputePriority(dResult);
 }
 
-bool IsKeyImageSpend1(const std::string& kiHex, const uint256& againsHash)
+bool IsKeyImageSpend1(const CKeyImage& keyImage, const uint256& againsHash)
 {
-    if (kiHex.empty()) return false;
-    std::vector<uint256> bhs;
-    if (!pblocktree->ReadKeyImages(kiHex, bhs)) {
+    if (keyImage.size() == 0) return false;
+    std::vector<CKeyImageSpend> spends;
+    if (!pkeyimages->GetSpends(keyImage, spends)) {
         //not spent yet because not found in database
         return false;
     }
-    if (bhs.empty()) {
-        return false;
-    }
-    for (int i = 0; i < bhs.size(); i++) {
-        uint256 bh = bhs[i];
+    for (const CKeyImageSpend& spend : spends) {
+        const uint256& bh = spend.hashBlock;
         if (againsHash.IsNull()) {
             //check if bh is in main chain
             // Find the block it claims to be in
@@ -297,20 +305,17 @@ bool IsKeyImageSpend1(const std::string& kiHex, const uint256& againsHash)
     return false;
 }
 
-bool CheckKeyImageSpendInMainChain(const std::string& kiHex, int& confirmations)
+bool CheckKeyImageSpendInMainChain(const CKeyImage& keyImage, int& confirmations)
 {
     confirmations = 0;
-    if (kiHex.empty()) return false;
-    std::vector<uint256> bhs;
-    if (!pblocktree->ReadKeyImages(kiHex, bhs)) {
+    if (keyImage.size() == 0) return false;
+    std::vector<CKeyImageSpend> spends;
+    if (!pkeyimages->GetSpends(keyImage, spends)) {
         //not spent yet because not found in database
         return false;
     }
-    if (bhs.empty()) {
-        return false;
-    }
-    for (int i = 0; i < bhs.size(); i++) {
-        uint256 bh = bhs[i];
+    for (const CKeyImageSpend& spend : spends) {
+        const uint256& bh = spend.hashBlock;
         //check if bh is in main chain
         // Find the block it claims to be in
         BlockMap::iterator mi = mapBlockIndex.find(bh);
@@ -327,35 +332,85 @@ bool CheckKeyImageSpendInMainChain(const std::string& kiHex, int& confirmations)
 
 secp256k1_context2* GetContext()
 {
-    static secp256k1_context2* both;
-    if (!both) both = secp256k1_context_create2(SECP256K1_CONTEXT_SIGN | SECP256K1_CONTEXT_VERIFY);
+    static secp256k1_context2* both = secp256k1_context_create2(SECP256K1_CONTEXT_SIGN | SECP256K1_CONTEXT_VERIFY);
     return both;
 }
 
-secp256k1_scratch_space2* GetScratch()
+secp256k1_bulletproof_generators* GetGenerator()
 {
-    static secp256k1_scratch_space2* scratch;
-    if (!scratch) scratch = secp256k1_scratch_space_create(GetContext(), 1024 * 1024 * 512);
-    return scratch;
+    static secp256k1_bulletproof_generators* generator = secp256k1_bulletproof_generators_create_with_pregenerated(GetContext());
+    return generator;
 }
 
-secp256k1_bulletproof_generators* GetGenerator()
+namespace
 {
-    static secp256k1_bulletproof_generators* generator;
-    if (!generator) generator = secp256k1_bulletproof_generators_create_with_pregenerated(GetContext());
-    return generator;
+/** Scratch space for bulletproof proving or verification, owned by the calling thread */
+struct CBulletproofScratch {
+    secp256k1_scratch_space2* scratch;
+    size_t nSize;
+
+    CBulletproofScratch() : scratch(NULL), nSize(0) {}
+    ~CBulletproofScratch()
+    {
+        if (scratch) secp256k1_scratch_space_destroy(scratch);
+    }
+};
+} // namespace
+
+secp256k1_scratch_space2* GetVerifyScratch(size_t nProofs, size_t nCommits)
+{
+    static thread_local CBulletproofScratch verifyScratch;
+    // each proof covers 64 bits per output, padded to a power of two outputs
+    size_t nPadded = 1;
+    while (nPadded < nCommits)
+        nPadded <<= 1;
+    size_t nLog = 0;
+    while ((size_t(1) << nLog) < 64 * nPadded)
+        nLog++;
+    // the generators are shared by the batch, every proof adds its own inner product and commitment points
+    const size_t nPoints = 2 * 64 * nPadded + 2 + nProofs * (2 * nLog + 5 + nCommits);
+    const size_t nSize = BULLETPROOF_VERIFY_SCRATCH_BASE + nPoints * BULLETPROOF_VERIFY_SCRATCH_PER_POINT + nProofs * BULLETPROOF_VERIFY_SCRATCH_PER_PROOF;
+    if (nSize > verifyScratch.nSize) {
+        if (verifyScratch.scratch) secp256k1_scratch_space_destroy(verifyScratch.scratch);
+        verifyScratch.scratch = secp256k1_scratch_space_create(GetContext(), nSize);
+        verifyScratch.nSize = nSize;
+    }
+    return verifyScratch.scratch;
+}
+
+secp256k1_scratch_space2* GetProveScratch(size_t nOutputs)
+{
+    static thread_local CBulletproofScratch proveScratch;
+    // the aggregate proof covers 64 bits per output, padded to a power of two outputs
+    size_t nPadded = 1;
+    while (nPadded < nOutputs)
+        nPadded <<= 1;
+    const size_t nSize = 64 * nPadded * BULLETPROOF_PROVE_SCRATCH_PER_BIT;
+    if (nSize > proveScratch.nSize) {
+        if (proveScratch.scratch) secp256k1_scratch_space_destroy(proveScratch.scratch);
+        proveScratch.scratch = secp256k1_scratch_space_create(GetContext(), nSize);
+        proveScratch.nSize = nSize;
+    }
+    return proveScratch.scratch;
 }
 
 void DestroyContext()
 {
     secp256k1_bulletproof_generators_destroy(GetContext(), GetGenerator());
-    secp256k1_scratch_space_destroy(GetScratch());
     secp256k1_context_destroy(GetContext());
 }
 
-bool VerifyBulletProofAggregate(const CTransaction& tx)
+bool VerifyBulletProofAggregate(const CTransaction& tx, bool fStore)
 {
     if (IsInitialBlockDownload()) return true;
+    if (IsBulletproofCached(tx)) return true;
+    if (!VerifyBulletProof(tx)) return false;
+    if (fStore) CacheBulletproof(tx);
+    return true;
+}
+
+bool VerifyBulletProof(const CTransaction& tx)
+{
     size_t len = tx.bulletproofs.size();
     if (tx.vout.size() >= 5) return false;
 
@@ -367,13 +422,65 @@ bool VerifyBulletProofAggregate(const CTransaction& tx)
         if (!secp256k1_pedersen_commitment_parse(GetContext(), &commitments[i], &(tx.vout[i].commitment[0])))
             throw runtime_error("Failed to parse pedersen commitment");
     }
-    return secp256k1_bulletproof_rangeproof_verify(GetContext(), GetScratch(), GetGenerator(), &(tx.bulletproofs[0]), len, NULL, commitments, tx.vout.size(), 64, &secp256k1_generator_const_h, NULL, 0);
+    return secp256k1_bulletproof_rangeproof_verify(GetContext(), GetVerifyScratch(1, tx.vout.size()), GetGenerator(), &(tx.bulletproofs[0]), len, NULL, commitments, tx.vout.size(), 64, &secp256k1_generator_const_h, NULL, 0);
 }
 
-bool VerifyRingSignatureWithTxFee(const CTransaction& tx, CBlockIndex* pindex)
+bool VerifyBulletProofBatch(const std::vector<const CTransaction*>& vtx, size_t* pnFailed)
+{
+    const size_t MAX_VOUT = 5;
+    struct CBulletProofEntry {
+        size_t nIndex;
+        secp256k1_pedersen_commitment commitments[MAX_VOUT];
+    };
+
+    // verify_multi needs proofs of equal length over the same number of commitments
+    std::map<std::pair<size_t, size_t>, std::vector<CBulletProofEntry> > mapGroups;
+    for (size_t i = 0; i < vtx.size(); i++) {
+        const CTransaction& tx = *vtx[i];
+        bool fValid = !tx.bulletproofs.empty() && !tx.vout.empty() && tx.vout.size() < MAX_VOUT;
+        CBulletProofEntry entry;
+        entry.nIndex = i;
+        for (size_t j = 0; fValid && j < tx.vout.size(); j++) {
+            fValid = tx.vout[j].commitment.size() >= 33 &&
+                     secp256k1_pedersen_commitment_parse(GetContext(), &entry.commitments[j], &(tx.vout[j].commitment[0]));
+        }
+        if (!fValid) {
+            if (pnFailed) *pnFailed = i;
+            return false;
+        }
+        mapGroups[std::make_pair(tx.vout.size(), tx.bulletproofs.size())].push_back(entry);
+    }
+
+    for (const auto& group : mapGroups) {
+        const size_t nCommits = group.first.first;
+        const size_t nProofLen = group.first.second;
+        const std::vector<CBulletProofEntry>& vEntries = group.second;
+        for (size_t nStart = 0; nStart < vEntries.size(); nStart += MAX_BULLETPROOF_BATCH) {
+            const size_t nEnd = std::min(vEntries.size(), nStart + MAX_BULLETPROOF_BATCH);
+            std::vector<const unsigned char*> vProofs;
+            std::vector<const secp256k1_pedersen_commitment*> vCommits;
+            std::vector<secp256k1_generator> vValueGens(nEnd - nStart, secp256k1_generator_const_h);
+            for (size_t k = nStart; k < nEnd; k++) {
+                vProofs.push_back(&(vtx[vEntries[k].nIndex]->bulletproofs[0]));
+                vCommits.push_back(vEntries[k].commitments);
+            }
+            if (secp256k1_bulletproof_rangeproof_verify_multi(GetContext(), GetVerifyScratch(vProofs.size(), nCommits), GetGenerator(), &vProofs[0], vProofs.size(), nProofLen, NULL, &vCommits[0], nCommits, 64, &vValueGens[0], NULL, NULL))
+                continue;
+            // Find the offender; the batch may also have failed for lack of scratch space
+            for (size_t k = nStart; k < nEnd; k++) {
+                if (!VerifyBulletProof(*vtx[vEntries[k].nIndex])) {
+                    if (pnFailed) *pnFailed = vEntries[k].nIndex;
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool GetRingSignatureMatrix(const CTransaction& tx, CBlockIndex* pindex, CRingSignatureMatrix& matrix)
 {
     if (tx.nTxFee < 0) return false;
-    if (IsInitialBlockDownload()) return true;
     const size_t MAX_VIN = MAX_TX_INPUTS;
     const size_t MAX_DECOYS = MAX_RING_SIZE; //padding 1 for safety reasons
     const size_t MAX_VOUT = 5;
@@ -397,22 +504,45 @@ bool VerifyRingSignatureWithTxFee(const CTransaction& tx, CBlockIndex* pindex)
         LogPrintf("The number of decoys RingSize %d not within range [%d, %d]\n", tx.vin[0].decoys.size(), MIN_RING_SIZE, MAX_RING_SIZE);
         return false; //maximum decoys = 15
     }
+    if (tx.vout.size() > MAX_VOUT) {
+        LogPrintf("Tx output too many\n");
+        return false;
+    }
 
-    unsigned char allInPubKeys[MAX_VIN + 1][MAX_DECOYS + 1][33];
-    unsigned char allKeyImages[MAX_VIN + 1][33];
-    unsigned char allInCommitments[MAX_VIN][MAX_DECOYS + 1][33];
-    unsigned char allOutCommitments[MAX_VOUT][33];
+    const size_t nRows = tx.vin.size() + 1;
+    const size_t nCols = tx.vin[0].decoys.size() + 1;
+    if (tx.S.size() < nCols) {
+        LogPrintf("Transaction %s has too few ring signature columns\n", tx.GetHash().GetHex());
+        return false;
+    }
+    for (size_t j = 0; j < nCols; j++) {
+        if (tx.S[j].size() < nRows) {
+            LogPrintf("Transaction %s has too few ring signature rows\n", tx.GetHash().GetHex());
+            return false;
+        }
+    }
+
+    matrix.txid = tx.GetHash();
+    matrix.hashSig = GetTxSignatureHash(tx);
+    matrix.c = tx.c;
+    matrix.nRows = nRows;
+    matrix.nCols = nCols;
+    matrix.vPubKeys.assign(nRows * nCols, CPubKey());
+    matrix.vKeyImages.clear();
+    matrix.vS.clear();
+    matrix.vS.reserve(nRows * nCols);
 
-    unsigned char SIJ[MAX_VIN + 1][MAX_DECOYS + 1][32];
-    unsigned char LIJ[MAX_VIN + 1][MAX_DECOYS + 1][33];
-    unsigned char RIJ[MAX_VIN + 1][MAX_DECOYS + 1][33];
+    unsigned char allInCommitments[MAX_VIN][MAX_DECOYS + 1][33];
 
     secp256k1_context2* both = GetContext();
 
-    //generating LIJ and RIJ at PI
-    for (size_t j = 0; j < tx.vin.size(); j++) {
-        memcpy(allKeyImages[j], tx.vin[j].keyImage.begin(), 33);
+    for (size_t i = 0; i < tx.vin.size(); i++) {
+        matrix.vKeyImages.push_back(tx.vin[i].keyImage);
     }
+    matrix.vKeyImages.push_back(tx.ntxFeeKeyImage);
+
+    CBlockIndex* tip = chainActive.Tip();
+    if (!pindex) tip = pindex;
 
     //extract all public keys
     for (size_t i = 0; i < tx.vin.size(); i++) {
@@ -421,19 +551,15 @@ bool VerifyRingSignatureWithTxFee(const CTransaction& tx, CBlockIndex* pindex)
         for (size_t j = 0; j < tx.vin[i].decoys.size(); j++) {
             decoysForIn.push_back(tx.vin[i].decoys[j]);
         }
-        for (size_t j = 0; j < tx.vin[0].decoys.size() + 1; j++) {
-            CTransaction txPrev;
-            uint256 hashBlock;
-            if (!GetTransaction(decoysForIn[j].hash, txPrev, hashBlock)) {
+        for (size_t j = 0; j < nCols; j++) {
+            CRingMemberOutput member;
+            if (!GetRingMemberOutput(decoysForIn[j], member)) {
                 LogPrintf("failed to find transaction %s\n", decoysForIn[j].hash.GetHex());
                 return false;
             }
-            CBlockIndex* tip = chainActive.Tip();
-            if (!pindex) tip = pindex;
 
-            uint256 hashTip = tip->GetBlockHash();
             //verify that tip and hashBlock must be in the same fork
-            CBlockIndex* atTheblock = mapBlockIndex[hashBlock];
+            CBlockIndex* atTheblock = mapBlockIndex[member.hashBlock];
             if (!atTheblock) {
                 LogPrintf("Decoy for transactions %s not in the same chain with block %s\n", decoysForIn[j].hash.GetHex(), tip->GetBlockHash().GetHex());
                 return false;
@@ -445,25 +571,26 @@ bool VerifyRingSignatureWithTxFee(const CTransaction& tx, CBlockIndex* pindex)
                 }
             }
 
-            CPubKey extractedPub;
-            if (!ExtractPubKey(txPrev.vout[decoysForIn[j].n].scriptPubKey, extractedPub)) {
+            if (!member.HasCommitment()) {
+                LogPrintf("Ring member %s does not exist\n", decoysForIn[j].ToString());
+                return false;
+            }
+            if (!member.HasPubKey()) {
                 LogPrintf("failed to extract pubkey\n");
                 return false;
             }
-            memcpy(allInPubKeys[i][j], extractedPub.begin(), 33);
-            memcpy(allInCommitments[i][j], &(txPrev.vout[decoysForIn[j].n].commitment[0]), 33);
+            matrix.vPubKeys[j * nRows + i].Set(member.vchPubKey, member.vchPubKey + 33);
+            memcpy(allInCommitments[i][j], member.vchCommitment, 33);
         }
     }
-    memcpy(allKeyImages[tx.vin.size()], tx.ntxFeeKeyImage.begin(), 33);
 
-    for (size_t i = 0; i < tx.vin[0].decoys.size() + 1; i++) {
-        std::vector<uint256> S_column = tx.S[i];
-        for (size_t j = 0; j < tx.vin.size() + 1; j++) {
-            memcpy(SIJ[j][i], S_column[j].begin(), 32);
+    for (size_t j = 0; j < nCols; j++) {
+        for (size_t i = 0; i < nRows; i++) {
+            matrix.vS.push_back(tx.S[j][i]);
         }
     }
 
-    //compute allInPubKeys[tx.vin.size()][..]
+    //compute the commitment balance keys of the last row
     secp256k1_pedersen_commitment allInCommitmentsPacked[MAX_VIN][MAX_DECOYS + 1];
     secp256k1_pedersen_commitment allOutCommitmentsPacked[MAX_VOUT + 1]; //+1 for tx fee
 
@@ -472,8 +599,7 @@ bool VerifyRingSignatureWithTxFee(const CTransaction& tx, CBlockIndex* pindex)
             LogPrintf("Commitment could not be null\n");
             return false;
         }
-        memcpy(allOutCommitments[i], &(tx.vout[i].commitment[0]), 33);
-        if (!secp256k1_pedersen_commitment_parse(both, &allOutCommitmentsPacked[i], allOutCommitments[i])) {
+        if (!secp256k1_pedersen_commitment_parse(both, &allOutCommitmentsPacked[i], &(tx.vout[i].commitment[0]))) {
             LogPrintf("failed to parse commitment\n");
             return false;
         }
@@ -485,8 +611,7 @@ bool VerifyRingSignatureWithTxFee(const CTransaction& tx, CBlockIndex* pindex)
     if (!secp256k1_pedersen_commit(both, &allOutCommitmentsPacked[tx.vout.size()], txFeeBlind, tx.nTxFee, &secp256k1_generator_const_h, &secp256k1_generator_const_g))
         throw runtime_error("Failed to computed commitment");
 
-    //filling the additional pubkey elements for decoys: allInPubKeys[wtxNew.vin.size()][..]
-    //allInPubKeys[wtxNew.vin.size()][j] = sum of allInPubKeys[..][j] + sum of allInCommitments[..][j] + sum of allOutCommitments
+    //the last row for ring member j = sum of the ring keys of column j + sum of input commitments of column j - sum of output commitments
     const secp256k1_pedersen_commitment* outCptr[MAX_VOUT + 1];
     for (size_t i = 0; i < tx.vout.size() + 1; i++) {
         outCptr[i] = &allOutCommitmentsPacked[i];
@@ -494,12 +619,17 @@ bool VerifyRingSignatureWithTxFee(const CTransaction& tx, CBlockIndex* pindex)
 
     secp256k1_pedersen_commitment inPubKeysToCommitments[MAX_VIN][MAX_DECOYS + 1];
     for (size_t i = 0; i < tx.vin.size(); i++) {
-        for (size_t j = 0; j < tx.vin[0].decoys.size() + 1; j++) {
-            secp256k1_pedersen_serialized_pubkey_to_commitment(allInPubKeys[i][j], 33, &inPubKeysToCommitments[i][j]);
+        for (size_t j = 0; j < nCols; j++) {
+            const CPubKey& pubkey = matrix.vPubKeys[j * nRows + i];
+            if (!pubkey.IsCompressed()) {
+                LogPrintf("failed to parse ring member public key\n");
+                return false;
+            }
+            secp256k1_pedersen_serialized_pubkey_to_commitment(pubkey.begin(), 33, &inPubKeysToCommitments[i][j]);
         }
     }
 
-    for (size_t j = 0; j < tx.vin[0].decoys.size() + 1; j++) {
+    for (size_t j = 0; j < nCols; j++) {
         const secp256k1_pedersen_commitment* inCptr[MAX_VIN * 2];
         for (size_t k = 0; k < tx.vin.size(); k++) {
             if (!secp256k1_pedersen_commitment_parse(both, &allInCommitmentsPacked[k][j], allInCommitments[k][j])) {
@@ -513,88 +643,176 @@ bool VerifyRingSignatureWithTxFee(const CTransaction& tx, CBlockIndex* pindex)
             inCptr[k] = &inPubKeysToCommitments[k - tx.vin.size()][j];
         }
         secp256k1_pedersen_commitment out;
+        unsigned char balanceKey[33];
         size_t length;
         if (!secp256k1_pedersen_commitment_sum(both, inCptr, tx.vin.size() * 2, outCptr, tx.vout.size() + 1, &out)) {
             LogPrintf("failed to secp256k1_pedersen_commitment_sum\n");
             return false;
         }
-        if (!secp256k1_pedersen_commitment_to_serialized_pubkey(&out, allInPubKeys[tx.vin.size()][j], &length)) {
+        if (!secp256k1_pedersen_commitment_to_serialized_pubkey(&out, balanceKey, &length)) {
             LogPrintf("failed to serialized pubkey\n");
             return false;
         }
+        matrix.vPubKeys[j * nRows + tx.vin.size()].Set(balanceKey, balanceKey + 33);
     }
+    return true;
+}
 
+bool ParseRingPoint(const unsigned char* pubkey, secp256k1_pubkey2& point, secp256k1_pubkey2& hashPoint)
+{
+    if (!secp256k1_ec_pubkey_parse2(GetContext(), &point, pubkey, 33))
+        return false;
 
-    //verification
-    unsigned char C[32];
-    memcpy(C, tx.c.begin(), 32);
-    for (size_t j = 0; j < tx.vin[0].decoys.size() + 1; j++) {
-        for (size_t i = 0; i < tx.vin.size() + 1; i++) {
-            //compute LIJ, RIJ
-            unsigned char P[33];
-            memcpy(P, allInPubKeys[i][j], 33);
-            if (!secp256k1_ec_pubkey_tweak_mul(P, 33, C)) {
-                LogPrintf("failed to mul pubkey\n");
-                return false;
-            }
+    //hash the key to a curve point the same way PointHashingSuccessively does
+    unsigned char hashed[33];
+    uint256 hash = Hash(pubkey, pubkey + 33);
+    hashed[0] = pubkey[0];
+    memcpy(hashed + 1, hash.begin(), 32);
+    while (!secp256k1_ec_pubkey_parse2(GetContext(), &hashPoint, hashed, 33)) {
+        hash = Hash(hashed, hashed + 33);
+        memcpy(hashed + 1, hash.begin(), 32);
+    }
+    return true;
+}
 
-            if (!secp256k1_ec_pubkey_tweak_add(P, 33, SIJ[i][j])) {
-                LogPrintf("failed to add pubkey\n");
-                return false;
-            }
+const CRingSignatureBatch::CRingPoint* CRingSignatureBatch::GetPoint(const CPubKey& pubkey)
+{
+    std::map<CPubKey, CRingPoint>::iterator it = mapPoints.find(pubkey);
+    if (it != mapPoints.end())
+        return &it->second;
+    if (!pubkey.IsCompressed())
+        return NULL;
 
-            memcpy(LIJ[i][j], P, 33);
+    CRingPoint ringPoint;
+    if (!ParseRingPoint(pubkey.begin(), ringPoint.point, ringPoint.hashPoint))
+        return NULL;
+    return &mapPoints.insert(std::make_pair(pubkey, ringPoint)).first->second;
+}
 
-            //compute RIJ
-            unsigned char sh[33];
-            CPubKey pkij;
-            pkij.Set(allInPubKeys[i][j], allInPubKeys[i][j] + 33);
-            PointHashingSuccessively(pkij, SIJ[i][j], sh);
+bool CRingSignatureBatch::VerifyMatrix(const CRingSignatureMatrix& matrix)
+{
+    const size_t nRows = matrix.nRows;
+    if (nRows == 0 || nRows > SECP256K1_MLSAG_MAX_ROWS || matrix.nCols == 0 ||
+        matrix.vPubKeys.size() != nRows * matrix.nCols || matrix.vS.size() != nRows * matrix.nCols ||
+        matrix.vKeyImages.size() != nRows)
+        return false;
+
+    secp256k1_context2* both = GetContext();
+    secp256k1_pubkey2 keyImages[SECP256K1_MLSAG_MAX_ROWS];
+    for (size_t i = 0; i < nRows; i++) {
+        if (!matrix.vKeyImages[i].IsCompressed() ||
+            !secp256k1_ec_pubkey_parse2(both, &keyImages[i], matrix.vKeyImages[i].begin(), 33)) {
+            LogPrintf("failed to parse key image\n");
+            return false;
+        }
+    }
 
-            unsigned char ci[33];
-            memcpy(ci, allKeyImages[i], 33);
-            if (!secp256k1_ec_pubkey_tweak_mul(ci, 33, C)) {
-                LogPrintf("failed to mul tweak\n");
+    secp256k1_pubkey2 pubkeys[SECP256K1_MLSAG_MAX_ROWS];
+    secp256k1_pubkey2 hashPoints[SECP256K1_MLSAG_MAX_ROWS];
+    unsigned char S[SECP256K1_MLSAG_MAX_ROWS * 32];
+    //L and R of all rows, interleaved, followed by the signature hash
+    unsigned char tempForHash[2 * SECP256K1_MLSAG_MAX_ROWS * 33 + 32];
+    unsigned char L[SECP256K1_MLSAG_MAX_ROWS * 33];
+    unsigned char R[SECP256K1_MLSAG_MAX_ROWS * 33];
+    uint256 C = matrix.c;
+    for (size_t j = 0; j < matrix.nCols; j++) {
+        for (size_t i = 0; i < nRows; i++) {
+            const CRingPoint* ringPoint = GetPoint(matrix.vPubKeys[j * nRows + i]);
+            if (!ringPoint) {
+                LogPrintf("failed to parse ring member public key\n");
                 return false;
             }
-
-            //convert shp into commitment
-            secp256k1_pedersen_commitment SHP_commitment;
-            secp256k1_pedersen_serialized_pubkey_to_commitment(sh, 33, &SHP_commitment);
-
-            //convert CI*I into commitment
-            secp256k1_pedersen_commitment cii_commitment;
-            secp256k1_pedersen_serialized_pubkey_to_commitment(ci, 33, &cii_commitment);
-
-            const secp256k1_pedersen_commitment* twoElements[2];
-            twoElements[0] = &SHP_commitment;
-            twoElements[1] = &cii_commitment;
-
-            secp256k1_pedersen_commitment sum;
-            if (!secp256k1_pedersen_commitment_sum_pos(both, twoElements, 2, &sum))
-                throw runtime_error("failed to compute secp256k1_pedersen_commitment_sum_pos");
-            size_t tempLength;
-            if (!secp256k1_pedersen_commitment_to_serialized_pubkey(&sum, RIJ[i][j], &tempLength))
-                throw runtime_error("failed to serialize pedersen commitment");
+            pubkeys[i] = ringPoint->point;
+            hashPoints[i] = ringPoint->hashPoint;
+            memcpy(S + 32 * i, matrix.vS[j * nRows + i].begin(), 32);
+        }
+        if (!secp256k1_mlsag_compute_column(both, L, R, C.begin(), S, pubkeys, hashPoints, keyImages, nRows)) {
+            LogPrintf("failed to compute ring signature column %d\n", j);
+            return false;
         }
 
-        //compute C
-        unsigned char tempForHash[2 * (MAX_VIN + 1) * 33 + 32];
         unsigned char* tempForHashPtr = tempForHash;
-        for (size_t i = 0; i < tx.vin.size() + 1; i++) {
-            memcpy(tempForHashPtr, &(LIJ[i][j][0]), 33);
+        for (size_t i = 0; i < nRows; i++) {
+            memcpy(tempForHashPtr, L + 33 * i, 33);
             tempForHashPtr += 33;
-            memcpy(tempForHashPtr, &(RIJ[i][j][0]), 33);
+            memcpy(tempForHashPtr, R + 33 * i, 33);
             tempForHashPtr += 33;
         }
-        uint256 ctsHash = GetTxSignatureHash(tx);
-        memcpy(tempForHashPtr, ctsHash.begin(), 32);
+        memcpy(tempForHashPtr, matrix.hashSig.begin(), 32);
+        C = Hash(tempForHash, tempForHash + 2 * nRows * 33 + 32);
+    }
+    return C == matrix.c;
+}
 
-        uint256 temppi1 = Hash(tempForHash, tempForHash + 2 * (tx.vin.size() + 1) * 33 + 32);
-        memcpy(C, temppi1.begin(), 32);
+bool CRingSignatureBatch::Verify(size_t* pnFailed)
+{
+    for (size_t i = 0; i < vMatrices.size(); i++) {
+        if (!VerifyMatrix(vMatrices[i])) {
+            if (pnFailed) *pnFailed = i;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool VerifyRingSignatureWithTxFee(const CTransaction& tx, CBlockIndex* pindex, bool fStore)
+{
+    if (tx.nTxFee < 0) return false;
+    if (IsInitialBlockDownload()) return true;
+    CRingSignatureMatrix matrix;
+    if (!GetRingSignatureMatrix(tx, pindex, matrix))
+        return false;
+    if (IsRingSignatureCached(matrix))
+        return true;
+    CRingSignatureBatch batch;
+    batch.Add(matrix);
+    if (!batch.Verify())
+        return false;
+    if (fStore)
+        CacheRingSignature(matrix);
+    return true;
+}
+
+void CRingSignatureBatch::swap(CRingSignatureBatch& batch)
+{
+    vMatrices.swap(batch.vMatrices);
+    mapPoints.swap(batch.mapPoints);
+}
+
+bool GetBlockRingCTChecks(const CBlock& block, CBlockIndex* pindex, CValidationState& state, std::vector<CRingCTCheck>& vChecks, size_t nChecks, bool fCheckRingCT)
+{
+    vChecks.clear();
+    if (block.IsPoABlockByVersion())
+        return true;
+
+    std::vector<const CTransaction*> vRingCTTx;
+    for (const CTransaction& tx : block.vtx) {
+        if (tx.IsCoinBase() || tx.IsCoinStake() || tx.IsCoinAudit())
+            continue;
+        if (tx.nTxFee < 0)
+            return state.DoS(100, error("ConnectBlock() : Ring Signature check for transaction %s failed", tx.GetHash().ToString()),
+                REJECT_INVALID, "bad-ring-signature");
+        if (fCheckRingCT)
+            vRingCTTx.push_back(&tx);
     }
-    //LogPrintf("Verifying\n");
-    return HexStr(tx.c.begin(), tx.c.end()) == HexStr(C, C + 32);
+    if (vRingCTTx.empty())
+        return true;
+
+    vChecks.resize(std::max((size_t)1, std::min(nChecks, vRingCTTx.size())));
+    for (size_t i = 0; i < vRingCTTx.size(); i++) {
+        const CTransaction& tx = *vRingCTTx[i];
+        CRingSignatureMatrix matrix;
+        if (!GetRingSignatureMatrix(tx, pindex, matrix))
+            return state.DoS(100, error("ConnectBlock() : Ring Signature check for transaction %s failed", tx.GetHash().ToString()),
+                REJECT_INVALID, "bad-ring-signature");
+        // Transactions verified on mempool acceptance only need their ring members resolved
+        CRingCTCheck& check = vChecks[i % vChecks.size()];
+        if (!IsRingSignatureCached(matrix))
+            check.AddRingSignature(tx, std::move(matrix));
+        if (!IsBulletproofCached(tx))
+            check.AddBulletproof(tx);
+    }
+    return true;
 }
 
 bool IsKeyImageSpend2(const std::string& kiHex, const uint256& bh)
@@ -618,89 +836,84 @@ bool IsKeyImageSpend2(const std::string& kiHex, const uint256& bh)
     return false;
 }
 
-bool ReVerifyPoSBlock(CBlockIndex* pindex)
+/** The checks of ReVerifyPoSBlock that follow the ring signature and bulletproof checks */
+static bool ReVerifyPoSBlockRewards(const CBlock& block, CBlockIndex* pindex)
 {
-    LOCK(cs_main);
-    {
-        if (!pindex) return false;
-        CBlock block;
-        if (!ReadBlockFromDisk(block, pindex)) return false;
-        if (!pindex->IsProofOfStake()) return false;
-        CAmount nFees = 0;
-        CAmount nValueIn = 0;
-        CAmount nValueOut = 0;
-        for (unsigned int i = 0; i < block.vtx.size(); i++) {
-            const CTransaction& tx = block.vtx[i];
-            if (!tx.IsCoinStake()) {
-                if (!tx.IsCoinAudit()) {
-                    if (!VerifyRingSignatureWithTxFee(tx, pindex))
-                        return false;
-                    if (!VerifyBulletProofAggregate(tx))
-                        return false;
-                }
-                nFees += tx.nTxFee;
-            }
-        }
+    AssertLockHeld(cs_main);
+    CAmount nFees = 0;
+    CAmount nValueIn = 0;
+    CAmount nValueOut = 0;
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        if (!tx.IsCoinStake())
+            nFees += tx.nTxFee;
+    }
 
-        const CTransaction coinstake = block.vtx[1];
-        CCoinsViewCache view(pcoinsTip);
-        nValueIn = GetValueIn(view, coinstake);
-        nValueOut = coinstake.GetValueOut();
+    const CTransaction coinstake = block.vtx[1];
+    CCoinsViewCache view(pcoinsTip);
+    nValueIn = GetValueIn(view, coinstake);
+    nValueOut = coinstake.GetValueOut();
 
-        size_t numUTXO = coinstake.vout.size();
-        CAmount posBlockReward = PoSBlockReward();
-        if (mapBlockIndex.count(block.hashPrevBlock) < 1) {
-            LogPrintf("ReVerifyPoSBlock() : Previous block not found, received block %s, previous %s, current tip %s", block.GetHash().GetHex(), block.hashPrevBlock.GetHex(), chainActive.Tip()->GetBlockHash().GetHex());
+    size_t numUTXO = coinstake.vout.size();
+    CAmount posBlockReward = PoSBlockReward();
+    if (mapBlockIndex.count(block.hashPrevBlock) < 1) {
+        LogPrintf("ReVerifyPoSBlock() : Previous block not found, received block %s, previous %s, current tip %s", block.GetHash().GetHex(), block.hashPrevBlock.GetHex(), chainActive.Tip()->GetBlockHash().GetHex());
+        return false;
+    }
+    int thisBlockHeight = mapBlockIndex[block.hashPrevBlock]->nHeight + 1; //avoid potential block disorder during download
+    CAmount blockValue = GetBlockValue(mapBlockIndex[block.hashPrevBlock]);
+    /*if (blockValue > posBlockReward) {
+        numUTXO - 1 is team rewards, numUTXO - 2 is masternode reward
+        const CTxOut& mnOut = coinstake.vout[numUTXO - 2];
+        std::string mnsa(mnOut.masternodeStealthAddress.begin(), mnOut.masternodeStealthAddress.end());
+        if (!VerifyDerivedAddress(mnOut, mnsa)) {
+            LogPrintf("ReVerifyPoSBlock() : Incorrect derived address for masternode rewards");
             return false;
         }
-        int thisBlockHeight = mapBlockIndex[block.hashPrevBlock]->nHeight + 1; //avoid potential block disorder during download
-        CAmount blockValue = GetBlockValue(mapBlockIndex[block.hashPrevBlock]);
-        /*if (blockValue > posBlockReward) {
-            numUTXO - 1 is team rewards, numUTXO - 2 is masternode reward
-            const CTxOut& mnOut = coinstake.vout[numUTXO - 2];
-            std::string mnsa(mnOut.masternodeStealthAddress.begin(), mnOut.masternodeStealthAddress.end());
-            if (!VerifyDerivedAddress(mnOut, mnsa)) {
-                LogPrintf("ReVerifyPoSBlock() : Incorrect derived address for masternode rewards");
-                return false;
-            }
 
-            CAmount teamReward = blockValue - posBlockReward;
-            const CTxOut& foundationOut = coinstake.vout[numUTXO - 1];
-            if (foundationOut.nValue != teamReward) {
-                LogPrintf("ReVerifyPoSBlock() : Incorrect amount PoS rewards for foundation, reward = %d while the correct reward = %d", foundationOut.nValue, teamReward);
-                return false;
-            }
+        CAmount teamReward = blockValue - posBlockReward;
+        const CTxOut& foundationOut = coinstake.vout[numUTXO - 1];
+        if (foundationOut.nValue != teamReward) {
+            LogPrintf("ReVerifyPoSBlock() : Incorrect amount PoS rewards for foundation, reward = %d while the correct reward = %d", foundationOut.nValue, teamReward);
+            return false;
+        }
 
-            if (!VerifyDerivedAddress(foundationOut, FOUNDATION_WALLET)) {
-                LogPrintf("ReVerifyPoSBlock() : Incorrect derived address PoS rewards for foundation");
-                return false;
-            }
-        } else {*/
-            //there is no team rewards in this block
-            const CTxOut& mnOut = coinstake.vout[numUTXO - 1];
-            std::string mnsa(mnOut.masternodeStealthAddress.begin(), mnOut.masternodeStealthAddress.end());
-            if (!VerifyDerivedAddress(mnOut, mnsa)) {
-                LogPrintf("ReVerifyPoSBlock() : Incorrect derived address for masternode rewards");
-                return false;
-            }
-        //}
+        if (!VerifyDerivedAddress(foundationOut, FOUNDATION_WALLET)) {
+            LogPrintf("ReVerifyPoSBlock() : Incorrect derived address PoS rewards for foundation");
+            return false;
+        }
+    } else {*/
+        //there is no team rewards in this block
+        const CTxOut& mnOut = coinstake.vout[numUTXO - 1];
+        std::string mnsa(mnOut.masternodeStealthAddress.begin(), mnOut.masternodeStealthAddress.end());
+        if (!VerifyDerivedAddress(mnOut, mnsa)) {
+            LogPrintf("ReVerifyPoSBlock() : Incorrect derived address for masternode rewards");
+            return false;
+        }
+    //}
 
-        // track money supply and mint amount info
-        CAmount nMoneySupplyPrev = pindex->pprev ? pindex->pprev->nMoneySupply : 0;
-        pindex->nMoneySupply = nMoneySupplyPrev + nValueOut - nValueIn - nFees;
-        LogPrint("supply", "%s: nMoneySupplyPrev=%d, pindex->nMoneySupply=%d, nFees = %d", __func__, nMoneySupplyPrev, pindex->nMoneySupply, nFees);
-        pindex->nMint = pindex->nMoneySupply - nMoneySupplyPrev + nFees;
+    // track money supply and mint amount info
+    CAmount nMoneySupplyPrev = pindex->pprev ? pindex->pprev->nMoneySupply : 0;
+    pindex->nMoneySupply = nMoneySupplyPrev + nValueOut - nValueIn - nFees;
+    LogPrint("supply", "%s: nMoneySupplyPrev=%d, pindex->nMoneySupply=%d, nFees = %d", __func__, nMoneySupplyPrev, pindex->nMoneySupply, nFees);
+    pindex->nMint = pindex->nMoneySupply - nMoneySupplyPrev + nFees;
 
-        //PoW phase redistributed fees to miner. PoS stage destroys fees.
-        CAmount nExpectedMint = GetBlockValue(pindex->pprev);
-        nExpectedMint += nFees;
+    //PoW phase redistributed fees to miner. PoS stage destroys fees.
+    CAmount nExpectedMint = GetBlockValue(pindex->pprev);
+    nExpectedMint += nFees;
 
-        if (!IsBlockValueValid(block, nExpectedMint, pindex->nMint)) {
-            LogPrintf("ReVerifyPoSBlock() : reward pays too much (actual=%s vs limit=%s)", FormatMoney(pindex->nMint), FormatMoney(nExpectedMint));
-            return false;
-        }
-        return true;
+    if (!IsBlockValueValid(block, nExpectedMint, pindex->nMint)) {
+        LogPrintf("ReVerifyPoSBlock() : reward pays too much (actual=%s vs limit=%s)", FormatMoney(pindex->nMint), FormatMoney(nExpectedMint));
+        return false;
     }
+    return true;
+}
+
+bool ReVerifyPoSBlock(CBlockIndex* pindex)
+{
+    std::vector<bool> vValid;
+    ReVerifyPoSBlocks(std::vector<CBlockIndex*>(1, pindex), vValid);
+    return vValid[0];
 }
 
 uint256 GetTxSignatureHash(const CTransaction& tx)
@@ -1076,6 +1289,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 
 CCoinsViewCache* pcoinsTip = NULL;
 CBlockTreeDB* pblocktree = NULL;
+CKeyImageView* pkeyimages = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -1505,6 +1719,16 @@ bool CheckTransaction(const CTransaction& tx, bool fzcActive, bool fRejectBadUTX
         }
     }
 
+    // Check for duplicate key images, which CheckBlock rejects as well
+    set<CKeyImage> setKeyImages;
+    for (const CTxIn& txin : tx.vin) {
+        if (!txin.keyImage.IsValid())
+            continue;
+        if (!setKeyImages.insert(txin.keyImage).second)
+            return state.DoS(100, error("CheckTransaction() : duplicate key images"),
+                REJECT_INVALID, "bad-txns-inputs-duplicate");
+    }
+
     if (tx.IsCoinBase()) {
         if (tx.vin[0].scriptSig.size() < 2 || tx.vin[0].scriptSig.size() > 150)
             return state.DoS(100, error("CheckTransaction() : coinbase script size=%d", tx.vin[0].scriptSig.size()),
@@ -1581,15 +1805,15 @@ bool CheckHaveInputs(const CCoinsViewCache& view, const CTransaction& tx)
 
             alldecoys.push_back(tx.vin[i].prevout);
             for (size_t j = 0; j < alldecoys.size(); j++) {
-                CTransaction prev;
-                uint256 bh;
-                if (!GetTransaction(alldecoys[j].hash, prev, bh, true)) {
+                CRingMemberOutput member;
+                if (!GetRingMemberOutput(alldecoys[j], member, true)) {
                     return false;
                 }
+                const uint256& bh = member.hashBlock;
 
                 if (mapBlockIndex.count(bh) < 1) return false;
-                if (prev.IsCoinStake() || prev.IsCoinAudit() || prev.IsCoinBase()) {
-                    if (nSpendHeight - mapBlockIndex[bh]->nHeight < Params().COINBASE_MATURITY()) return false;
+                if (member.IsCoinBase()) {
+                    if (nSpendHeight - member.nHeight < Params().COINBASE_MATURITY()) return false;
                 }
 
                 CBlockIndex* tip = chainActive.Tip();
@@ -1675,22 +1899,26 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
 
             if (!tx.IsCoinStake() && !tx.IsCoinBase() && !tx.IsCoinAudit()) {
                 if (!tx.IsCoinAudit()) {
-                    if (!VerifyRingSignatureWithTxFee(tx, chainActive.Tip()))
+                    if (!VerifyRingSignatureWithTxFee(tx, chainActive.Tip(), true))
                         return state.DoS(100, error("AcceptToMemoryPool() : Ring Signature check for transaction %s failed", tx.GetHash().ToString()),
                             REJECT_INVALID, "bad-ring-signature");
-                    if (!VerifyBulletProofAggregate(tx))
+                    if (!VerifyBulletProofAggregate(tx, true))
                         return state.DoS(100, error("AcceptToMemoryPool() : Bulletproof check for transaction %s failed", tx.GetHash().ToString()),
                             REJECT_INVALID, "bad-bulletproof");
                 }
             }
 
-            // Check key images not duplicated with what in db
+            // Check key images not duplicated with what in db or in the pool
             for (const CTxIn& txin : tx.vin) {
                 const CKeyImage& keyImage = txin.keyImage;
-                if (IsKeyImageSpend1(keyImage.GetHex(), uint256())) {
+                if (IsKeyImageSpend1(keyImage, uint256())) {
                     return state.Invalid(error("AcceptToMemoryPool : key image already spent"),
                         REJECT_DUPLICATE, "bad-txns-inputs-spent");
                 }
+                if (pool.existsKeyImage(keyImage)) {
+                    return state.Invalid(error("AcceptToMemoryPool : key image already spent by a transaction in the pool"),
+                        REJECT_DUPLICATE, "bad-txns-inputs-spent");
+                }
             }
 
             // Bring the best block into scope
@@ -1796,15 +2024,13 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         LOCK(pwalletMain->cs_wallet);
         if (pwalletMain->mapWallet.count(tx.GetHash()) == 1) {
             for (size_t i = 0; i < tx.vin.size(); i++) {
-                std::string outpoint = tx.vin[i].prevout.hash.GetHex() + std::to_string(tx.vin[i].prevout.n);
-                if (pwalletMain->outpointToKeyImages[outpoint] == tx.vin[i].keyImage) {
+                if (pwalletMain->outpointToKeyImages[tx.vin[i].prevout] == tx.vin[i].keyImage) {
                     pwalletMain->inSpendQueueOutpoints[tx.vin[i].prevout] = true;
                     continue;
                 }
 
                 for (size_t j = 0; j < tx.vin[i].decoys.size(); j++) {
-                    std::string outpoint = tx.vin[i].decoys[j].hash.GetHex() + std::to_string(tx.vin[i].decoys[j].n);
-                    if (pwalletMain->outpointToKeyImages[outpoint] == tx.vin[i].keyImage) {
+                    if (pwalletMain->outpointToKeyImages[tx.vin[i].decoys[j]] == tx.vin[i].keyImage) {
                         pwalletMain->inSpendQueueOutpoints[tx.vin[i].decoys[j]] = true;
                         break;
                     }
@@ -2004,10 +2230,62 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
     return true;
 }
 
-/** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
+/** Transactions are read in chunks of this size, doubled until the transaction fits */
+static const unsigned int TX_READ_CHUNK_SIZE = 16 * 1024;
+/** Largest serialized block header, PoA blocks included */
+static const unsigned int MAX_BLOCK_HEADER_READ_SIZE = 1024;
+
+/** Read the transaction at postx and the hash of the block containing it, only fetching the bytes needed */
+static bool ReadTransactionFromDisk(const CDiskTxPos& postx, CTransaction& txOut, uint256& hashBlock)
+{
+    unsigned int nBlockSize;
+    if (!ReadDiskRecordSize(postx, "blk", nBlockSize))
+        return error("%s : ReadDiskRecordSize failed", __func__);
+
+    try {
+        CDataStream ssHeader(SER_DISK, CLIENT_VERSION);
+        ssHeader.resize(std::min(nBlockSize, MAX_BLOCK_HEADER_READ_SIZE));
+        if (!ReadDiskFile(postx, "blk", &ssHeader[0], ssHeader.size()))
+            return error("%s : ReadDiskFile failed", __func__);
+        const unsigned int nHeaderRead = ssHeader.size();
+        CBlockHeader header;
+        ssHeader >> header;
+        hashBlock = header.GetHash();
+
+        const unsigned int nTxOffset = nHeaderRead - ssHeader.size() + postx.nTxOffset;
+        if (nTxOffset >= nBlockSize)
+            return error("%s : transaction offset %u out of block of %u bytes", __func__, postx.nTxOffset, nBlockSize);
+        const CDiskBlockPos posTx(postx.nFile, postx.nPos + nTxOffset);
+        const unsigned int nAvailable = nBlockSize - nTxOffset;
+        for (unsigned int nChunk = std::min(nAvailable, TX_READ_CHUNK_SIZE);; nChunk = std::min(nAvailable, 2 * nChunk)) {
+            CDataStream ssTx(SER_DISK, CLIENT_VERSION);
+            ssTx.resize(nChunk);
+            if (!ReadDiskFile(posTx, "blk", &ssTx[0], nChunk))
+                return error("%s : ReadDiskFile failed", __func__);
+            try {
+                ssTx >> txOut;
+                return true;
+            } catch (const std::ios_base::failure&) {
+                // ran out of bytes, read a larger chunk unless the rest of the block was already there
+                if (nChunk == nAvailable)
+                    throw;
+            }
+        }
+    } catch (const std::exception& e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+}
+
+/**
+ * Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock.
+ * Only the index lookups hold cs_main; block data on disk is never rewritten, so
+ * the transaction itself is read and deserialized without it.
+ */
 bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock, bool fAllowSlow)
 {
     CBlockIndex* pindexSlow = NULL;
+    CDiskTxPos postx;
+    bool fIndexed = false;
     {
         LOCK(cs_main);
         {
@@ -2017,30 +2295,11 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock
         }
 
         if (fTxIndex) {
-            CDiskTxPos postx;
-            if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-                if (file.IsNull())
-                    return error("%s: OpenBlockFile failed", __func__);
-                CBlockHeader header;
-                try {
-                    file >> header;
-                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                    file >> txOut;
-                } catch (const std::exception& e) {
-                    return error("%s : Deserialize or I/O error - %s", __func__, e.what());
-                }
-                hashBlock = header.GetHash();
-                if (txOut.GetHash() != hash)
-                    return error("%s : txid mismatch, %s, %s", __func__, txOut.GetHash().GetHex(), hash.GetHex());
-                return true;
-            }
-
             // transaction not found in the index, nothing more can be done
-            return false;
-        }
-
-        if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
+            if (!pblocktree->ReadTxIndex(hash, postx))
+                return false;
+            fIndexed = true;
+        } else if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
             int nHeight = -1;
             {
                 CCoinsViewCache& view = *pcoinsTip;
@@ -2053,6 +2312,14 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock
         }
     }
 
+    if (fIndexed) {
+        if (!ReadTransactionFromDisk(postx, txOut, hashBlock))
+            return false;
+        if (txOut.GetHash() != hash)
+            return error("%s : txid mismatch, %s, %s", __func__, txOut.GetHash().GetHex(), hash.GetHex());
+        return true;
+    }
+
     if (pindexSlow) {
         CBlock block;
         if (ReadBlockFromDisk(block, pindexSlow)) {
@@ -2069,6 +2336,39 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock
     return false;
 }
 
+/**
+ * Return the ring member data of a confirmed output. The ring member index is
+ * filled by ConnectBlock; outputs confirmed before it existed are looked up
+ * through GetTransaction once and then added to the index.
+ */
+bool GetRingMemberOutput(const COutPoint& outpoint, CRingMemberOutput& output, bool fAllowSlow)
+{
+    if (pblocktree->ReadRingMemberOutput(outpoint, output))
+        return true;
+
+    CTransaction txPrev;
+    uint256 hashBlock;
+    if (!GetTransaction(outpoint.hash, txPrev, hashBlock, fAllowSlow))
+        return false;
+    if (outpoint.n >= txPrev.vout.size())
+        return false;
+
+    int nHeight;
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+        if (mi == mapBlockIndex.end() || !mi->second)
+            return false;
+        nHeight = mi->second->nHeight;
+    }
+
+    output = CRingMemberOutput(txPrev, outpoint.n, hashBlock, nHeight);
+    std::vector<std::pair<COutPoint, CRingMemberOutput> > vOutputs;
+    vOutputs.push_back(std::make_pair(outpoint, output));
+    pblocktree->WriteRingMemberOutputs(vOutputs);
+    return true;
+}
+
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -2100,14 +2400,17 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk : OpenBlockFile failed");
+    unsigned int nSize;
+    if (!ReadDiskRecordSize(pos, "blk", nSize))
+        return error("ReadBlockFromDisk : ReadDiskRecordSize failed");
 
-    // Read block
+    // Read block straight into the stream it is deserialized from
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss.resize(nSize);
+    if (nSize == 0 || !ReadDiskFile(pos, "blk", &ss[0], nSize))
+        return error("ReadBlockFromDisk : ReadDiskFile failed");
     try {
-        filein >> block;
+        ss >> block;
     } catch (const std::exception& e) {
         return error("%s : Deserialize or I/O error - %s", __func__, e.what());
     }
@@ -2728,6 +3031,21 @@ void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCach
     inputs.ModifyCoins(tx.GetHash())->FromTx(tx, nHeight);
 }
 
+bool CRingCTCheck::operator()()
+{
+    size_t nFailed = 0;
+    bool fValid = true;
+    if (!rings.Verify(&nFailed))
+        fValid = error("CRingCTCheck(): Ring Signature check for transaction %s failed", vRingTx[nFailed]->GetHash().ToString());
+    else if (!VerifyBulletProofBatch(vBulletproofTx, &nFailed))
+        fValid = error("CRingCTCheck(): Bulletproof check for transaction %s failed", vBulletproofTx[nFailed]->GetHash().ToString());
+    if (pfValid) {
+        *pfValid = fValid;
+        return true;
+    }
+    return fValid;
+}
+
 bool CScriptCheck::operator()()
 {
     const CScript& scriptSig = ptxTo->vin[nIn].scriptSig;
@@ -2996,6 +3314,7 @@ void static FlushBlockFile(bool fFinalize = false)
 bool FindUndoPos(CValidationState& state, int nFile, CDiskBlockPos& pos, unsigned int nAddSize);
 
 static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+static CCheckQueue<CRingCTCheck> ringctcheckqueue(1);
 
 void ThreadScriptCheck()
 {
@@ -3003,6 +3322,70 @@ void ThreadScriptCheck()
     scriptcheckqueue.Thread();
 }
 
+void ThreadRingCTCheck()
+{
+    util::ThreadRename("prcycoin-ringctch");
+    ringctcheckqueue.Thread();
+}
+
+void ReVerifyPoSBlocks(const std::vector<CBlockIndex*>& vIndex, std::vector<bool>& vValid)
+{
+    LOCK(cs_main);
+    vValid.assign(vIndex.size(), false);
+    const bool fCheckRingCT = !IsInitialBlockDownload();
+
+    // Read every audited block before any check is queued, the checks point into vBlocks
+    std::vector<CBlock> vBlocks(vIndex.size());
+    std::vector<bool> vPending(vIndex.size(), false);
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        CBlockIndex* pindex = vIndex[i];
+        if (!pindex) continue;
+        if (pindex->nStatus & BLOCK_AUDITED) {
+            vValid[i] = true;
+            continue;
+        }
+        if (!ReadBlockFromDisk(vBlocks[i], pindex)) continue;
+        if (!pindex->IsProofOfStake()) continue;
+        vPending[i] = true;
+    }
+
+    // Ring members are resolved here under cs_main, the signatures and range proofs
+    // of each block are verified on the script check threads into its own slot
+    std::unique_ptr<bool[]> pfChecked(new bool[vIndex.size()]);
+    CCheckQueueControl<CRingCTCheck> control(nScriptCheckThreads ? &ringctcheckqueue : NULL);
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        pfChecked[i] = vPending[i];
+        if (!vPending[i]) continue;
+        CValidationState state;
+        std::vector<CRingCTCheck> vChecks;
+        if (!GetBlockRingCTChecks(vBlocks[i], vIndex[i], state, vChecks, 1, fCheckRingCT)) {
+            pfChecked[i] = false;
+            continue;
+        }
+        for (CRingCTCheck& check : vChecks)
+            check.SetResult(&pfChecked[i]);
+        if (nScriptCheckThreads) {
+            control.Add(vChecks);
+        } else {
+            for (CRingCTCheck& check : vChecks)
+                check();
+        }
+    }
+    control.Wait();
+
+    // The remaining checks update the money supply of the block index, run them in order
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        if (!pfChecked[i] || !ReVerifyPoSBlockRewards(vBlocks[i], vIndex[i]))
+            continue;
+        vValid[i] = true;
+        // Ring signatures and bulletproofs are not checked during initial download
+        if (fCheckRingCT) {
+            vIndex[i]->nStatus |= BLOCK_AUDITED;
+            setDirtyBlockIndex.insert(vIndex[i]);
+        }
+    }
+}
+
 bool RecalculatePRCYSupply(int nHeightStart)
 {
     const int chainHeight = chainActive.Height();
@@ -3177,6 +3560,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     CBlockUndo blockundo;
 
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    CCheckQueueControl<CRingCTCheck> controlRingCT(nScriptCheckThreads ? &ringctcheckqueue : NULL);
 
     int64_t nTimeStart = GetTimeMicros();
     CAmount nFees = 0;
@@ -3185,10 +3569,29 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
     std::vector<std::pair<uint256, CDiskTxPos> > vPos;
     vPos.reserve(block.vtx.size());
+    std::vector<std::pair<CKeyImage, CKeyImageSpend> > vKeyImageSpends;
+    std::vector<std::pair<COutPoint, CRingMemberOutput> > vRingMembers;
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
     CAmount nValueOut = 0;
     CAmount nValueIn = 0;
     unsigned int nMaxBlockSigOps = MAX_BLOCK_SIGOPS_CURRENT;
+    const bool fCheckRingCT = !IsInitialBlockDownload();
+    {
+        // Ring signatures and bulletproofs are checked on the script check threads
+        // while the transactions are connected, or right here without them.
+        std::vector<CRingCTCheck> vRingCTChecks;
+        if (!GetBlockRingCTChecks(block, pindex, state, vRingCTChecks, std::max(nScriptCheckThreads, 1), fCheckRingCT))
+            return false;
+        if (nScriptCheckThreads) {
+            controlRingCT.Add(vRingCTChecks);
+        } else {
+            for (CRingCTCheck& check : vRingCTChecks) {
+                if (!check())
+                    return state.DoS(100, error("ConnectBlock() : Ring Signature or Bulletproof check failed"),
+                        REJECT_INVALID, "bad-ringct");
+            }
+        }
+    }
     for (unsigned int i = 0; i < block.vtx.size(); i++) {
         const CTransaction& tx = block.vtx[i];
         nInputs += tx.vin.size();
@@ -3198,28 +3601,16 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 REJECT_INVALID, "bad-blk-sigops");
 
         if (!block.IsPoABlockByVersion() && !tx.IsCoinBase()) {
-            if (!tx.IsCoinStake()) {
-                if (!tx.IsCoinAudit()) {
-                    if (!VerifyRingSignatureWithTxFee(tx, pindex))
-                        return state.DoS(100, error("ConnectBlock() : Ring Signature check for transaction %s failed", tx.GetHash().ToString()),
-                            REJECT_INVALID, "bad-ring-signature");
-                    if (!VerifyBulletProofAggregate(tx))
-                        return state.DoS(100, error("ConnectBlock() : Bulletproof check for transaction %s failed", tx.GetHash().ToString()),
-                            REJECT_INVALID, "bad-bulletproof");
-                }
-            }
-
             // Check that the inputs are not marked as invalid/fraudulent
             uint256 bh = pindex->GetBlockHash();
             for (CTxIn in : tx.vin) {
                 const CKeyImage& keyImage = in.keyImage;
-                std::string kh = keyImage.GetHex();
-                if (IsKeyImageSpend1(kh, bh)) {
+                if (IsKeyImageSpend1(keyImage, bh)) {
                     //remove transaction from the pool?
                     return state.Invalid(error("ConnectBlock() : key image already spent"),
                         REJECT_DUPLICATE, "bad-txns-inputs-spent");
                 }
-                pblocktree->WriteKeyImage(keyImage.GetHex(), bh);
+                vKeyImageSpends.push_back(std::make_pair(keyImage, CKeyImageSpend(bh, pindex->nHeight)));
                 if (pwalletMain != NULL && !pwalletMain->IsLocked()) {
                     if (pwalletMain->GetDebit(in, ISMINE_ALL)) {
                         pwalletMain->keyImagesSpends[keyImage.GetHex()] = true;
@@ -3254,6 +3645,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         UpdateCoins(tx, state, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
 
         vPos.push_back(std::make_pair(tx.GetHash(), pos));
+        for (unsigned int j = 0; j < tx.vout.size(); j++)
+            vRingMembers.push_back(std::make_pair(COutPoint(tx.GetHash(), j), CRingMemberOutput(tx, j, pindex->GetBlockHash(), pindex->nHeight)));
         pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
     }
 
@@ -3315,6 +3708,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     if (!control.Wait())
         return state.DoS(100, false);
+    if (!controlRingCT.Wait())
+        return state.DoS(100, error("ConnectBlock() : Ring Signature or Bulletproof check failed"),
+            REJECT_INVALID, "bad-ringct");
     int64_t nTime2 = GetTimeMicros();
     nTimeVerify += nTime2 - nTimeStart;
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1,
@@ -3342,10 +3738,22 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         setDirtyBlockIndex.insert(pindex);
     }
 
+    // Remember that this PoS block passed every check ReVerifyPoSBlock repeats,
+    // unless the ring signatures and bulletproofs were skipped during initial download
+    if (block.IsProofOfStake() && fCheckRingCT && !(pindex->nStatus & BLOCK_AUDITED)) {
+        pindex->nStatus |= BLOCK_AUDITED;
+        setDirtyBlockIndex.insert(pindex);
+    }
+
     if (fTxIndex)
         if (!pblocktree->WriteTxIndex(vPos))
             return state.Abort("Failed to write transaction index");
 
+    if (!pblocktree->WriteRingMemberOutputs(vRingMembers))
+        return state.Abort("Failed to write ring member index");
+
+    pkeyimages->AddSpends(vKeyImageSpends);
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -3413,6 +3821,9 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
                     return state.Abort("Files to write to block index database");
                 }
             }
+            // Then the key images spent by the blocks about to become the chainstate tip.
+            if (!pkeyimages->Flush())
+                return state.Abort("Failed to write key image index");
             // Finally flush the chainstate (which may refer to block index entries).
             if (!pcoinsTip->Flush())
                 return state.Abort("Failed to write to coin database");
@@ -3627,29 +4038,21 @@ void RemoveInvalidTransactionsFromMempool()
     LOCK(mempool.cs);
     std::vector<CTransaction> tobeRemoveds;
     for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mempool.mapTx.begin(); it != mempool.mapTx.end(); ++it) {
+        // Key image conflicts with the chain are evicted by removeForBlock through mapKeyImages
         const CTransaction& tx = it->second.GetTx();
         for(size_t i = 0; i < tx.vin.size(); i++) {
-            std::string kiHex = tx.vin[i].keyImage.GetHex();
-            int confirm = 0;
-            if (CheckKeyImageSpendInMainChain(kiHex, confirm)) {
-                if (confirm > Params().MaxReorganizationDepth()) {
-                    tobeRemoveds.push_back(tx);
-                    break;
-                }
-            }
             bool needsBreak = false;
             std::vector<COutPoint> decoys = tx.vin[i].decoys;
             decoys.push_back(tx.vin[i].prevout);
             for (size_t j = 0; j < decoys.size(); j++) {
-                CTransaction txPrev;
-                uint256 hashBlock;
-                if (!GetTransaction(decoys[j].hash, txPrev, hashBlock)) {
+                CRingMemberOutput member;
+                if (!GetRingMemberOutput(decoys[j], member)) {
                     tobeRemoveds.push_back(tx);
                     needsBreak = true;
                     break;
                 }
 
-                CBlockIndex* atTheblock = mapBlockIndex[hashBlock];
+                CBlockIndex* atTheblock = mapBlockIndex[member.hashBlock];
                 if (!atTheblock) {
                     tobeRemoveds.push_back(tx);
                     needsBreak = true;
@@ -4054,8 +4457,8 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = blockIndexArena.Allocate();
+    *pindexNew = CBlockIndex(block);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -4072,18 +4475,16 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
         //update previous block pointer
         pindexNew->pprev->pnext = pindexNew;
 
-        // ppcoin: compute chain trust score
-        pindexNew->bnChainTrust = (pindexNew->pprev ? pindexNew->pprev->bnChainTrust : 0) + pindexNew->GetBlockTrust();
-
         // ppcoin: compute stake entropy bit for stake modifier
         if (!block.IsPoABlockByVersion() && !pindexNew->SetStakeEntropyBit(pindexNew->GetStakeEntropyBit()))
             LogPrintf("AddToBlockIndex() : SetStakeEntropyBit() failed \n");
 
-        // ppcoin: record proof-of-stake hash value
+        // ppcoin: record proof-of-stake hash value, only the stake modifier checksum needs it
+        uint256 hashProofOfStake;
         if (pindexNew->IsProofOfStake()) {
             if (!mapProofOfStake.count(hash))
                 LogPrintf("AddToBlockIndex() : hashProofOfStake not found in map \n");
-            pindexNew->hashProofOfStake = mapProofOfStake[hash];
+            hashProofOfStake = mapProofOfStake[hash];
         }
 
         // ppcoin: compute stake modifier
@@ -4092,7 +4493,7 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
         if (!block.IsPoABlockByVersion() && !ComputeNextStakeModifier(pindexNew->pprev, nStakeModifier, fGeneratedStakeModifier))
             LogPrintf("AddToBlockIndex() : ComputeNextStakeModifier() failed \n");
         pindexNew->SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
-        pindexNew->nStakeModifierChecksum = GetStakeModifierChecksum(pindexNew);
+        pindexNew->nStakeModifierChecksum = GetStakeModifierChecksum(pindexNew, hashProofOfStake);
         if (!block.IsPoABlockByVersion() && !CheckStakeModifierCheckpoints(pindexNew->nHeight, pindexNew->nStakeModifierChecksum))
             LogPrintf("AddToBlockIndex() : Rejected by stake modifier checkpoint height=%d, modifier=%s \n",
                 pindexNew->nHeight, std::to_string(nStakeModifier));
@@ -4355,26 +4756,10 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
             if (block.vtx[i].IsCoinStake())
                 return state.DoS(100, error("CheckBlock() : more than one coinstake"));
 
-        const CTransaction& coinstake = block.vtx[1];
-        int numUTXO = coinstake.vout.size();
-
-        //verify shnorr signature
-        if (!VerifyShnorrKeyImageTx(coinstake)) {
-            return state.DoS(100, error("CheckBlock() : Failed to verify shnorr signature"));
-        }
-
-        //verify commitments for all UTXOs
-        for (int i = 1; i < numUTXO; i++) {
-            if (!VerifyZeroBlindCommitment(coinstake.vout[i]))
-                return state.DoS(100, error("CheckBlock() : PoS rewards commitment not correct"));
-        }
     }
 
-    if (block.IsProofOfAudit() || block.IsProofOfWork()) {
-        //verify commitment
-        if (!VerifyZeroBlindCommitment(block.vtx[0].vout[0]))
-            return state.DoS(100, error("CheckBlock() : PoS rewards commitment not correct"));
-    }
+    if (fCheckSig && !CheckBlockSignatures(block, state))
+        return false;
 
     /**
      * @todo Audit checkblock
@@ -4427,6 +4812,60 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     return true;
 }
 
+bool CheckBlockSignatures(const CBlock& block, CValidationState& state)
+{
+    if (block.IsProofOfStake()) {
+        const CTransaction& coinstake = block.vtx[1];
+        int numUTXO = coinstake.vout.size();
+
+        //verify shnorr signature
+        if (!VerifyShnorrKeyImageTx(coinstake)) {
+            return state.DoS(100, error("CheckBlock() : Failed to verify shnorr signature"));
+        }
+
+        //verify commitments for all UTXOs
+        for (int i = 1; i < numUTXO; i++) {
+            if (!VerifyZeroBlindCommitment(coinstake.vout[i]))
+                return state.DoS(100, error("CheckBlock() : PoS rewards commitment not correct"));
+        }
+    }
+
+    if (block.IsProofOfAudit() || block.IsProofOfWork()) {
+        if (block.vtx.empty() || block.vtx[0].vout.empty())
+            return state.DoS(100, error("CheckBlock() : coinbase output missing"),
+                REJECT_INVALID, "bad-cb-missing");
+        //verify commitment
+        if (!VerifyZeroBlindCommitment(block.vtx[0].vout[0]))
+            return state.DoS(100, error("CheckBlock() : PoS rewards commitment not correct"));
+    }
+
+    return true;
+}
+
+bool PreCheckBlock(const CBlock& block, CValidationState& state)
+{
+    bool mutated;
+    uint256 hashMerkleRoot2 = block.BuildMerkleTree(&mutated);
+    if (block.hashMerkleRoot != hashMerkleRoot2)
+        return state.DoS(100, error("PreCheckBlock() : hashMerkleRoot mismatch"),
+            REJECT_INVALID, "bad-txnmrklroot", true);
+    if (mutated)
+        return state.DoS(100, error("PreCheckBlock() : duplicate transaction"),
+            REJECT_INVALID, "bad-txns-duplicate", true);
+
+    if (!CheckBlockSignatures(block, state))
+        return false;
+
+    // CheckBlockSignature reads the reward output of the coinstake
+    if (!block.IsPoABlockByVersion()) {
+        if (block.IsProofOfStake() && block.vtx[1].vout.size() < 2)
+            return state.DoS(100, error("PreCheckBlock() : coinstake without reward output"));
+        if (!block.CheckBlockSignature())
+            return state.DoS(100, error("PreCheckBlock() : bad proof-of-stake block signature"));
+    }
+    return true;
+}
+
 bool CheckWork(const CBlock block, CBlockIndex* const pindexPrev)
 {
     if (pindexPrev == NULL)
@@ -4761,23 +5200,23 @@ void CBlockIndex::BuildSkip()
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
 }
 
-bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDiskBlockPos* dbp)
+bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDiskBlockPos* dbp, bool fPreChecked)
 {
     AssertLockNotHeld(cs_main);
 
     // Preliminary checks
     int64_t nStartTime = GetTimeMillis();
-    bool checked = CheckBlock(*pblock, state);
+    bool checked = CheckBlock(*pblock, state, true, !fPreChecked, !fPreChecked);
     // ppcoin: check proof-of-stake
     // Limited duplicity on stake: prevents block flood attack
     // Duplicate stake allowed only when there is orphan child block
     // Key image will be checked later for duplicate stake
     /*if (pblock->IsProofOfStake() && setStakeSeen.count(pblock->GetProofOfStake())) {
-        if (IsKeyImageSpend1(pblock->vtx[1].vin[0].keyImage.GetHex(), pblock->hashPrevBlock))
+        if (IsKeyImageSpend1(pblock->vtx[1].vin[0].keyImage, pblock->hashPrevBlock))
             return error("ProcessNewBlock() : duplicate proof-of-stake (%s, %d) for block %s", pblock->GetProofOfStake().first.ToString().c_str(), pblock->GetProofOfStake().second, pblock->GetHash().ToString().c_str());
     }*/
     // NovaCoin: check proof-of-stake block signature
-    if (!pblock->IsPoABlockByVersion() && !pblock->CheckBlockSignature())
+    if (!fPreChecked && !pblock->IsPoABlockByVersion() && !pblock->CheckBlockSignature())
         return error("ProcessNewBlock() : bad proof-of-stake block signature");
 
     if (pblock->GetHash() != Params().HashGenesisBlock() && pfrom != NULL) {
@@ -4820,6 +5259,7 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
                 if (pblock->IsProofOfStake()) {
                     if (pwalletMain->IsMine(pblock->vtx[1].vin[0])) {
                         pwalletMain->mapWallet.erase(pblock->vtx[1].GetHash());
+                        pwalletMain->MarkBalanceDirty(pblock->vtx[1].GetHash());
                     }
                 }
             }
@@ -4852,87 +5292,6 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
         pwalletMain->resetPendingOutPoints();
     }
 
-    //Block is accepted, let's update decoys pool
-    //First, update user decoy pool
-    int userTxStartIdx = 1;
-    int coinbaseIdx = 0;
-    if (pwalletMain) {
-        LOCK2(cs_main, pwalletMain->cs_wallet);
-        {
-            if (pblock->IsProofOfStake()) {
-                userTxStartIdx = 2;
-                coinbaseIdx = 1;
-            }
-
-            if (pblock->IsProofOfStake()) {
-                if (pwalletMain->userDecoysPool.count(pblock->vtx[1].vin[0].prevout) == 1) {
-                    pwalletMain->userDecoysPool.erase(pblock->vtx[1].vin[0].prevout);
-                }
-
-                if (pwalletMain->coinbaseDecoysPool.count(pblock->vtx[1].vin[0].prevout) == 1) {
-                    pwalletMain->coinbaseDecoysPool.erase(pblock->vtx[1].vin[0].prevout);
-                }
-            }
-
-            if ((int)pblock->vtx.size() > userTxStartIdx) {
-                for (int i = userTxStartIdx; i < (int)pblock->vtx.size(); i++) {
-                    for (int j = 0; j < (int)pblock->vtx[i].vout.size(); j++) {
-                        if (!pblock->vtx[i].vout[j].commitment.empty() && (secp256k1_rand32() % 100) <= CWallet::PROBABILITY_NEW_COIN_SELECTED) {
-                            COutPoint newOutPoint(pblock->vtx[i].GetHash(), j);
-                            if (pwalletMain->userDecoysPool.count(newOutPoint) == 1) {
-                                continue;
-                            }
-                            //add new user transaction to the pool
-                            if ((int32_t)pwalletMain->userDecoysPool.size() >= CWallet::MAX_DECOY_POOL) {
-                                int selected = secp256k1_rand32() % CWallet::MAX_DECOY_POOL;
-                                map<COutPoint, uint256>::const_iterator it = std::next(pwalletMain->userDecoysPool.begin(), selected);
-                                pwalletMain->userDecoysPool.erase(it->first);
-                                pwalletMain->userDecoysPool[newOutPoint] = pblock->GetHash();
-                            } else {
-                                pwalletMain->userDecoysPool[newOutPoint] = pblock->GetHash();
-                            }
-                        }
-                    }
-                }
-            }
-
-            if (chainActive.Height() > Params().COINBASE_MATURITY()) {
-                //read block chainActive.Height() - Params().COINBASE_MATURITY()
-                CBlockIndex* p = chainActive[chainActive.Height() - Params().COINBASE_MATURITY()];
-                CBlock b;
-                if (ReadBlockFromDisk(b, p)) {
-                    coinbaseIdx = 0;
-                    if (p->IsProofOfStake()) {
-                        coinbaseIdx = 1;
-                    }
-                    CTransaction& coinbase = b.vtx[coinbaseIdx];
-                    if (b.posBlocksAudited.size() == 0) {
-                        for (int i = 0; i < (int)coinbase.vout.size(); i++) {
-                            if (!coinbase.vout[i].IsNull() && !coinbase.vout[i].commitment.empty() && coinbase.vout[i].nValue > 0 && !coinbase.vout[i].IsEmpty()) {
-                                if ((secp256k1_rand32() % 100) <= CWallet::PROBABILITY_NEW_COIN_SELECTED) {
-                                    COutPoint newOutPoint(coinbase.GetHash(), i);
-                                    if (pwalletMain->coinbaseDecoysPool.count(newOutPoint) == 1) {
-                                        continue;
-                                    }
-                                    //add new coinbase transaction to the pool
-                                    if ((int)pwalletMain->coinbaseDecoysPool.size() >= CWallet::MAX_DECOY_POOL) {
-                                        int selected = secp256k1_rand32() % CWallet::MAX_DECOY_POOL;
-                                        map<COutPoint, uint256>::const_iterator it = std::next(pwalletMain->coinbaseDecoysPool.begin(), selected);
-                                        pwalletMain->coinbaseDecoysPool.erase(it->first);
-                                        pwalletMain->coinbaseDecoysPool[newOutPoint] = pblock->GetHash();
-                                    } else {
-                                        pwalletMain->coinbaseDecoysPool[newOutPoint] = pblock->GetHash();
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-            LogPrintf("%s: Coinbase decoys = %d, user decoys = %d\n", __func__, pwalletMain->coinbaseDecoysPool.size(), pwalletMain->userDecoysPool.size());
-        }
-    }
-
     LogPrintf("%s: ACCEPTED in %ld milliseconds with size=%d, height=%d\n", __func__, GetTimeMillis() - nStartTime,
         pblock->GetSerializeSize(SER_DISK, CLIENT_VERSION), chainActive.Height());
 
@@ -5039,9 +5398,7 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockIndexArena.Allocate();
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
 
     pindexNew->phashBlock = &((*mi).first);
@@ -5049,14 +5406,22 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
+void AdoptBlockIndexEntries(CBlockIndexArena& arena)
+{
+    blockIndexArena.Splice(arena);
+}
+
 bool static LoadBlockIndexDB(string& strError)
 {
+    int64_t nTimeStart = GetTimeMicros();
     if (!pblocktree->LoadBlockIndexGuts())
         return false;
+    RecordStartupPhase("blockindex", GetTimeMicros() - nTimeStart);
 
     boost::this_thread::interruption_point();
 
     // Calculate nChainWork
+    nTimeStart = GetTimeMicros();
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
     for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex) {
@@ -5064,11 +5429,14 @@ bool static LoadBlockIndexDB(string& strError)
         vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
     }
     sort(vSortedByHeight.begin(), vSortedByHeight.end());
+    size_t nWithExtra = 0;
     for (const PAIRTYPE(int, CBlockIndex*) & item : vSortedByHeight) {
         // Stop if shutdown was requested
         if (ShutdownRequested()) return false;
 
         CBlockIndex* pindex = item.second;
+        if (pindex->pextra)
+            nWithExtra++;
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
         if (pindex->nStatus & BLOCK_HAVE_DATA) {
             if (pindex->pprev) {
@@ -5093,8 +5461,12 @@ bool static LoadBlockIndexDB(string& strError)
             (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
+    RecordStartupPhase("chainwork", GetTimeMicros() - nTimeStart);
+    LogPrint("bench", "%s: %u block index entries of %u bytes, %u with a CBlockIndexExtra of %u bytes\n", __func__,
+        vSortedByHeight.size(), sizeof(CBlockIndex), nWithExtra, sizeof(CBlockIndexExtra));
 
     // Load block file info
+    nTimeStart = GetTimeMicros();
     pblocktree->ReadLastBlockFile(nLastBlockFile);
     vinfoBlockFile.resize(nLastBlockFile + 1);
     LogPrintf("%s: last block file = %i\n", __func__, nLastBlockFile);
@@ -5126,6 +5498,7 @@ bool static LoadBlockIndexDB(string& strError)
             return false;
         }
     }
+    RecordStartupPhase("blockfileinfo", GetTimeMicros() - nTimeStart);
 
     //Check if the shutdown procedure was followed on last client exit
     bool fLastShutdownWasPrepared = true;
@@ -5141,6 +5514,10 @@ bool static LoadBlockIndexDB(string& strError)
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("LoadBlockIndexDB(): transaction index %s\n", fTxIndex ? "enabled" : "disabled");
 
+    // Convert the key image index from the old hex string format
+    if (!pblocktree->UpgradeKeyImageIndex())
+        return error("LoadBlockIndexDB(): failed to upgrade key image index");
+
     // If this is written true before the next client init, then we know the shutdown process failed
     pblocktree->WriteFlag("shutdown", false);
 
@@ -5262,6 +5639,11 @@ bool LoadBlockIndex(string& strError)
     // Load block index from databases
     if (!fReindex && !LoadBlockIndexDB(strError))
         return false;
+    // LoadBlockIndexDB upgraded the key image index, so it can be scanned now
+    if (!pkeyimages->Load()) {
+        strError = "failed to load key image index";
+        return false;
+    }
     return true;
 }
 
@@ -5304,107 +5686,340 @@ bool InitBlockIndex()
 }
 
 
-bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
+namespace {
+
+/**
+ * Reads the blocks of an external block file ahead of LoadExternalBlockFile. A
+ * reader thread scans the file for blocks and queues their raw bytes, a pool of
+ * workers deserializes them and runs PreCheckBlock, and Next hands them out in
+ * file order so that they are still accepted and connected one by one.
+ */
+class CBlockImportPipeline
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+public:
+    struct CEntry {
+        CDiskBlockPos pos;
+        //! where the file is scanned again if the block does not deserialize, just after its message start
+        uint64_t nRewind;
+        CDataStream ssRaw;
+        CBlock block;
+        uint256 hash;
+        //! a worker took it
+        bool fTaken;
+        //! the worker is done with it
+        bool fDone;
+        bool fDeserialized;
+        bool fPreChecked;
+
+        CEntry() : nRewind(0), ssRaw(SER_DISK, CLIENT_VERSION), fTaken(false), fDone(false), fDeserialized(false), fPreChecked(false) {}
+    };
+
+    CBlockImportPipeline(FILE* fileIn, int nFile, int nWorkers) : fEof(false), fReaderDone(false), fStop(false), fResync(false), nResyncPos(0)
+    {
+        threadGroup.create_thread(boost::bind(&CBlockImportPipeline::Read, this, fileIn, nFile));
+        for (int i = 0; i < nWorkers; i++)
+            threadGroup.create_thread(boost::bind(&CBlockImportPipeline::Work, this));
+    }
 
-    int nLoaded = 0;
-    try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2 * MAX_BLOCK_SIZE_CURRENT, MAX_BLOCK_SIZE_CURRENT + 8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
+    ~CBlockImportPipeline()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            fStop = true;
+        }
+        cond.notify_all();
+        threadGroup.join_all();
+    }
 
-            blkdat.SetPos(nRewind);
-            nRewind++;         // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[MESSAGE_START_SIZE];
-                blkdat.FindByte(Params().MessageStart()[0]);
-                nRewind = blkdat.GetPos() + 1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE_CURRENT)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
+    //! Wait for the next block of the file, NULL once there are no more
+    std::shared_ptr<CEntry> Next()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (true) {
+            while (queue.empty() ? !fEof : !queue.front()->fDone)
+                cond.wait(lock);
+            if (queue.empty())
+                return std::shared_ptr<CEntry>();
+            std::shared_ptr<CEntry> entry = queue.front();
+            if (!entry->fDeserialized && !fReaderDone) {
+                // The size in front of the block may be corrupt and cover valid
+                // blocks, so scan again byte by byte from just after its message
+                // start. The blocks read after it are dropped and found again.
+                queue.clear();
+                fResync = true;
+                nResyncPos = entry->nRewind;
+                fEof = false;
+                cond.notify_all();
+                continue;
             }
-            try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != Params().HashGenesisBlock() &&
-                    mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                        block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+            queue.pop_front();
+            cond.notify_all();
+            return entry;
+        }
+    }
+
+    //! The system error that stopped the reader, if any
+    std::string GetError()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        return strError;
+    }
+
+private:
+    boost::mutex cs;
+    boost::condition_variable cond;
+    //! Blocks read from the file in file order, up to MAX_IMPORT_LOOKAHEAD of them
+    std::deque<std::shared_ptr<CEntry> > queue;
+    //! the reader found no more blocks, it waits for a resync request
+    bool fEof;
+    //! the reader thread has exited
+    bool fReaderDone;
+    bool fStop;
+    //! the reader has to scan again from nResyncPos
+    bool fResync;
+    uint64_t nResyncPos;
+    std::string strError;
+    boost::thread_group threadGroup;
+
+    //! Queue a block, blocks read before a resync request are dropped. False if the pipeline stops.
+    bool Push(const std::shared_ptr<CEntry>& entry)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (!fStop && !fResync && queue.size() >= MAX_IMPORT_LOOKAHEAD)
+            cond.wait(lock);
+        if (fStop)
+            return false;
+        if (!fResync) {
+            queue.push_back(entry);
+            cond.notify_all();
+        }
+        return true;
+    }
+
+    //! Take a pending resync request, waiting for one or for the stop if fWait. False if the pipeline stops.
+    bool TakeResync(bool fWait, bool& fResyncTaken, uint64_t& nPos)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (fWait) {
+            fEof = true;
+            cond.notify_all();
+            while (!fStop && !fResync)
+                cond.wait(lock);
+        }
+        if (fStop)
+            return false;
+        fResyncTaken = fResync;
+        if (fResync) {
+            nPos = nResyncPos;
+            fResync = false;
+            fEof = false;
+        }
+        return true;
+    }
+
+    void Read(FILE* fileIn, int nFile)
+    {
+        try {
+            // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+            CBufferedFile blkdat(fileIn, 2 * MAX_BLOCK_SIZE_CURRENT, MAX_BLOCK_SIZE_CURRENT + 8, SER_DISK, CLIENT_VERSION);
+            uint64_t nRewind = blkdat.GetPos();
+            bool fResyncTaken = false;
+            bool fWait = false;
+            while (true) {
+                // At the end of the file, wait for a resync request or the stop
+                if (!TakeResync(fWait || blkdat.eof(), fResyncTaken, nRewind))
+                    break;
+                fWait = false;
+                if (fResyncTaken) {
+                    // The resync position may be further back than the buffer keeps
+                    blkdat.SetLimit();
+                    if (!blkdat.SetPos(nRewind) && !blkdat.Seek(nRewind))
+                        throw std::runtime_error("unable to seek to the resync position");
+                }
+                blkdat.SetPos(nRewind);
+                nRewind++;         // start one byte further next time, in case of failure
+                blkdat.SetLimit(); // remove former limit
+                unsigned int nSize = 0;
+                try {
+                    // locate a header
+                    unsigned char buf[MESSAGE_START_SIZE];
+                    blkdat.FindByte(Params().MessageStart()[0]);
+                    nRewind = blkdat.GetPos() + 1;
+                    blkdat >> FLATDATA(buf);
+                    if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
+                        continue;
+                    // read size
+                    blkdat >> nSize;
+                    if (nSize < 80 || nSize > MAX_BLOCK_SIZE_CURRENT)
+                        continue;
+                } catch (const std::exception&) {
+                    // no valid block header found; don't complain
+                    fWait = true;
                     continue;
                 }
-
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash] == NULL) || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    CValidationState state;
-                    if (ProcessNewBlock(state, NULL, &block, dbp))
-                        nLoaded++;
-                    if (state.IsError())
+                try {
+                    // read block, the workers deserialize it
+                    uint64_t nBlockPos = blkdat.GetPos();
+                    std::shared_ptr<CEntry> entry(new CEntry());
+                    entry->pos = CDiskBlockPos(nFile, nBlockPos);
+                    entry->nRewind = nRewind;
+                    entry->ssRaw.resize(nSize);
+                    blkdat.SetLimit(nBlockPos + nSize);
+                    blkdat.SetPos(nBlockPos);
+                    blkdat.read(&entry->ssRaw[0], nSize);
+                    nRewind = blkdat.GetPos();
+                    if (!Push(entry))
                         break;
-                } else if (hash != Params().HashGenesisBlock() && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(),
-                        mapBlockIndex[hash]->nHeight);
+                } catch (const std::exception& e) {
+                    LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
                 }
+            }
+        } catch (const std::runtime_error& e) {
+            boost::unique_lock<boost::mutex> lock(cs);
+            strError = e.what();
+        }
+
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            fEof = true;
+            fReaderDone = true;
+        }
+        cond.notify_all();
+    }
 
-                // Recursively process earlier encountered successors of this block
-                deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(
-                        head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second)) {
-                            LogPrintf("%s: Processing out of order child %s of %s\n", __func__,
-                                block.GetHash().ToString(),
-                                head.ToString());
-                            CValidationState dummy;
-                            if (ProcessNewBlock(dummy, NULL, &block, &it->second)) {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
-                            }
+    void Work()
+    {
+        while (true) {
+            std::shared_ptr<CEntry> entry;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                while (!fStop) {
+                    for (const std::shared_ptr<CEntry>& queued : queue) {
+                        if (!queued->fTaken) {
+                            entry = queued;
+                            break;
                         }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
                     }
+                    if (entry || fEof)
+                        break;
+                    cond.wait(lock);
                 }
+                if (!entry)
+                    return;
+                entry->fTaken = true;
+            }
+
+            try {
+                entry->ssRaw >> entry->block;
+                entry->hash = entry->block.GetHash();
+                entry->fDeserialized = true;
+                CValidationState state;
+                entry->fPreChecked = PreCheckBlock(entry->block, state);
             } catch (const std::exception& e) {
                 LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
             }
+            // release the raw bytes while the block waits for its turn
+            entry->ssRaw = CDataStream(SER_DISK, CLIENT_VERSION);
+
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                entry->fDone = true;
+            }
+            cond.notify_all();
+        }
+    }
+};
+
+} // anon namespace
+
+bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
+{
+    // Map of disk positions for blocks with unknown parent (only used for reindex)
+    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+    int64_t nStart = GetTimeMillis();
+
+    int nThreads = GetArg("-importthreads", DEFAULT_IMPORT_THREADS);
+    if (nThreads <= 0)
+        nThreads += boost::thread::hardware_concurrency();
+    nThreads = std::max(1, std::min(nThreads, MAX_IMPORT_THREADS));
+
+    int nLoaded = 0;
+    int64_t nTimeWait = 0;
+    CBlockImportPipeline pipeline(fileIn, dbp ? dbp->nFile : 0, nThreads);
+    while (true) {
+        boost::this_thread::interruption_point();
+
+        int64_t nTimeStart = GetTimeMicros();
+        std::shared_ptr<CBlockImportPipeline::CEntry> entry = pipeline.Next();
+        nTimeWait += GetTimeMicros() - nTimeStart;
+        if (!entry)
+            break;
+        // deserialization errors are logged by the worker
+        if (!entry->fDeserialized)
+            continue;
+
+        try {
+            if (dbp)
+                dbp->nPos = entry->pos.nPos;
+            CBlock& block = entry->block;
+
+            // detect out of order blocks, and store them for later
+            const uint256& hash = entry->hash;
+            if (hash != Params().HashGenesisBlock() &&
+                mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+                LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                    block.hashPrevBlock.ToString());
+                if (dbp)
+                    mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+                continue;
+            }
+
+            // process in case the block isn't known yet
+            if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash] == NULL) || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+                CValidationState state;
+                if (ProcessNewBlock(state, NULL, &block, dbp, entry->fPreChecked))
+                    nLoaded++;
+                if (state.IsError())
+                    break;
+            } else if (hash != Params().HashGenesisBlock() && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+                LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(),
+                    mapBlockIndex[hash]->nHeight);
+            }
+
+            // Recursively process earlier encountered successors of this block
+            deque<uint256> queue;
+            queue.push_back(hash);
+            while (!queue.empty()) {
+                uint256 head = queue.front();
+                queue.pop_front();
+                std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(
+                    head);
+                while (range.first != range.second) {
+                    std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+                    if (ReadBlockFromDisk(block, it->second)) {
+                        LogPrintf("%s: Processing out of order child %s of %s\n", __func__,
+                            block.GetHash().ToString(),
+                            head.ToString());
+                        CValidationState dummy;
+                        if (ProcessNewBlock(dummy, NULL, &block, &it->second)) {
+                            nLoaded++;
+                            queue.push_back(block.GetHash());
+                        }
+                    }
+                    range.first++;
+                    mapBlocksUnknownParent.erase(it);
+                }
+            }
+        } catch (const std::exception& e) {
+            LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
         }
-    } catch (const std::runtime_error& e) {
-        AbortNode(std::string("System error: ") + e.what());
     }
+    const std::string strError = pipeline.GetError();
+    if (!strError.empty())
+        AbortNode(std::string("System error: ") + strError);
     if (nLoaded > 0)
         LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
+    LogPrint("bench", "    - Waited %.2fms for blocks read ahead by %d threads\n", nTimeWait * 0.001, nThreads);
     return nLoaded > 0;
 }
 
@@ -7063,16 +7678,19 @@ bool CBlockUndo::WriteToDisk(CDiskBlockPos& pos, const uint256& hashBlock)
 
 bool CBlockUndo::ReadFromDisk(const CDiskBlockPos& pos, const uint256& hashBlock)
 {
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("CBlockUndo::ReadFromDisk : OpenBlockFile failed");
+    unsigned int nSize;
+    if (!ReadDiskRecordSize(pos, "rev", nSize))
+        return error("CBlockUndo::ReadFromDisk : ReadDiskRecordSize failed");
 
-    // Read block
+    // Read undo data and the checksum following it
     uint256 hashChecksum;
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss.resize(nSize + sizeof(hashChecksum));
+    if (!ReadDiskFile(pos, "rev", &ss[0], ss.size()))
+        return error("CBlockUndo::ReadFromDisk : ReadDiskFile failed");
     try {
-        filein >> *this;
-        filein >> hashChecksum;
+        ss >> *this;
+        ss >> hashChecksum;
     } catch (const std::exception& e) {
         return error("%s : Deserialize or I/O error - %s", __func__, e.what());
     }
@@ -7101,10 +7719,7 @@ public:
 
     ~CMainCleanup()
     {
-        // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
+        // block headers, the entries themselves are owned by blockIndexArena
         mapBlockIndex.clear();
 
         // orphan transactions
@@ -52,6 +52,9 @@ class CBlockIndex;
 class CBlockTreeDB;
 class CBloomFilter;
 class CInv;
+class CKeyImageView;
+class CRingCTCheck;
+struct CRingMemberOutput;
 class CScriptCheck;
 class CValidationInterface;
 class CValidationState;
@@ -88,6 +91,22 @@ static const int COINBASE_MATURITY = 100;
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Maximum number of threads deserializing and pre-checking blocks during an import */
+static const int MAX_IMPORT_THREADS = 16;
+/** -importthreads default (0 = auto) */
+static const int DEFAULT_IMPORT_THREADS = 0;
+/** Number of blocks an import reads ahead of the block being connected */
+static const unsigned int MAX_IMPORT_LOOKAHEAD = 64;
+/** Scratch space limit per multi-exponentiation point of the per-thread scratch space used to verify bulletproofs */
+static const size_t BULLETPROOF_VERIFY_SCRATCH_PER_POINT = 512;
+/** Scratch space limit per proof, on top of its points, for the state the bulletproof verifier keeps for it */
+static const size_t BULLETPROOF_VERIFY_SCRATCH_PER_PROOF = 8 * 1024;
+/** Scratch space limit for the multi-exponentiation buckets of bulletproof verification */
+static const size_t BULLETPROOF_VERIFY_SCRATCH_BASE = 1024 * 1024;
+/** Scratch space limit per proven bit of the per-thread scratch space used to make bulletproofs */
+static const size_t BULLETPROOF_PROVE_SCRATCH_PER_BIT = 8 * 1024;
+/** Maximum number of range proofs verified in a single multi-exponentiation */
+static const size_t MAX_BULLETPROOF_BATCH = 64;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -184,13 +203,91 @@ void RegisterNodeSignals(CNodeSignals& nodeSignals);
 void UnregisterNodeSignals(CNodeSignals& nodeSignals);
 
 secp256k1_context2* GetContext();
-secp256k1_scratch_space2* GetScratch();
+/** Scratch space of the calling thread for proving the ranges of nOutputs outputs, grown to the largest proof it made */
+secp256k1_scratch_space2* GetProveScratch(size_t nOutputs);
 secp256k1_bulletproof_generators* GetGenerator();
-bool VerifyBulletProofAggregate(const CTransaction& tx);
-bool VerifyRingSignatureWithTxFee(const CTransaction& tx, CBlockIndex* pindex);
+/** Scratch space of the calling thread for verifying nProofs range proofs over nCommits outputs each, grown to the largest batch it verified */
+secp256k1_scratch_space2* GetVerifyScratch(size_t nProofs, size_t nCommits);
+bool VerifyBulletProofAggregate(const CTransaction& tx, bool fStore = false);
+/** Verify a transaction's aggregate range proof, also during initial block download */
+bool VerifyBulletProof(const CTransaction& tx);
+/**
+ * Verify the range proofs of several transactions with one multi-exponentiation per
+ * group of equally shaped proofs. On failure, pnFailed receives the index of the offender.
+ */
+bool VerifyBulletProofBatch(const std::vector<const CTransaction*>& vtx, size_t* pnFailed = NULL);
+bool VerifyRingSignatureWithTxFee(const CTransaction& tx, CBlockIndex* pindex, bool fStore = false);
+
+/**
+ * The public inputs of one transaction's MLSAG ring signature, gathered from the
+ * chain up front so that verifying them needs neither cs_main nor disk access.
+ * Rows 0..vin.size()-1 hold the rings of the inputs, the last row holds the
+ * commitment balance keys signed with the transaction fee key image.
+ * Ring keys and responses are stored column by column.
+ */
+struct CRingSignatureMatrix {
+    uint256 txid;
+    uint256 hashSig;
+    uint256 c;
+    size_t nRows;
+    size_t nCols;
+    std::vector<CPubKey> vPubKeys;
+    std::vector<CKeyImage> vKeyImages;
+    std::vector<uint256> vS;
+
+    CRingSignatureMatrix() : nRows(0), nCols(0) {}
+};
+
+/**
+ * Decompress a 33-byte ring member public key and hash it to the curve point its
+ * key image and R points are built on. Returns false if the key is not a valid point.
+ */
+bool ParseRingPoint(const unsigned char* pubkey, secp256k1_pubkey2& point, secp256k1_pubkey2& hashPoint);
+
+/**
+ * Verifies a set of ring signatures, typically all those of one block. Every
+ * distinct ring member is decompressed and hashed to its curve point once for
+ * the whole batch, and each ring column is evaluated in group-element form.
+ */
+class CRingSignatureBatch
+{
+private:
+    struct CRingPoint {
+        secp256k1_pubkey2 point;
+        secp256k1_pubkey2 hashPoint;
+    };
+
+    std::vector<CRingSignatureMatrix> vMatrices;
+    std::map<CPubKey, CRingPoint> mapPoints;
+
+    const CRingPoint* GetPoint(const CPubKey& pubkey);
+    bool VerifyMatrix(const CRingSignatureMatrix& matrix);
+
+public:
+    void Add(CRingSignatureMatrix matrix) { vMatrices.push_back(std::move(matrix)); }
+    size_t size() const { return vMatrices.size(); }
+    void swap(CRingSignatureBatch& batch);
+
+    /** Verify every queued ring signature. On failure, *pnFailed is set to the index of the first invalid one. */
+    bool Verify(size_t* pnFailed = NULL);
+};
+
+/** Collect the ring members, key images and responses of a transaction's ring signature */
+bool GetRingSignatureMatrix(const CTransaction& tx, CBlockIndex* pindex, CRingSignatureMatrix& matrix);
+/**
+ * Gather the ring signatures and bulletproofs of all non-coinbase, non-coinstake and
+ * non-audit transactions of a block, spread over at most nChecks CRingCTCheck closures.
+ * Only the transaction fees are checked when fCheckRingCT is false.
+ */
+bool GetBlockRingCTChecks(const CBlock& block, CBlockIndex* pindex, CValidationState& state, std::vector<CRingCTCheck>& vChecks, size_t nChecks, bool fCheckRingCT);
 void DestroyContext();
 bool VerifyDerivedAddress(const CTxOut& out, std::string stealth);
 bool ReVerifyPoSBlock(CBlockIndex* pindex);
+/**
+ * ReVerifyPoSBlock for a list of audited blocks, with the ring signature and bulletproof
+ * checks of all blocks spread over the script check threads. vValid[i] is the verdict of vIndex[i].
+ */
+void ReVerifyPoSBlocks(const std::vector<CBlockIndex*>& vIndex, std::vector<bool>& vValid);
 
 /**
  * Process an incoming block. This only returns after the best known valid
@@ -201,9 +298,10 @@ bool ReVerifyPoSBlock(CBlockIndex* pindex);
  * @param[in]   pfrom   The node which we are receiving the block from; it is added to mapBlockSource and may be penalised if the block is invalid.
  * @param[in]   pblock  The block we want to process.
  * @param[out]  dbp     If pblock is stored to disk (or already there), this will be set to its location.
+ * @param[in]   fPreChecked  PreCheckBlock already passed for pblock, skip the checks it covers.
  * @return True if state.IsValid()
  */
-bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDiskBlockPos* dbp = NULL);
+bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDiskBlockPos* dbp = NULL, bool fPreChecked = false);
 /** Check whether enough disk space is available for an incoming block */
 bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
 /** Open a block file (blk?????.dat) */
@@ -234,6 +332,8 @@ bool VerifyZeroBlindCommitment(const CTxOut& out);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the ring signature and bulletproof checking thread */
+void ThreadRingCTCheck();
 
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
@@ -241,6 +341,8 @@ bool IsInitialBlockDownload();
 std::string GetWarnings(std::string strFor);
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
 bool GetTransaction(const uint256& hash, CTransaction& tx, uint256& hashBlock, bool fAllowSlow = false);
+/** Retrieve the ring member data of a confirmed output */
+bool GetRingMemberOutput(const COutPoint& outpoint, CRingMemberOutput& output, bool fAllowSlow = false);
 /** Find the best known block, and make it the tip of the block chain */
 
 bool CheckHaveInputs(const CCoinsViewCache& view, const CTransaction& tx);
@@ -259,6 +361,8 @@ void RemoveInvalidTransactionsFromMempool();
 
 /** Create a new block index entry for a given block hash */
 CBlockIndex* InsertBlockIndex(uint256 hash);
+/** Take over block index entries that were allocated outside of main, e.g. by the block index load */
+void AdoptBlockIndexEntries(CBlockIndexArena& arena);
 /** Abort with a message */
 bool AbortNode(const std::string& msg, const std::string& userMessage = "");
 /** Get statistics from node state */
@@ -277,8 +381,8 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
 
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool isDSTX = false);
 
-bool IsKeyImageSpend1(const std::string& kiHex, const uint256& againsHash);
-bool CheckKeyImageSpendInMainChain(const std::string& kiHex, int& confirmations);
+bool IsKeyImageSpend1(const CKeyImage& keyImage, const uint256& againsHash);
+bool CheckKeyImageSpendInMainChain(const CKeyImage& keyImage, int& confirmations);
 
 double GetPriority(const CTransaction& tx, int nHeight);
 
@@ -448,6 +552,41 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing the ring signature and bulletproof verification of a
+ * group of transactions, so that it can run on the script check threads.
+ */
+class CRingCTCheck
+{
+private:
+    CRingSignatureBatch rings;
+    std::vector<const CTransaction*> vRingTx;
+    std::vector<const CTransaction*> vBulletproofTx;
+    //! When set, receives the result and the check always passes, so one failure does not stop the other checks
+    bool* pfValid;
+
+public:
+    CRingCTCheck() : pfValid(NULL) {}
+
+    void SetResult(bool* pfValidIn) { pfValid = pfValidIn; }
+    void AddRingSignature(const CTransaction& tx, CRingSignatureMatrix matrix)
+    {
+        rings.Add(std::move(matrix));
+        vRingTx.push_back(&tx);
+    }
+    void AddBulletproof(const CTransaction& tx) { vBulletproofTx.push_back(&tx); }
+
+    bool operator()();
+
+    void swap(CRingCTCheck& check)
+    {
+        rings.swap(check.rings);
+        vRingTx.swap(check.vRingTx);
+        vBulletproofTx.swap(check.vBulletproofTx);
+        std::swap(pfValid, check.pfValid);
+    }
+};
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
@@ -472,6 +611,13 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
 bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fCheckSig = true);
+/** The coinstake and reward commitment signatures CheckBlock verifies when fCheckSig is set */
+bool CheckBlockSignatures(const CBlock& block, CValidationState& state);
+/**
+ * The merkle root and signature checks of a block, which depend on nothing but
+ * the block itself and can therefore run ahead of the chain on any thread.
+ */
+bool PreCheckBlock(const CBlock& block, CValidationState& state);
 bool CheckWork(const CBlock block, CBlockIndex* const pindexPrev);
 
 /** Context-dependent validity checks */
@@ -644,6 +790,9 @@ extern CCoinsViewCache* pcoinsTip;
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB* pblocktree;
 
+/** Cache of the key image index in pblocktree */
+extern CKeyImageView* pkeyimages;
+
 struct CBlockTemplate {
     CBlock block;
     std::vector<CAmount> vTxFees;
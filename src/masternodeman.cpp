@@ -1009,7 +1009,7 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
 
         CValidationState state;
 
-        bool fAcceptable = !IsKeyImageSpend1(vin.keyImage.GetHex(), uint256());
+        bool fAcceptable = !IsKeyImageSpend1(vin.keyImage, uint256());
 
         if (fAcceptable) {
             if (GetInputAge(vin) < MASTERNODE_MIN_CONFIRMATIONS) {
@@ -100,6 +100,7 @@ uint32_t GetListOfPoSInfo(uint32_t currentHeight, std::vector<PoSBlockSummary>&
 {
     //A PoA block should be mined only after at least 59 PoS blocks have not been audited
     //Look for the previous PoA block
+    const size_t nFirstAudit = audits.size();
     uint32_t nloopIdx = currentHeight;
     while (nloopIdx >= Params().START_POA_BLOCK()) {
         if (chainActive[nloopIdx]->GetBlockHeader().IsPoABlockByVersion()) {
@@ -112,8 +113,7 @@ uint32_t GetListOfPoSInfo(uint32_t currentHeight, std::vector<PoSBlockSummary>&
         for (int i = Params().LAST_POW_BLOCK() + 1; i <= Params().LAST_POW_BLOCK() + 60; i++) {
             PoSBlockSummary pos;
             pos.hash = chainActive[i]->GetBlockHash();
-            CBlockIndex* pindex = mapBlockIndex[pos.hash];
-            pos.nTime = ReVerifyPoSBlock(pindex) ? chainActive[i]->GetBlockHeader().nTime : 0;
+            pos.nTime = chainActive[i]->GetBlockHeader().nTime;
             pos.height = i;
             audits.push_back(pos);
         }
@@ -137,8 +137,7 @@ uint32_t GetListOfPoSInfo(uint32_t currentHeight, std::vector<PoSBlockSummary>&
                 if (posBlock.IsProofOfStake()) {
                     PoSBlockSummary pos;
                     pos.hash = chainActive[nextAuditHeight]->GetBlockHash();
-                    CBlockIndex* pindex = mapBlockIndex[pos.hash];
-                    pos.nTime = ReVerifyPoSBlock(pindex) ? chainActive[nextAuditHeight]->GetBlockHeader().nTime : 0;
+                    pos.nTime = chainActive[nextAuditHeight]->GetBlockHeader().nTime;
                     pos.height = nextAuditHeight;
                     audits.push_back(pos);
                 }
@@ -150,6 +149,17 @@ uint32_t GetListOfPoSInfo(uint32_t currentHeight, std::vector<PoSBlockSummary>&
             }
         }
     }
+
+    //Blocks that fail the audit are listed with a zero time
+    std::vector<CBlockIndex*> vAuditedIndex;
+    for (size_t i = nFirstAudit; i < audits.size(); i++)
+        vAuditedIndex.push_back(mapBlockIndex[audits[i].hash]);
+    std::vector<bool> vValid;
+    ReVerifyPoSBlocks(vAuditedIndex, vValid);
+    for (size_t i = 0; i < vValid.size(); i++) {
+        if (!vValid[i])
+            audits[nFirstAudit + i].nTime = 0;
+    }
     return nloopIdx;
 }
 
@@ -262,7 +272,7 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, const CPubKey& txP
             // Check key images not duplicated with what in db
             for (const CTxIn& txin : tx.vin) {
                 const CKeyImage& keyImage = txin.keyImage;
-                if (IsKeyImageSpend1(keyImage.GetHex(), uint256())) {
+                if (IsKeyImageSpend1(keyImage, uint256())) {
                     fKeyImageCheck = false;
                     break;
                 }
@@ -190,6 +190,10 @@ bool CheckPoAContainRecentHash(const CBlock& block)
         pindex = pindex->pprev;
     }
     bool ret = true;
+    //audited blocks are re-verified together once the chain structure checks passed,
+    //the first one that fails while the summary claims it valid decides the result
+    std::vector<CBlockIndex*> vAuditedIndex;
+    std::vector<PoSBlockSummary> vAuditedSummary;
     if (pindex->nHeight <= Params().START_POA_BLOCK()) {
         //this is the first PoA block ==> check all PoS blocks from LAST_POW_BLOCK up to currentHeight - POA_BLOCK_PERIOD - 1 inclusive
         int index = 0;
@@ -203,14 +207,8 @@ bool CheckPoAContainRecentHash(const CBlock& block)
                 ret = false;
                 break;
             }
-            CBlockIndex* p = mapBlockIndex[pos.hash];
-            bool auditResult = ReVerifyPoSBlock(p);
-            if (!auditResult) {
-                if (pos.nTime) {
-                    ret = false;
-                    break;
-                }
-            }
+            vAuditedIndex.push_back(pidxInChain);
+            vAuditedSummary.push_back(pos);
             index++;
         }
     } else {
@@ -269,28 +267,26 @@ bool CheckPoAContainRecentHash(const CBlock& block)
                     previousPoSIndex->GetBlockTime() != previousSummary.nTime) {
                     return error("CheckPoAContainRecentHash(): PoS block info not matched for %s\n", thisPoSAduditedHash.GetHex());
                 }
-                bool auditResult = ReVerifyPoSBlock(thisPoSAuditedIndex);
-                if (!auditResult) {
-                    if (previousSummary.nTime) {
-                        ret = false;
-                        LogPrintf("%s: Failed to reverify block %s\n", __func__, previousSummary.hash.GetHex());
-                        break;
-                    }
-                }
-            }
-            if (ret) {
-                bool auditResult = ReVerifyPoSBlock(pCurrentFirstPoSAuditedIndex);
-                if (!auditResult) {
-                    if (block.posBlocksAudited[0].nTime) {
-                        ret = false;
-                        LogPrintf("%s: Failed to reverify block %s\n", __func__, block.posBlocksAudited[0].hash.GetHex());
-                    }
-                }
+                vAuditedIndex.push_back(thisPoSAuditedIndex);
+                vAuditedSummary.push_back(previousSummary);
             }
+            vAuditedIndex.push_back(pCurrentFirstPoSAuditedIndex);
+            vAuditedSummary.push_back(block.posBlocksAudited[0]);
         } else {
             ret = block.hashPrevPoABlock.IsNull();
         }
     }
+    if (ret && !vAuditedIndex.empty()) {
+        std::vector<bool> vValid;
+        ReVerifyPoSBlocks(vAuditedIndex, vValid);
+        for (size_t i = 0; i < vValid.size(); i++) {
+            if (!vValid[i] && vAuditedSummary[i].nTime) {
+                LogPrintf("%s: Failed to reverify block %s\n", __func__, vAuditedSummary[i].hash.GetHex());
+                ret = false;
+                break;
+            }
+        }
+    }
     return ret;
 }
 
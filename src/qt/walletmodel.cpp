@@ -808,7 +808,7 @@ std::map<QString, QString> getTx(CWallet* wallet, CWalletTx tx)
     }
     CAmount firstOut = 0;
     if (wallet && !wallet->IsLocked()) {
-        for (CTxOut out: tx.vout){
+        for (const CTxOut& out: tx.vout){
             CAmount vamount;
             CKey blind;
             if (wallet->IsMine(out) && wallet->RevealTxOutAmount(tx,out,vamount, blind)) {
@@ -368,7 +368,10 @@ static bool rest_tx(HTTPRequest *req, const std::string &strURIPart) {
 
         case RF_JSON: {
             UniValue objTx(UniValue::VOBJ);
-            TxToJSON(tx, hashBlock, objTx);
+            {
+                LOCK(cs_main);
+                TxToJSON(tx, hashBlock, objTx);
+            }
             string strJSON = objTx.write() + "\n";
             req->WriteHeader("Content-Type", "application/json");
             req->WriteReply(HTTP_OK, strJSON);
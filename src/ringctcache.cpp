@@ -0,0 +1,147 @@
+// Copyright (c) 2018-2020 The DAPS Project developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "ringctcache.h"
+
+#include "crypto/sha256.h"
+#include "main.h"
+#include "random.h"
+#include "uint256.h"
+#include "util.h"
+
+#include <atomic>
+#include <set>
+
+#include <boost/thread.hpp>
+
+namespace {
+
+/**
+ * Valid ring signature and bulletproof cache, to avoid verifying the privacy
+ * crypto twice for every transaction (once when accepted into memory pool,
+ * and again when accepted into the block chain). Entries are salted hashes,
+ * so an attacker can not predict which entries random eviction will hit.
+ */
+class CRingCTCache
+{
+private:
+    static const unsigned char RING_SIGNATURE = 'R';
+    static const unsigned char BULLETPROOF = 'B';
+
+    unsigned char salt[32];
+    std::set<uint256> setValid;
+    boost::shared_mutex cs_ringctcache;
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+
+    CSHA256 Hasher(unsigned char type) const
+    {
+        CSHA256 hasher;
+        hasher.Write(salt, sizeof(salt)).Write(&type, 1);
+        return hasher;
+    }
+
+public:
+    CRingCTCache() : nHits(0), nMisses(0)
+    {
+        GetRandBytes(salt, sizeof(salt));
+    }
+
+    bool Get(const uint256& entry)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_ringctcache);
+        if (setValid.count(entry)) {
+            ++nHits;
+            return true;
+        }
+        ++nMisses;
+        return false;
+    }
+
+    void Set(const uint256& entry)
+    {
+        int64_t nMaxCacheSize = GetArg("-maxringctcachesize", DEFAULT_MAX_RINGCT_CACHE_SIZE);
+        if (nMaxCacheSize <= 0) return;
+
+        boost::unique_lock<boost::shared_mutex> lock(cs_ringctcache);
+        while (static_cast<int64_t>(setValid.size()) >= nMaxCacheSize) {
+            // Evict a random entry, see CSignatureCache
+            std::set<uint256>::iterator it = setValid.lower_bound(GetRandHash());
+            if (it == setValid.end())
+                it = setValid.begin();
+            setValid.erase(it);
+        }
+        setValid.insert(entry);
+    }
+
+    uint256 RingSignatureEntry(const CRingSignatureMatrix& matrix) const
+    {
+        CSHA256 hasher = Hasher(RING_SIGNATURE);
+        hasher.Write(matrix.txid.begin(), 32).Write(matrix.hashSig.begin(), 32);
+        for (const CPubKey& pubkey : matrix.vPubKeys)
+            hasher.Write(pubkey.begin(), pubkey.size());
+        for (const CKeyImage& keyImage : matrix.vKeyImages)
+            hasher.Write(keyImage.begin(), keyImage.size());
+        uint256 entry;
+        hasher.Finalize(entry.begin());
+        return entry;
+    }
+
+    uint256 BulletproofEntry(const CTransaction& tx) const
+    {
+        uint256 txid = tx.GetHash();
+        uint256 entry;
+        Hasher(BULLETPROOF).Write(txid.begin(), 32).Finalize(entry.begin());
+        return entry;
+    }
+
+    CRingCTCacheStats Stats()
+    {
+        CRingCTCacheStats stats;
+        {
+            boost::shared_lock<boost::shared_mutex> lock(cs_ringctcache);
+            stats.nSize = setValid.size();
+        }
+        stats.nHits = nHits;
+        stats.nMisses = nMisses;
+        return stats;
+    }
+};
+
+CRingCTCache& GetRingCTCache()
+{
+    static CRingCTCache ringCTCache;
+    return ringCTCache;
+}
+
+}
+
+bool IsRingSignatureCached(const CRingSignatureMatrix& matrix)
+{
+    CRingCTCache& cache = GetRingCTCache();
+    return cache.Get(cache.RingSignatureEntry(matrix));
+}
+
+void CacheRingSignature(const CRingSignatureMatrix& matrix)
+{
+    CRingCTCache& cache = GetRingCTCache();
+    cache.Set(cache.RingSignatureEntry(matrix));
+}
+
+bool IsBulletproofCached(const CTransaction& tx)
+{
+    CRingCTCache& cache = GetRingCTCache();
+    return cache.Get(cache.BulletproofEntry(tx));
+}
+
+void CacheBulletproof(const CTransaction& tx)
+{
+    CRingCTCache& cache = GetRingCTCache();
+    cache.Set(cache.BulletproofEntry(tx));
+}
+
+CRingCTCacheStats GetRingCTCacheStats()
+{
+    return GetRingCTCache().Stats();
+}
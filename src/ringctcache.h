@@ -0,0 +1,38 @@
+// Copyright (c) 2018-2020 The DAPS Project developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef PRCYCOIN_RINGCTCACHE_H
+#define PRCYCOIN_RINGCTCACHE_H
+
+#include <stdint.h>
+
+class CTransaction;
+struct CRingSignatureMatrix;
+
+/** Default for -maxringctcachesize, maximum number of cached ring signature and bulletproof verdicts */
+static const int64_t DEFAULT_MAX_RINGCT_CACHE_SIZE = 20000;
+
+struct CRingCTCacheStats {
+    uint64_t nSize;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+    CRingCTCacheStats() : nSize(0), nHits(0), nMisses(0) {}
+};
+
+/**
+ * Valid ring signature cache. An entry commits to the transaction id, the
+ * signature hash and the ring members the signature was verified against, so
+ * a reorg that resolves the decoys differently does not hit the cache.
+ */
+bool IsRingSignatureCached(const CRingSignatureMatrix& matrix);
+void CacheRingSignature(const CRingSignatureMatrix& matrix);
+
+/** Valid bulletproof cache. Range proofs only depend on the transaction itself. */
+bool IsBulletproofCached(const CTransaction& tx);
+void CacheBulletproof(const CTransaction& tx);
+
+CRingCTCacheStats GetRingCTCacheStats();
+
+#endif // PRCYCOIN_RINGCTCACHE_H
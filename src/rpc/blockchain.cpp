@@ -8,6 +8,7 @@
 
 #include "checkpoints.h"
 #include "main.h"
+#include "ringctcache.h"
 #include "rpc/server.h"
 #include "sync.h"
 #include "util.h"
@@ -82,7 +83,7 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     result.push_back(Pair("bits", strprintf("%08x", blockindex->nBits)));
     result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
     result.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
-    result.push_back(Pair("acc_checkpoint", blockindex->nAccumulatorCheckpoint.GetHex()));
+    result.push_back(Pair("acc_checkpoint", blockindex->GetAccumulatorCheckpoint().GetHex()));
 
     if (blockindex->pprev)
         result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
@@ -1000,6 +1001,31 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
     return mempoolInfoToJSON();
 }
 
+UniValue getringctcacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getringctcacheinfo\n"
+            "\nReturns details on the cache of verified ring signatures and bulletproofs.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"size\": xxxxx                (numeric) Current number of cached entries\n"
+            "  \"maxsize\": xxxxx             (numeric) Maximum number of cached entries\n"
+            "  \"hits\": xxxxx                (numeric) Number of lookups that skipped verification\n"
+            "  \"misses\": xxxxx              (numeric) Number of lookups that required verification\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getringctcacheinfo", "") + HelpExampleRpc("getringctcacheinfo", ""));
+
+    CRingCTCacheStats stats = GetRingCTCacheStats();
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("size", (uint64_t)stats.nSize));
+    ret.push_back(Pair("maxsize", GetArg("-maxringctcachesize", DEFAULT_MAX_RINGCT_CACHE_SIZE)));
+    ret.push_back(Pair("hits", (uint64_t)stats.nHits));
+    ret.push_back(Pair("misses", (uint64_t)stats.nMisses));
+    return ret;
+}
+
 UniValue invalidateblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -14,6 +14,7 @@
 #include "net.h"
 #include "netbase.h"
 #include "rpc/server.h"
+#include "startupprofile.h"
 #include "timedata.h"
 #include "util.h"
 
@@ -129,6 +130,44 @@ UniValue getinfo(const UniValue &params, bool fHelp) {
     return obj;
 }
 
+UniValue getstartupprofile(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getstartupprofile\n"
+            "Returns the time spent in the phases of node startup.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"phases\": [               (array) phases in the order they first ran\n"
+            "    {\n"
+            "      \"phase\": \"name\",       (string) blockindex, chainwork, blockfileinfo, wallet, rescan or mncache\n"
+            "      \"time_ms\": xxxxx,      (numeric) milliseconds spent in the phase\n"
+            "      \"runs\": n              (numeric) how often the phase ran, more than once if the block database was rebuilt\n"
+            "    }\n"
+            "    ,...\n"
+            "  ],\n"
+            "  \"total_ms\": xxxxx          (numeric) milliseconds spent in all phases\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getstartupprofile", "") + HelpExampleRpc("getstartupprofile", ""));
+
+    UniValue phases(UniValue::VARR);
+    int64_t nTotalMicros = 0;
+    for (const CStartupPhase& phase : GetStartupProfile()) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("phase", phase.strName));
+        obj.push_back(Pair("time_ms", phase.nTimeMicros / 1000));
+        obj.push_back(Pair("runs", phase.nCount));
+        phases.push_back(obj);
+        nTotalMicros += phase.nTimeMicros;
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("phases", phases));
+    result.push_back(Pair("total_ms", nTotalMicros / 1000));
+    return result;
+}
+
 UniValue mnsync(const UniValue &params, bool fHelp) {
     std::string strMode;
     if (params.size() == 1)
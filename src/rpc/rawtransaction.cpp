@@ -103,9 +103,8 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
                         const CWalletTx& prev = (*mi).second;
                         if (allDecoys[i].n < prev.vout.size()) {
                             if (pwalletMain->IsMine(prev.vout[allDecoys[i].n])) {
-                                std::string outString = allDecoys[i].hash.GetHex() + std::to_string(allDecoys[i].n);
-                                if (pwalletMain->outpointToKeyImages.count(outString) == 1) {
-                                    CKeyImage ki = pwalletMain->outpointToKeyImages[outString];
+                                if (pwalletMain->outpointToKeyImages.count(allDecoys[i]) == 1) {
+                                    CKeyImage ki = pwalletMain->outpointToKeyImages[allDecoys[i]];
                                     if (ki == txin.keyImage) {
                                         CAmount decodedAmount;
                                         CKey blind;
@@ -304,14 +303,13 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
             "\nExamples:\n" +
             HelpExampleCli("getrawtransaction", "\"mytxid\"") + HelpExampleCli("getrawtransaction", "\"mytxid\" 1") + HelpExampleRpc("getrawtransaction", "\"mytxid\", 1"));
 
-    LOCK(cs_main);
-
     uint256 hash = ParseHashV(params[0], "parameter 1");
 
     bool fVerbose = false;
     if (params.size() > 1)
         fVerbose = (params[1].get_int() != 0);
 
+    // GetTransaction takes cs_main itself, only for the index lookups
     CTransaction tx;
     uint256 hashBlock = 0;
     if (!GetTransaction(hash, tx, hashBlock, true))
@@ -320,6 +318,7 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
     if (!fVerbose)
         return strHex;
 
+    LOCK(cs_main);
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("hex", strHex));
     TxToJSON(tx, hashBlock, result);
@@ -152,6 +152,39 @@ SECP256K1_API void secp256k1_pedersen_serialized_pubkey_to_commitment(
         secp256k1_pedersen_commitment* commit
 ) SECP256K1_ARG_NONNULL(1) SECP256K1_ARG_NONNULL(3);
 
+/** Maximum number of rows accepted by secp256k1_mlsag_compute_column. */
+#define SECP256K1_MLSAG_MAX_ROWS 64
+
+/** Compute the L and R points of one column of an MLSAG ring signature.
+ *
+ *  For every row i this computes L_i = c*P_i + s_i*G and R_i = s_i*H_i + c*I_i
+ *  without leaving group-element form, then converts the whole column to affine
+ *  coordinates with a single field inversion.
+ *
+ *  Returns 1: all points computed and serialized.
+ *          0: a scalar overflows or is zero, or some L_i or R_i is the point at infinity.
+ *  Args:      ctx: pointer to a context object initialized for verification (cannot be NULL)
+ *  Out:     l_out: n_rows serialized compressed L points, 33 bytes each (cannot be NULL)
+ *           r_out: n_rows serialized compressed R points, 33 bytes each (cannot be NULL)
+ *  In:        c32: 32-byte challenge of this column (cannot be NULL)
+ *             s32: n_rows 32-byte responses of this column (cannot be NULL)
+ *         pubkeys: the ring members P_i of this column (cannot be NULL)
+ *      hashpoints: the hashed points H_i = Hp(P_i) of this column (cannot be NULL)
+ *       keyimages: the key images I_i, one per row (cannot be NULL)
+ *          n_rows: number of rows, at most SECP256K1_MLSAG_MAX_ROWS
+ */
+SECP256K1_API SECP256K1_WARN_UNUSED_RESULT int secp256k1_mlsag_compute_column(
+  const secp256k1_context2* ctx,
+  unsigned char* l_out,
+  unsigned char* r_out,
+  const unsigned char* c32,
+  const unsigned char* s32,
+  const secp256k1_pubkey2* pubkeys,
+  const secp256k1_pubkey2* hashpoints,
+  const secp256k1_pubkey2* keyimages,
+  size_t n_rows
+) SECP256K1_ARG_NONNULL(1) SECP256K1_ARG_NONNULL(2) SECP256K1_ARG_NONNULL(3) SECP256K1_ARG_NONNULL(4) SECP256K1_ARG_NONNULL(5) SECP256K1_ARG_NONNULL(6) SECP256K1_ARG_NONNULL(7) SECP256K1_ARG_NONNULL(8);
+
 /** Sets the final Pedersen blinding factor correctly when the generators themselves
  *  have blinding factors.
  *
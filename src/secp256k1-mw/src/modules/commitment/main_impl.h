@@ -278,4 +278,96 @@ int secp256k1_pedersen_blind_generator_blind_sum(const secp256k1_context2* ctx,
     return 1;
 }
 
+/* Computes r = na[0]*a[0] + na[1]*a[1] with a single Strauss pass, sharing the doublings. */
+static void secp256k1_mlsag_ecmult_2(const secp256k1_ecmult_context *ctx, secp256k1_gej *r, const secp256k1_gej *a, const secp256k1_scalar *na) {
+    secp256k1_gej prej[2 * ECMULT_TABLE_SIZE(WINDOW_A)];
+    secp256k1_fe zr[2 * ECMULT_TABLE_SIZE(WINDOW_A)];
+    secp256k1_ge pre_a[2 * ECMULT_TABLE_SIZE(WINDOW_A)];
+    struct secp256k1_strauss_point_state ps[2];
+#ifdef USE_ENDOMORPHISM
+    secp256k1_ge pre_a_lam[2 * ECMULT_TABLE_SIZE(WINDOW_A)];
+#endif
+    struct secp256k1_strauss_state state;
+
+    state.prej = prej;
+    state.zr = zr;
+    state.pre_a = pre_a;
+#ifdef USE_ENDOMORPHISM
+    state.pre_a_lam = pre_a_lam;
+#endif
+    state.ps = ps;
+    secp256k1_ecmult_strauss_wnaf(ctx, &state, r, 2, a, na, NULL);
+}
+
+int secp256k1_mlsag_compute_column(const secp256k1_context2* ctx, unsigned char* l_out, unsigned char* r_out, const unsigned char* c32, const unsigned char* s32, const secp256k1_pubkey2* pubkeys, const secp256k1_pubkey2* hashpoints, const secp256k1_pubkey2* keyimages, size_t n_rows) {
+    secp256k1_gej lrj[2 * SECP256K1_MLSAG_MAX_ROWS];
+    secp256k1_ge lr[2 * SECP256K1_MLSAG_MAX_ROWS];
+    secp256k1_scalar c;
+    int overflow = 0;
+    size_t i;
+
+    VERIFY_CHECK(ctx != NULL);
+    ARG_CHECK(secp256k1_ecmult_context_is_built(&ctx->ecmult_ctx));
+    ARG_CHECK(l_out != NULL);
+    ARG_CHECK(r_out != NULL);
+    ARG_CHECK(c32 != NULL);
+    ARG_CHECK(s32 != NULL);
+    ARG_CHECK(pubkeys != NULL);
+    ARG_CHECK(hashpoints != NULL);
+    ARG_CHECK(keyimages != NULL);
+    ARG_CHECK(n_rows > 0 && n_rows <= SECP256K1_MLSAG_MAX_ROWS);
+
+    secp256k1_scalar_set_b32(&c, c32, &overflow);
+    if (overflow || secp256k1_scalar_is_zero(&c)) {
+        return 0;
+    }
+
+    for (i = 0; i < n_rows; i++) {
+        secp256k1_ge ge;
+        secp256k1_gej pj[2];
+        secp256k1_scalar sc[2];
+
+        secp256k1_scalar_set_b32(&sc[0], &s32[32 * i], &overflow);
+        if (overflow || secp256k1_scalar_is_zero(&sc[0])) {
+            return 0;
+        }
+        sc[1] = c;
+
+        /* L_i = c*P_i + s_i*G */
+        if (!secp256k1_pubkey2_load(ctx, &ge, &pubkeys[i])) {
+            return 0;
+        }
+        secp256k1_gej_set_ge(&pj[0], &ge);
+        secp256k1_ecmult(&ctx->ecmult_ctx, &lrj[2 * i], &pj[0], &c, &sc[0]);
+
+        /* R_i = s_i*H_i + c*I_i */
+        if (!secp256k1_pubkey2_load(ctx, &ge, &hashpoints[i])) {
+            return 0;
+        }
+        secp256k1_gej_set_ge(&pj[0], &ge);
+        if (!secp256k1_pubkey2_load(ctx, &ge, &keyimages[i])) {
+            return 0;
+        }
+        secp256k1_gej_set_ge(&pj[1], &ge);
+        secp256k1_mlsag_ecmult_2(&ctx->ecmult_ctx, &lrj[2 * i + 1], pj, sc);
+
+        if (secp256k1_gej_is_infinity(&lrj[2 * i]) || secp256k1_gej_is_infinity(&lrj[2 * i + 1])) {
+            return 0;
+        }
+    }
+
+    secp256k1_ge_set_all_gej_var(lr, lrj, 2 * n_rows, &ctx->error_callback);
+    for (i = 0; i < n_rows; i++) {
+        size_t len = 33;
+        if (!secp256k1_eckey_pubkey_serialize(&lr[2 * i], &l_out[33 * i], &len, 1)) {
+            return 0;
+        }
+        len = 33;
+        if (!secp256k1_eckey_pubkey_serialize(&lr[2 * i + 1], &r_out[33 * i], &len, 1)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
 #endif
@@ -218,6 +218,64 @@ void test_multiple_generators(void) {
 }
 #undef MAX_N_GENS
 
+static void test_mlsag_compute_column(void) {
+    secp256k1_pubkey2 pubkeys[3];
+    secp256k1_pubkey2 hashpoints[3];
+    secp256k1_pubkey2 keyimages[3];
+    unsigned char c32[32];
+    unsigned char s32[3 * 32];
+    unsigned char l_out[3 * 33];
+    unsigned char r_out[3 * 33];
+    secp256k1_scalar c;
+    size_t i;
+
+    random_scalar_order_test(&c);
+    secp256k1_scalar_get_b32(c32, &c);
+    for (i = 0; i < 3; i++) {
+        unsigned char sec[32];
+        secp256k1_scalar s;
+        random_scalar_order_test(&s);
+        secp256k1_scalar_get_b32(sec, &s);
+        CHECK(secp256k1_ec_pubkey_create2(ctx, &pubkeys[i], sec));
+        random_scalar_order_test(&s);
+        secp256k1_scalar_get_b32(sec, &s);
+        CHECK(secp256k1_ec_pubkey_create2(ctx, &hashpoints[i], sec));
+        random_scalar_order_test(&s);
+        secp256k1_scalar_get_b32(sec, &s);
+        CHECK(secp256k1_ec_pubkey_create2(ctx, &keyimages[i], sec));
+        random_scalar_order_test(&s);
+        secp256k1_scalar_get_b32(&s32[32 * i], &s);
+    }
+    CHECK(secp256k1_mlsag_compute_column(ctx, l_out, r_out, c32, s32, pubkeys, hashpoints, keyimages, 3));
+
+    /* Compare against the same points computed one public-key operation at a time */
+    for (i = 0; i < 3; i++) {
+        secp256k1_pubkey2 l = pubkeys[i];
+        secp256k1_pubkey2 sh = hashpoints[i];
+        secp256k1_pubkey2 ci = keyimages[i];
+        secp256k1_pubkey2 r;
+        const secp256k1_pubkey2 *terms[2];
+        unsigned char ser[33];
+        size_t len = 33;
+        CHECK(secp256k1_ec_pubkey_tweak_mul2(ctx, &l, c32));
+        CHECK(secp256k1_ec_pubkey_tweak_add2(ctx, &l, &s32[32 * i]));
+        CHECK(secp256k1_ec_pubkey_serialize2(ctx, ser, &len, &l, SECP256K1_EC_COMPRESSED));
+        CHECK(memcmp(ser, &l_out[33 * i], 33) == 0);
+        CHECK(secp256k1_ec_pubkey_tweak_mul2(ctx, &sh, &s32[32 * i]));
+        CHECK(secp256k1_ec_pubkey_tweak_mul2(ctx, &ci, c32));
+        terms[0] = &sh;
+        terms[1] = &ci;
+        CHECK(secp256k1_ec_pubkey_combine2(ctx, &r, terms, 2));
+        len = 33;
+        CHECK(secp256k1_ec_pubkey_serialize2(ctx, ser, &len, &r, SECP256K1_EC_COMPRESSED));
+        CHECK(memcmp(ser, &r_out[33 * i], 33) == 0);
+    }
+
+    /* A zero response is rejected */
+    memset(s32, 0, 32);
+    CHECK(secp256k1_mlsag_compute_column(ctx, l_out, r_out, c32, s32, pubkeys, hashpoints, keyimages, 3) == 0);
+}
+
 void run_commitment_tests(void) {
     int i;
     test_commitment_api();
@@ -225,6 +283,9 @@ void run_commitment_tests(void) {
         test_pedersen();
     }
     test_multiple_generators();
+    for (i = 0; i < count; i++) {
+        test_mlsag_compute_column();
+    }
 }
 
 #endif
@@ -0,0 +1,40 @@
+// Copyright (c) 2018-2020 The DAPS Project developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "startupprofile.h"
+
+#include "sync.h"
+#include "util.h"
+
+namespace {
+
+RecursiveMutex cs_startupProfile;
+std::vector<CStartupPhase> vStartupPhases;
+
+} // anon namespace
+
+void RecordStartupPhase(const std::string& strName, int64_t nTimeMicros)
+{
+    LogPrint("bench", "Startup phase %s: %.2fms\n", strName, nTimeMicros * 0.001);
+
+    LOCK(cs_startupProfile);
+    for (CStartupPhase& phase : vStartupPhases) {
+        if (phase.strName == strName) {
+            phase.nTimeMicros += nTimeMicros;
+            phase.nCount++;
+            return;
+        }
+    }
+    CStartupPhase phase;
+    phase.strName = strName;
+    phase.nTimeMicros = nTimeMicros;
+    phase.nCount = 1;
+    vStartupPhases.push_back(phase);
+}
+
+std::vector<CStartupPhase> GetStartupProfile()
+{
+    LOCK(cs_startupProfile);
+    return vStartupPhases;
+}
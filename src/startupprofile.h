@@ -0,0 +1,29 @@
+// Copyright (c) 2018-2020 The DAPS Project developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef PRCYCOIN_STARTUPPROFILE_H
+#define PRCYCOIN_STARTUPPROFILE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** Time spent in one phase of node startup */
+struct CStartupPhase {
+    std::string strName;
+    //! Summed over all runs of the phase, e.g. when the block index is loaded again after a reindex prompt
+    int64_t nTimeMicros;
+    int nCount;
+};
+
+/**
+ * Add nTimeMicros to the startup phase strName. Phases are kept in the order
+ * they are first recorded and reported by the getstartupprofile RPC.
+ */
+void RecordStartupPhase(const std::string& strName, int64_t nTimeMicros);
+
+/** All phases recorded so far */
+std::vector<CStartupPhase> GetStartupProfile();
+
+#endif // PRCYCOIN_STARTUPPROFILE_H
@@ -0,0 +1,74 @@
+// Copyright (c) 2018-2020 The DAPS Project developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilereader.h"
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "main.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockfilereader_tests)
+
+BOOST_AUTO_TEST_CASE(blockfilereader_blocks)
+{
+    // More files than descriptors are cached, read twice so evicted files get opened again
+    const int nFirstFile = 100;
+    const int nFiles = MAX_OPEN_BLOCK_FILES + 4;
+    CBlock genesis = Params().GenesisBlock();
+    std::vector<CDiskBlockPos> vPos;
+    for (int nFile = nFirstFile; nFile < nFirstFile + nFiles; nFile++) {
+        CDiskBlockPos pos(nFile, 0);
+        BOOST_CHECK(WriteBlockToDisk(genesis, pos));
+        vPos.push_back(pos);
+        const unsigned int nBlockSize = ::GetSerializeSize(genesis, SER_DISK, CLIENT_VERSION);
+        CDiskBlockPos posNext(nFile, pos.nPos + nBlockSize);
+        BOOST_CHECK(WriteBlockToDisk(genesis, posNext));
+        vPos.push_back(posNext);
+    }
+
+    for (int nPass = 0; nPass < 2; nPass++) {
+        for (const CDiskBlockPos& pos : vPos) {
+            CBlock block;
+            BOOST_CHECK(ReadBlockFromDisk(block, pos));
+            BOOST_CHECK(block.GetHash() == genesis.GetHash());
+            unsigned int nSize;
+            BOOST_CHECK(ReadDiskRecordSize(pos, "blk", nSize));
+            BOOST_CHECK_EQUAL(nSize, ::GetSerializeSize(genesis, SER_DISK, CLIENT_VERSION));
+        }
+    }
+
+    // Positions that are not the start of a record, or past the end of the file, are refused
+    CBlock block;
+    BOOST_CHECK(!ReadBlockFromDisk(block, CDiskBlockPos(nFirstFile, vPos[0].nPos + 1)));
+    BOOST_CHECK(!ReadBlockFromDisk(block, CDiskBlockPos(nFirstFile, vPos[1].nPos + 4096)));
+    BOOST_CHECK(!ReadBlockFromDisk(block, CDiskBlockPos(nFirstFile + nFiles, 8)));
+    CloseBlockFileReaders();
+}
+
+BOOST_AUTO_TEST_CASE(blockfilereader_undo)
+{
+    CBlockUndo blockundo;
+    blockundo.vtxundo.resize(3);
+    for (size_t i = 0; i < blockundo.vtxundo.size(); i++) {
+        CTxOut txout(i * COIN, CScript() << OP_TRUE);
+        blockundo.vtxundo[i].vprevout.push_back(CTxInUndo(txout, false, false, i + 1, 1));
+    }
+    const uint256 hashBlock = Params().GenesisBlock().GetHash();
+    CDiskBlockPos pos(100, 0);
+    BOOST_CHECK(blockundo.WriteToDisk(pos, hashBlock));
+
+    CBlockUndo blockundoRead;
+    BOOST_CHECK(blockundoRead.ReadFromDisk(pos, hashBlock));
+    BOOST_CHECK_EQUAL(blockundoRead.vtxundo.size(), blockundo.vtxundo.size());
+    for (size_t i = 0; i < blockundo.vtxundo.size(); i++)
+        BOOST_CHECK(blockundoRead.vtxundo[i].vprevout[0].txout == blockundo.vtxundo[i].vprevout[0].txout);
+
+    // The checksum commits to the block hash
+    BOOST_CHECK(!blockundoRead.ReadFromDisk(pos, uint256()));
+    CloseBlockFileReaders();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,67 @@
+// Copyright (c) 2018-2020 The DAPS Project developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "main.h"
+#include "random.h"
+#include "wallet/wallet.h"
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+static CTransaction RandomTransaction(size_t nOutputs)
+{
+    CTransaction tx;
+    for (size_t i = 0; i < nOutputs; i++) {
+        CTxOut out;
+        out.nValue = GetRand(1000000) * COIN;
+        out.maskValue.inMemoryRawBind.MakeNewKey(true);
+        BOOST_CHECK(CWallet::CreateCommitment(out.maskValue.inMemoryRawBind.begin(), out.nValue, out.commitment));
+        tx.vout.push_back(out);
+    }
+    return tx;
+}
+
+static void ProveTransactions(std::vector<CTransaction>* vtx, std::vector<int>* vProven, size_t nFirst, size_t nStep)
+{
+    for (size_t i = nFirst; i < vtx->size(); i += nStep)
+        (*vProven)[i] = CWallet::generateBulletProofAggregate((*vtx)[i]);
+}
+
+BOOST_AUTO_TEST_SUITE(bulletproof_tests)
+
+BOOST_AUTO_TEST_CASE(bulletproof_prove_verify)
+{
+    for (size_t nOutputs = 1; nOutputs <= 2; nOutputs++) {
+        CTransaction tx = RandomTransaction(nOutputs);
+        BOOST_CHECK(CWallet::generateBulletProofAggregate(tx));
+        BOOST_CHECK(VerifyBulletProof(tx));
+
+        tx.vout[0].nValue += 1;
+        tx.vout[0].commitment.clear();
+        BOOST_CHECK(CWallet::CreateCommitment(tx.vout[0].maskValue.inMemoryRawBind.begin(), tx.vout[0].nValue, tx.vout[0].commitment));
+        BOOST_CHECK(!VerifyBulletProof(tx));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(bulletproof_prove_concurrently)
+{
+    const size_t nThreads = 4;
+    std::vector<CTransaction> vtx;
+    for (size_t i = 0; i < 16; i++)
+        vtx.push_back(RandomTransaction(1 + i % 2));
+    std::vector<int> vProven(vtx.size(), 0);
+
+    boost::thread_group threadGroup;
+    for (size_t i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&ProveTransactions, &vtx, &vProven, i, nThreads));
+    threadGroup.join_all();
+
+    for (size_t i = 0; i < vtx.size(); i++) {
+        BOOST_CHECK(vProven[i]);
+        BOOST_CHECK(VerifyBulletProof(vtx[i]));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,98 @@
+// Copyright (c) 2018-2020 The DAPS Project developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/decoypool.h"
+
+#include "random.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(decoypool_tests)
+
+BOOST_AUTO_TEST_CASE(decoypool_add_remove)
+{
+    CDecoyPool pool(1000);
+    std::vector<COutPoint> vOutPoints;
+    for (int i = 0; i < 300; i++) {
+        COutPoint outpoint(GetRandHash(), i % 3);
+        BOOST_CHECK(pool.Add(outpoint, GetRandHash(), i * 37));
+        vOutPoints.push_back(outpoint);
+    }
+    BOOST_CHECK(!pool.Add(vOutPoints[0], uint256(), 0));
+    BOOST_CHECK_EQUAL(pool.Size(), 300U);
+
+    // Remove every other entry, the rest must stay reachable by outpoint and by position
+    for (size_t i = 0; i < vOutPoints.size(); i += 2)
+        BOOST_CHECK(pool.Remove(vOutPoints[i]));
+    BOOST_CHECK(!pool.Remove(vOutPoints[0]));
+    BOOST_CHECK_EQUAL(pool.Size(), 150U);
+    for (size_t i = 0; i < vOutPoints.size(); i++)
+        BOOST_CHECK_EQUAL(pool.Contains(vOutPoints[i]), i % 2 == 1);
+    std::set<COutPoint> setSeen;
+    for (size_t i = 0; i < pool.Size(); i++)
+        setSeen.insert(pool.At(i).outpoint);
+    BOOST_CHECK_EQUAL(setSeen.size(), 150U);
+
+    pool.Clear();
+    BOOST_CHECK_EQUAL(pool.Size(), 0U);
+    CDecoyPool::Entry entry;
+    BOOST_CHECK(!pool.GetRandom(0, 1000000, entry));
+}
+
+BOOST_AUTO_TEST_CASE(decoypool_evict)
+{
+    CDecoyPool pool(50);
+    for (int i = 0; i < 200; i++) {
+        COutPoint outpoint(GetRandHash(), 0);
+        BOOST_CHECK(pool.Add(outpoint, GetRandHash(), i));
+        BOOST_CHECK(pool.Contains(outpoint));
+        BOOST_CHECK(pool.Size() <= 50);
+    }
+    BOOST_CHECK_EQUAL(pool.Size(), 50U);
+}
+
+BOOST_AUTO_TEST_CASE(decoypool_height_range)
+{
+    CDecoyPool pool(10000);
+    for (int i = 0; i < 5000; i++)
+        pool.Add(COutPoint(GetRandHash(), 0), GetRandHash(), i);
+
+    CDecoyPool::Entry entry;
+    for (int i = 0; i < 100; i++) {
+        BOOST_CHECK(pool.GetRandom(1500, 2500, entry));
+        BOOST_CHECK(entry.nHeight >= 1500 && entry.nHeight <= 2500);
+        BOOST_CHECK(pool.GetRandom(0, 2, entry));
+        BOOST_CHECK(entry.nHeight <= 2);
+    }
+    BOOST_CHECK(pool.GetRandom(4999, 4999, entry));
+    BOOST_CHECK_EQUAL(entry.nHeight, 4999);
+    BOOST_CHECK(!pool.GetRandom(5000, 100000, entry));
+    BOOST_CHECK(!pool.GetRandom(10, 5, entry));
+}
+
+BOOST_AUTO_TEST_CASE(decoypool_age_distribution)
+{
+    CDecoyPool pool(100000);
+    for (int i = 0; i < 100000; i++)
+        pool.Add(COutPoint(GetRandHash(), 0), GetRandHash(), i);
+
+    // A uniform pick would land in the last 10000 blocks one time in ten
+    CDecoyPool::Entry entry;
+    int nRecent = 0;
+    for (int i = 0; i < 1000; i++) {
+        BOOST_CHECK(pool.GetRandomByAge(99999, 60, entry));
+        BOOST_CHECK(entry.nHeight <= 99999);
+        if (entry.nHeight >= 90000)
+            nRecent++;
+        BOOST_CHECK(pool.GetRandomByAge(50500, 60, entry));
+        BOOST_CHECK(entry.nHeight <= 50500);
+    }
+    BOOST_CHECK(nRecent > 500);
+
+    BOOST_CHECK(pool.GetRandomByAge(0, 60, entry));
+    BOOST_CHECK_EQUAL(entry.nHeight, 0);
+    BOOST_CHECK(!pool.GetRandomByAge(-1, 60, entry));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
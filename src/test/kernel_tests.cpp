@@ -0,0 +1,56 @@
+// Copyright (c) 2018-2020 The DAPS Project developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "hash.h"
+#include "kernel.h"
+#include "random.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(kernel_tests)
+
+BOOST_AUTO_TEST_CASE(sha256d_single_block)
+{
+    // an odd count exercises both the four-lane and the single-block paths
+    const size_t nBlocks = 11;
+    std::vector<unsigned char> vBlocks(64 * nBlocks, 0);
+    std::vector<uint256> vExpected;
+    for (size_t i = 0; i < nBlocks; i++) {
+        unsigned char* block = &vBlocks[64 * i];
+        const size_t nLen = (i * 7) % 56;
+        GetRandBytes(block, nLen);
+        block[nLen] = 0x80;
+        WriteBE64(block + 56, nLen * 8);
+        vExpected.push_back(Hash(block, block + nLen));
+    }
+
+    std::vector<unsigned char> vOut(32 * nBlocks);
+    SHA256DSingleBlock(&vOut[0], &vBlocks[0], nBlocks);
+    for (size_t i = 0; i < nBlocks; i++)
+        BOOST_CHECK(memcmp(&vOut[32 * i], vExpected[i].begin(), 32) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(stake_kernel_hash)
+{
+    const uint64_t nStakeModifier = GetRand(std::numeric_limits<uint64_t>::max());
+    const unsigned int nTimeBlockFrom = 1580000000;
+    const COutPoint prevout(GetRandHash(), 3);
+    CStakeKernel kernel(nStakeModifier, nTimeBlockFrom, prevout);
+
+    // the kernel is the double hash of the serialized modifier, block time, outpoint and timestamp
+    const unsigned int nTimeFirst = nTimeBlockFrom + 100000;
+    uint256 hashes[CStakeKernel::BATCH_SIZE];
+    kernel.GetHashes(nTimeFirst, CStakeKernel::BATCH_SIZE, hashes);
+    for (unsigned int i = 0; i < CStakeKernel::BATCH_SIZE; i++) {
+        CDataStream ss(SER_GETHASH, 0);
+        ss << nStakeModifier << nTimeBlockFrom << prevout.n << prevout.hash << (unsigned int)(nTimeFirst - i);
+        const uint256 expected = Hash(ss.begin(), ss.end());
+        BOOST_CHECK(hashes[i] == expected);
+        BOOST_CHECK(kernel.GetHash(nTimeFirst - i) == expected);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
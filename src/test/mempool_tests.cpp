@@ -2,7 +2,9 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "key.h"
 #include "main.h"
+#include "random.h"
 #include "txmempool.h"
 #include "util.h"
 
@@ -101,4 +103,72 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
 }
 
 BOOST_AUTO_TEST_SUITE_END()
-#endif
\ No newline at end of file
+#endif
+
+BOOST_AUTO_TEST_SUITE(mempool_keyimage_tests)
+
+BOOST_AUTO_TEST_CASE(MempoolKeyImageConflictTest)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CKeyImage keyImage = key.GetPubKey();
+
+    // Two transactions spending the same key image through different decoys
+    CMutableTransaction txSpend;
+    txSpend.vin.resize(1);
+    txSpend.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txSpend.vin[0].keyImage = keyImage;
+    txSpend.vout.resize(1);
+    CMutableTransaction txDoubleSpend = txSpend;
+    txDoubleSpend.vin[0].prevout = COutPoint(GetRandHash(), 1);
+    BOOST_CHECK(txSpend.GetHash() != txDoubleSpend.GetHash());
+
+    CTxMemPool testPool(CFeeRate(0));
+    std::list<CTransaction> removed;
+
+    testPool.addUnchecked(txSpend.GetHash(), CTxMemPoolEntry(txSpend, 0, 0, 0.0, 1));
+    BOOST_CHECK(testPool.existsKeyImage(keyImage));
+
+    // A block containing the double spend evicts the pool transaction
+    std::vector<CTransaction> vtx;
+    vtx.push_back(txDoubleSpend);
+    testPool.removeForBlock(vtx, 1, removed);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    BOOST_CHECK(removed.front().GetHash() == txSpend.GetHash());
+    BOOST_CHECK_EQUAL(testPool.size(), 0);
+    BOOST_CHECK(!testPool.existsKeyImage(keyImage));
+    removed.clear();
+
+    // Removing a transaction releases its key images
+    testPool.addUnchecked(txSpend.GetHash(), CTxMemPoolEntry(txSpend, 0, 0, 0.0, 1));
+    testPool.remove(txSpend, removed, false);
+    BOOST_CHECK(!testPool.existsKeyImage(keyImage));
+}
+
+BOOST_AUTO_TEST_CASE(DuplicateKeyImageTest)
+{
+    CKey key;
+    key.MakeNewKey(true);
+
+    // A transaction spending the same key image twice never reaches the pool
+    CMutableTransaction tx;
+    tx.vin.resize(2);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vin[0].keyImage = key.GetPubKey();
+    tx.vin[1].prevout = COutPoint(GetRandHash(), 1);
+    tx.vin[1].keyImage = key.GetPubKey();
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1;
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+
+    CValidationState state;
+    BOOST_CHECK(!CheckTransaction(tx, false, false, state));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-txns-inputs-duplicate");
+
+    key.MakeNewKey(true);
+    tx.vin[1].keyImage = key.GetPubKey();
+    CValidationState stateValid;
+    BOOST_CHECK(CheckTransaction(tx, false, false, stateValid));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
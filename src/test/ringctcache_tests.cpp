@@ -0,0 +1,140 @@
+// Copyright (c) 2018-2020 The DAPS Project developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "ringctcache.h"
+
+#include "key.h"
+#include "main.h"
+#include "random.h"
+
+#include <boost/test/unit_test.hpp>
+
+static CRingSignatureMatrix RandomMatrix()
+{
+    CRingSignatureMatrix matrix;
+    matrix.txid = GetRandHash();
+    matrix.hashSig = GetRandHash();
+    matrix.nRows = 2;
+    matrix.nCols = 2;
+    for (size_t i = 0; i < matrix.nRows * matrix.nCols; i++) {
+        CKey key;
+        key.MakeNewKey(true);
+        matrix.vPubKeys.push_back(key.GetPubKey());
+    }
+    CKey image;
+    image.MakeNewKey(true);
+    matrix.vKeyImages.push_back(image.GetPubKey());
+    return matrix;
+}
+
+static std::vector<unsigned char> Commit(const CKey& blind, CAmount nValue)
+{
+    secp256k1_pedersen_commitment commitment;
+    BOOST_CHECK(secp256k1_pedersen_commit(GetContext(), &commitment, blind.begin(), nValue, &secp256k1_generator_const_h, &secp256k1_generator_const_g));
+    std::vector<unsigned char> vch(33);
+    BOOST_CHECK(secp256k1_pedersen_commitment_serialize(GetContext(), &vch[0], &commitment));
+    return vch;
+}
+
+static CTransaction ProvenTransaction(size_t nOutputs)
+{
+    CTransaction tx;
+    std::vector<CKey> vBlinds(nOutputs);
+    std::vector<const unsigned char*> vBlindPtrs;
+    std::vector<uint64_t> vValues;
+    for (size_t i = 0; i < nOutputs; i++) {
+        vBlinds[i].MakeNewKey(true);
+        vBlindPtrs.push_back(vBlinds[i].begin());
+        vValues.push_back(GetRand(1000000) * COIN);
+        CTxOut out;
+        out.nValue = vValues[i];
+        out.commitment = Commit(vBlinds[i], vValues[i]);
+        tx.vout.push_back(out);
+    }
+    unsigned char nonce[32];
+    GetRandBytes(nonce, 32);
+    unsigned char proof[2000];
+    size_t len = sizeof(proof);
+    BOOST_CHECK(secp256k1_bulletproof_rangeproof_prove(GetContext(), GetProveScratch(nOutputs), GetGenerator(), proof, &len, &vValues[0], NULL, &vBlindPtrs[0], nOutputs, &secp256k1_generator_const_h, 64, nonce, NULL, 0));
+    tx.bulletproofs.assign(proof, proof + len);
+    return tx;
+}
+
+BOOST_AUTO_TEST_SUITE(ringctcache_tests)
+
+BOOST_AUTO_TEST_CASE(ringctcache_ring_signature)
+{
+    CRingSignatureMatrix matrix = RandomMatrix();
+    CRingCTCacheStats before = GetRingCTCacheStats();
+    BOOST_CHECK(!IsRingSignatureCached(matrix));
+    CacheRingSignature(matrix);
+    BOOST_CHECK(IsRingSignatureCached(matrix));
+
+    CRingCTCacheStats after = GetRingCTCacheStats();
+    BOOST_CHECK_EQUAL(after.nHits, before.nHits + 1);
+    BOOST_CHECK_EQUAL(after.nMisses, before.nMisses + 1);
+    BOOST_CHECK_EQUAL(after.nSize, before.nSize + 1);
+
+    // The same signature checked against a different ring is a new entry
+    CRingSignatureMatrix other = matrix;
+    CKey decoy;
+    decoy.MakeNewKey(true);
+    other.vPubKeys[1] = decoy.GetPubKey();
+    BOOST_CHECK(!IsRingSignatureCached(other));
+
+    other = matrix;
+    other.hashSig = GetRandHash();
+    BOOST_CHECK(!IsRingSignatureCached(other));
+}
+
+BOOST_AUTO_TEST_CASE(ringctcache_bulletproof)
+{
+    CMutableTransaction mtx;
+    mtx.nLockTime = 1;
+    CTransaction tx(mtx);
+    mtx.nLockTime = 2;
+    CTransaction other(mtx);
+
+    BOOST_CHECK(!IsBulletproofCached(tx));
+    CacheBulletproof(tx);
+    BOOST_CHECK(IsBulletproofCached(tx));
+    BOOST_CHECK(!IsBulletproofCached(other));
+}
+
+BOOST_AUTO_TEST_CASE(ringctcache_bounded)
+{
+    mapArgs["-maxringctcachesize"] = "10";
+    for (int i = 0; i < 50; i++)
+        CacheRingSignature(RandomMatrix());
+    BOOST_CHECK(GetRingCTCacheStats().nSize <= 10);
+    mapArgs.erase("-maxringctcachesize");
+}
+
+BOOST_AUTO_TEST_CASE(bulletproof_verify_batch)
+{
+    // More than one full batch of two output proofs, and a few single output ones
+    std::vector<CTransaction> vtx;
+    for (size_t i = 0; i < MAX_BULLETPROOF_BATCH + 6; i++)
+        vtx.push_back(ProvenTransaction(2));
+    for (size_t i = 0; i < 4; i++)
+        vtx.push_back(ProvenTransaction(1));
+    std::vector<const CTransaction*> vptx;
+    for (const CTransaction& tx : vtx)
+        vptx.push_back(&tx);
+    size_t nFailed = vtx.size();
+    BOOST_CHECK(VerifyBulletProofBatch(vptx, &nFailed));
+
+    // Only the transaction whose proof does not match its commitments is reported
+    const size_t nInvalid = 40;
+    CKey blind;
+    blind.MakeNewKey(true);
+    vtx[nInvalid].vout[0].commitment = Commit(blind, vtx[nInvalid].vout[0].nValue);
+    BOOST_CHECK(!VerifyBulletProofBatch(vptx, &nFailed));
+    BOOST_CHECK_EQUAL(nFailed, nInvalid);
+
+    vptx.erase(vptx.begin() + nInvalid);
+    BOOST_CHECK(VerifyBulletProofBatch(vptx));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
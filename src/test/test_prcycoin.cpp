@@ -53,6 +53,7 @@ struct TestingSetup {
         mapMultiArgs["-debug"] = categories;
 
         pblocktree = new CBlockTreeDB(1 << 20, true);
+        pkeyimages = new CKeyImageView(*pblocktree, 1 << 20);
         pcoinsdbview = new CCoinsViewDB(1 << 23, true);
         pcoinsTip = new CCoinsViewCache(pcoinsdbview);
         InitBlockIndex();
@@ -120,6 +121,7 @@ struct TestingSetup {
 #endif
         delete pcoinsTip;
         delete pcoinsdbview;
+        delete pkeyimages;
         delete pblocktree;
 #ifdef ENABLE_WALLET
         bitdb.Flush(true);
@@ -0,0 +1,120 @@
+// Copyright (c) 2018-2020 The DAPS Project developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txdb.h"
+
+#include "key.h"
+#include "main.h"
+#include "random.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(txdb_tests)
+
+BOOST_AUTO_TEST_CASE(load_block_index_guts)
+{
+    // Enough entries for every thread to get a share of the key range
+    const int nBlocks = 500;
+    const int nFirstHeight = 10000000; // past the PoW blocks, whose hashes would be checked
+    CBlockTreeDB blocktree(1 << 20, true);
+
+    std::vector<uint256> vHashes;
+    vHashes.reserve(nBlocks + 1);
+    std::vector<CBlockIndex> vIndex(nBlocks);
+    std::vector<uint256> vMerkleRoots;
+    for (int i = 0; i < nBlocks; i++) {
+        CBlockIndex& index = vIndex[i];
+        index.pprev = i ? &vIndex[i - 1] : NULL;
+        index.nHeight = nFirstHeight + i;
+        index.nVersion = 5;
+        index.hashMerkleRoot = GetRandHash();
+        index.nTime = 1580000000 + i;
+        index.nStatus = BLOCK_VALID_TREE;
+        if (i == 0) {
+            // A predecessor that is not in the database
+            vHashes.push_back(GetRandHash());
+            index.pprev = NULL;
+        }
+        vMerkleRoots.push_back(index.hashMerkleRoot);
+        CDiskBlockIndex diskindex(&index);
+        if (i == 0)
+            diskindex.hashPrev = vHashes[0];
+        vHashes.push_back(diskindex.GetBlockHash());
+        index.phashBlock = &vHashes.back();
+        BOOST_CHECK(blocktree.WriteBlockIndex(diskindex));
+    }
+
+    // Load into an empty map, and put the global one back before a failed check can end the test
+    BlockMap mapSaved, mapLoaded;
+    mapSaved.swap(mapBlockIndex);
+    BOOST_CHECK(blocktree.LoadBlockIndexGuts());
+    mapLoaded.swap(mapBlockIndex);
+    mapBlockIndex.swap(mapSaved);
+
+    // The missing predecessor gets an empty entry
+    BOOST_CHECK_EQUAL(mapLoaded.size(), (size_t)nBlocks + 1);
+    BOOST_CHECK(mapLoaded.count(vHashes[0]));
+    for (int i = 0; i < nBlocks; i++) {
+        BlockMap::iterator mi = mapLoaded.find(vHashes[i + 1]);
+        BOOST_REQUIRE(mi != mapLoaded.end());
+        const CBlockIndex* pindex = mi->second;
+        BOOST_CHECK(pindex->GetBlockHash() == vHashes[i + 1]);
+        BOOST_CHECK_EQUAL(pindex->nHeight, nFirstHeight + i);
+        BOOST_CHECK(pindex->hashMerkleRoot == vMerkleRoots[i]);
+        BOOST_REQUIRE(pindex->pprev);
+        BOOST_CHECK(pindex->pprev->GetBlockHash() == vHashes[i]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(upgrade_key_image_index)
+{
+    CBlockTreeDB blocktree(1 << 20, true);
+    const uint256 hashBlock = chainActive.Genesis()->GetBlockHash();
+    const uint256 hashOtherBlock = GetRandHash();
+
+    // Older versions wrote the key image with CPubKey::GetHex, and a numeric
+    // suffix for every further spend
+    std::vector<CKeyImage> vKeyImages;
+    for (int i = 0; i < 4; i++) {
+        CKey key;
+        key.MakeNewKey(i % 2 == 0);
+        vKeyImages.push_back(key.GetPubKey());
+        BOOST_CHECK(blocktree.Write(std::make_pair('k', vKeyImages.back().GetHex()), hashBlock));
+    }
+    BOOST_CHECK(blocktree.Write(std::make_pair('k', vKeyImages[0].GetHex() + "1"), hashOtherBlock));
+    // Records that are not key images are kept
+    const std::string strBadKey = "0102";
+    BOOST_CHECK(blocktree.Write(std::make_pair('k', strBadKey), hashBlock));
+
+    BOOST_CHECK(blocktree.UpgradeKeyImageIndex());
+
+    uint256 hashRead;
+    for (const CKeyImage& keyImage : vKeyImages) {
+        std::vector<CKeyImageSpend> vSpends;
+        BOOST_CHECK(blocktree.ReadKeyImageSpends(keyImage, vSpends));
+        BOOST_REQUIRE(!vSpends.empty());
+        BOOST_CHECK(vSpends[0].hashBlock == hashBlock);
+        BOOST_CHECK_EQUAL(vSpends[0].nHeight, 0);
+        BOOST_CHECK(!blocktree.Read(std::make_pair('k', keyImage.GetHex()), hashRead));
+    }
+    std::vector<CKeyImageSpend> vSpends;
+    BOOST_CHECK(blocktree.ReadKeyImageSpends(vKeyImages[0], vSpends));
+    BOOST_CHECK_EQUAL(vSpends.size(), 2U);
+    BOOST_CHECK(!blocktree.Read(std::make_pair('k', vKeyImages[0].GetHex() + "1"), hashRead));
+    BOOST_CHECK(blocktree.Read(std::make_pair('k', strBadKey), hashRead));
+
+    // The spends are seen by the consensus checks
+    CKeyImageView keyimages(blocktree, 1 << 20);
+    BOOST_CHECK(keyimages.Load());
+    CKeyImageView* pkeyimagesSaved = pkeyimages;
+    pkeyimages = &keyimages;
+    for (const CKeyImage& keyImage : vKeyImages)
+        BOOST_CHECK(IsKeyImageSpend1(keyImage, uint256()));
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_CHECK(!IsKeyImageSpend1(key.GetPubKey(), uint256()));
+    pkeyimages = pkeyimagesSaved;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -7,10 +7,15 @@
 
 #include "txdb.h"
 
+#include "init.h"
 #include "main.h"
 #include "poa.h"
+#include "random.h"
+#include "script/standard.h"
 #include "uint256.h"
 
+#include <algorithm>
+#include <limits>
 #include <stdint.h>
 
 #include <boost/thread.hpp>
@@ -188,35 +193,176 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
 }
 
 
-bool CBlockTreeDB::ReadKeyImage(const string& keyImage, uint256& bh)
+CRingMemberOutput::CRingMemberOutput() : nHeight(-1), nFlags(0)
 {
-    return Read(std::make_pair('k', keyImage), bh);
+    memset(vchPubKey, 0, sizeof(vchPubKey));
+    memset(vchCommitment, 0, sizeof(vchCommitment));
 }
 
-bool CBlockTreeDB::ReadKeyImages(const string& keyImage, std::vector<uint256>& bhs)
+CRingMemberOutput::CRingMemberOutput(const CTransaction& tx, unsigned int n, const uint256& hashBlockIn, int nHeightIn) : CRingMemberOutput()
 {
-    uint256 bh;
-    if (!Read(std::make_pair('k', keyImage), bh)) return false;
-    bhs.push_back(bh);
-    int i = 1;
-    while(ReadKeyImage(keyImage + std::to_string(i), bh)) {
-        bhs.push_back(bh);
-        i++;
+    hashBlock = hashBlockIn;
+    nHeight = nHeightIn;
+    if (tx.IsCoinBase() || tx.IsCoinStake() || tx.IsCoinAudit())
+        nFlags |= COINBASE;
+    const CTxOut& out = tx.vout[n];
+    CPubKey pubkey;
+    if (ExtractPubKey(out.scriptPubKey, pubkey) && pubkey.size() >= 33) {
+        memcpy(vchPubKey, pubkey.begin(), 33);
+        nFlags |= HAS_PUBKEY;
     }
-    return true;
+    if (out.commitment.size() >= 33) {
+        memcpy(vchCommitment, &out.commitment[0], 33);
+        nFlags |= HAS_COMMITMENT;
+    }
+}
+
+bool CBlockTreeDB::ReadRingMemberOutput(const COutPoint& outpoint, CRingMemberOutput& output)
+{
+    return Read(make_pair('o', outpoint), output);
 }
 
-bool CBlockTreeDB::WriteKeyImage(const string& keyImage, const uint256& bh)
+bool CBlockTreeDB::WriteRingMemberOutputs(const std::vector<std::pair<COutPoint, CRingMemberOutput> >& vOutputs)
 {
-    uint256 blockHash;
-    if (!ReadKeyImage(keyImage, blockHash)) {
-        return Write(std::make_pair('k', keyImage), bh);
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<COutPoint, CRingMemberOutput> >::const_iterator it = vOutputs.begin(); it != vOutputs.end(); it++) {
+        batch.Write(make_pair('o', it->first), it->second);
     }
-    int i = 1;
-    while (ReadKeyImage(keyImage + std::to_string(i), blockHash)) {
-        i++;
+    return WriteBatch(batch);
+}
+
+/** Key image index entries are keyed by 'K' followed by the raw serialized key image */
+static std::pair<char, CFlatData> KeyImageKey(const CKeyImage& keyImage)
+{
+    return std::make_pair('K', CFlatData((void*)keyImage.begin(), (void*)keyImage.end()));
+}
+
+bool CBlockTreeDB::ReadKeyImageSpends(const CKeyImage& keyImage, std::vector<CKeyImageSpend>& vSpends)
+{
+    return Read(KeyImageKey(keyImage), vSpends);
+}
+
+void CBlockTreeDB::BatchWriteKeyImageSpends(CLevelDBBatch& batch, const std::vector<std::pair<CKeyImage, CKeyImageSpend> >& vSpends)
+{
+    std::map<CKeyImage, std::vector<CKeyImageSpend> > mapUpdates;
+    for (const std::pair<CKeyImage, CKeyImageSpend>& item : vSpends) {
+        std::map<CKeyImage, std::vector<CKeyImageSpend> >::iterator it = mapUpdates.find(item.first);
+        if (it == mapUpdates.end()) {
+            it = mapUpdates.insert(std::make_pair(item.first, std::vector<CKeyImageSpend>())).first;
+            ReadKeyImageSpends(item.first, it->second);
+        }
+        bool fKnown = false;
+        for (const CKeyImageSpend& spend : it->second)
+            fKnown |= spend.hashBlock == item.second.hashBlock;
+        if (!fKnown)
+            it->second.push_back(item.second);
     }
-    return Write(std::make_pair('k', keyImage + std::to_string(i)), bh);
+    for (const std::pair<const CKeyImage, std::vector<CKeyImageSpend> >& item : mapUpdates)
+        batch.Write(KeyImageKey(item.first), item.second);
+}
+
+bool CBlockTreeDB::WriteKeyImageIndex(const std::map<CKeyImage, std::vector<CKeyImageSpend> >& mapSpends)
+{
+    CLevelDBBatch batch;
+    for (const std::pair<const CKeyImage, std::vector<CKeyImageSpend> >& item : mapSpends)
+        batch.Write(KeyImageKey(item.first), item.second);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ForEachKeyImage(const std::function<void(const CKeyImage&)>& func)
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << 'K';
+    pcursor->Seek(ssKeySet.str());
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        leveldb::Slice slKey = pcursor->key();
+        if (slKey.size() < 2 || slKey[0] != 'K')
+            break;
+        func(CKeyImage((const unsigned char*)slKey.data() + 1, (const unsigned char*)slKey.data() + slKey.size()));
+        pcursor->Next();
+    }
+    return true;
+}
+
+bool CBlockTreeDB::UpgradeKeyImageIndex()
+{
+    // Older versions stored every spend under 'k' + hex key image, with a
+    // numeric suffix appended for each additional spending block.
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('k', std::string());
+    pcursor->Seek(ssKeySet.str());
+    if (!pcursor->Valid() || pcursor->key()[0] != 'k')
+        return true;
+
+    LogPrintf("Upgrading key image index...\n");
+    const size_t nBatchSize = 10000;
+    size_t nUpgraded = 0;
+    size_t nKept = 0;
+    std::vector<std::pair<CKeyImage, CKeyImageSpend> > vSpends;
+    std::vector<std::string> vOldKeys;
+    while (true) {
+        boost::this_thread::interruption_point();
+        bool fDone = !pcursor->Valid() || pcursor->key()[0] != 'k';
+        if (!fDone) {
+            try {
+                leveldb::Slice slKey = pcursor->key();
+                CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+                char chType;
+                std::string strKey;
+                ssKey >> chType >> strKey;
+                leveldb::Slice slValue = pcursor->value();
+                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+                uint256 hashBlock;
+                ssValue >> hashBlock;
+
+                // The hex was written by CPubKey::GetHex, last byte first, so the
+                // header byte that gives the length is at the end of the image
+                CKeyImage keyImage;
+                const size_t vHexSizes[] = {130, 66};
+                for (size_t nHexSize : vHexSizes) {
+                    if (strKey.size() < nHexSize)
+                        continue;
+                    std::vector<unsigned char> vch = ParseHex(strKey.substr(0, nHexSize));
+                    std::reverse(vch.begin(), vch.end());
+                    keyImage = CKeyImage(vch);
+                    if (vch.size() * 2 == nHexSize && keyImage.size() == vch.size())
+                        break;
+                    keyImage = CKeyImage();
+                }
+                if (keyImage.size() != 0) {
+                    BlockMap::const_iterator mi = mapBlockIndex.find(hashBlock);
+                    vSpends.push_back(std::make_pair(keyImage, CKeyImageSpend(hashBlock, mi == mapBlockIndex.end() ? -1 : mi->second->nHeight)));
+                    // Only erased together with the rewritten spend
+                    vOldKeys.push_back(strKey);
+                } else {
+                    LogPrintf("%s : keeping key image index entry %s, it is not a key image\n", __func__, strKey);
+                    nKept++;
+                }
+            } catch (const std::exception& e) {
+                LogPrintf("%s : keeping unreadable key image index entry - %s\n", __func__, e.what());
+                nKept++;
+            }
+            pcursor->Next();
+        }
+        if (vOldKeys.size() >= nBatchSize || (fDone && !vOldKeys.empty())) {
+            CLevelDBBatch batch;
+            BatchWriteKeyImageSpends(batch, vSpends);
+            for (const std::string& strKey : vOldKeys)
+                batch.Erase(std::make_pair('k', strKey));
+            if (!WriteBatch(batch))
+                return error("%s : failed to write key image index", __func__);
+            nUpgraded += vOldKeys.size();
+            vSpends.clear();
+            vOldKeys.clear();
+        }
+        if (fDone)
+            break;
+    }
+    LogPrintf("Upgraded %u key image index entries, kept %u that could not be read\n", nUpgraded, nKept);
+    return true;
 }
 
 bool CBlockTreeDB::WriteFlag(const std::string& name, bool fValue)
@@ -243,77 +389,272 @@ bool CBlockTreeDB::ReadInt(const std::string& name, int& nValue)
     return Read(std::make_pair('I', name), nValue);
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts()
+namespace {
+
+/** A decoded block index entry, linked into mapBlockIndex once all records are read */
+struct CLoadedBlockIndex {
+    CBlockIndex* pindex;
+    uint256 hash;
+    uint256 hashPrev;
+    uint256 hashNext;
+};
+
+/** The 'b' records of a range of first hash bytes, decoded by one thread */
+struct CBlockIndexRange {
+    unsigned int nBegin;
+    unsigned int nEnd;
+    CBlockIndexArena arena;
+    std::vector<CLoadedBlockIndex> vLoaded;
+    bool fOk;
+    std::string strError;
+};
+
+void LoadBlockIndexRange(CBlockTreeDB* pdb, CBlockIndexRange* range)
 {
-    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    range->fOk = false;
+    boost::scoped_ptr<leveldb::Iterator> pcursor(pdb->NewIterator());
+
+    // The key is 'b' followed by the serialized block hash
+    pcursor->Seek(std::string(1, 'b') + (char)range->nBegin);
+
+    // One buffer for all values of the range
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    try {
+        for (; pcursor->Valid(); pcursor->Next()) {
+            if (ShutdownRequested())
+                return;
+            leveldb::Slice slKey = pcursor->key();
+            if (slKey.size() < 2 || slKey[0] != 'b' || (unsigned char)slKey[1] >= range->nEnd)
+                break;
+
+            leveldb::Slice slValue = pcursor->value();
+            ssValue.clear();
+            ssValue.write(slValue.data(), slValue.size());
+            CDiskBlockIndex diskindex;
+            ssValue >> diskindex;
+
+            CLoadedBlockIndex loaded;
+            loaded.hash = diskindex.GetBlockHash();
+            loaded.hashPrev = diskindex.hashPrev;
+            loaded.hashNext = diskindex.hashNext;
+
+            // Construct block index object
+            CBlockIndex* pindexNew = range->arena.Allocate();
+            pindexNew->nHeight = diskindex.nHeight;
+            pindexNew->nFile = diskindex.nFile;
+            pindexNew->nDataPos = diskindex.nDataPos;
+            pindexNew->nUndoPos = diskindex.nUndoPos;
+            pindexNew->nVersion = diskindex.nVersion;
+            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+            pindexNew->nTime = diskindex.nTime;
+            pindexNew->nBits = diskindex.nBits;
+            pindexNew->nNonce = diskindex.nNonce;
+            pindexNew->nStatus = diskindex.nStatus;
+            pindexNew->nTx = diskindex.nTx;
+
+            //Proof of Audit
+            CBlockIndexExtra extra;
+            extra.hashPoAMerkleRoot = diskindex.hashPoAMerkleRoot;
+            extra.hashPrevPoABlock = diskindex.hashPrevPoABlock;
+            extra.minedHash = diskindex.minedHash;
+            pindexNew->SetExtra(extra);
+
+            //Proof Of Stake
+            pindexNew->nMint = diskindex.nMint;
+            pindexNew->nMoneySupply = diskindex.nMoneySupply;
+            pindexNew->nFlags = diskindex.nFlags;
+            pindexNew->nStakeModifier = diskindex.nStakeModifier;
+            pindexNew->prevoutStake = diskindex.prevoutStake;
+            pindexNew->nStakeTime = diskindex.nStakeTime;
+
+            if (pindexNew->nHeight <= Params().LAST_POW_BLOCK()) {
+                if (!CheckProofOfWork(loaded.hash, pindexNew->nBits)) {
+                    range->strError = strprintf("CheckProofOfWork failed: block %s at height %d", loaded.hash.ToString(), pindexNew->nHeight);
+                    return;
+                }
+            }
 
-    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
-    ssKeySet << make_pair('b', uint256(0));
-    pcursor->Seek(ssKeySet.str());
+            loaded.pindex = pindexNew;
+            range->vLoaded.push_back(loaded);
+        }
+    } catch (const std::exception& e) {
+        range->strError = strprintf("Deserialize or I/O error - %s", e.what());
+        return;
+    }
+    range->fOk = true;
+}
+
+} // anon namespace
+
+bool CBlockTreeDB::LoadBlockIndexGuts()
+{
+    const int64_t nTimeStart = GetTimeMicros();
+
+    // Block hashes are uniformly distributed, so splitting the records on the
+    // first byte of the hash gives each thread about the same share.
+    const int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), MAX_BLOCK_INDEX_LOAD_THREADS));
+    std::vector<CBlockIndexRange> vRanges(nThreads);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads; i++) {
+        vRanges[i].nBegin = 256 * i / nThreads;
+        vRanges[i].nEnd = 256 * (i + 1) / nThreads;
+        threadGroup.create_thread(boost::bind(&LoadBlockIndexRange, this, &vRanges[i]));
+    }
+    threadGroup.join_all();
+
+    size_t nLoaded = 0;
+    for (const CBlockIndexRange& range : vRanges) {
+        if (!range.fOk) {
+            if (ShutdownRequested())
+                return false;
+            return error("%s : %s", __func__, range.strError);
+        }
+        nLoaded += range.vLoaded.size();
+    }
+    const int64_t nTimeDecoded = GetTimeMicros();
 
     // Load mapBlockIndex
-    uint256 nPreviousCheckpoint;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        try {
-            leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
-            char chType;
-            ssKey >> chType;
-            if (chType == 'b') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
-                CDiskBlockIndex diskindex;
-                ssValue >> diskindex;
-
-                // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev = InsertBlockIndex(diskindex.hashPrev);
-                pindexNew->pnext = InsertBlockIndex(diskindex.hashNext);
-                pindexNew->nHeight = diskindex.nHeight;
-                pindexNew->nFile = diskindex.nFile;
-                pindexNew->nDataPos = diskindex.nDataPos;
-                pindexNew->nUndoPos = diskindex.nUndoPos;
-                pindexNew->nVersion = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->nTime = diskindex.nTime;
-                pindexNew->nBits = diskindex.nBits;
-                pindexNew->nNonce = diskindex.nNonce;
-                pindexNew->nStatus = diskindex.nStatus;
-                pindexNew->nTx = diskindex.nTx;
-
-                //Proof of Audit
-                pindexNew->hashPoAMerkleRoot = diskindex.hashPoAMerkleRoot;
-                pindexNew->hashPrevPoABlock = diskindex.hashPrevPoABlock;
-                pindexNew->minedHash = diskindex.minedHash;
-
-                //Proof Of Stake
-                pindexNew->nMint = diskindex.nMint;
-                pindexNew->nMoneySupply = diskindex.nMoneySupply;
-                pindexNew->nFlags = diskindex.nFlags;
-                pindexNew->nStakeModifier = diskindex.nStakeModifier;
-                pindexNew->prevoutStake = diskindex.prevoutStake;
-                pindexNew->nStakeTime = diskindex.nStakeTime;
-                pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
-
-                if (pindexNew->nHeight <= Params().LAST_POW_BLOCK()) {
-                    if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits))
-                        return error("LoadBlockIndex() : CheckProofOfWork failed: %s", pindexNew->ToString());
-                }
+    mapBlockIndex.reserve(mapBlockIndex.size() + nLoaded);
+    for (CBlockIndexRange& range : vRanges) {
+        for (CLoadedBlockIndex& loaded : range.vLoaded) {
+            std::pair<BlockMap::iterator, bool> ret = mapBlockIndex.insert(std::make_pair(loaded.hash, loaded.pindex));
+            if (!ret.second) {
+                // Only when entries were created before the load
+                *ret.first->second = *loaded.pindex;
+                loaded.pindex = ret.first->second;
+            }
+            loaded.pindex->phashBlock = &ret.first->first;
+        }
+        AdoptBlockIndexEntries(range.arena);
+    }
 
-                //populate accumulator checksum map in memory
-                if(pindexNew->nAccumulatorCheckpoint != 0 && pindexNew->nAccumulatorCheckpoint != nPreviousCheckpoint) {
-                    nPreviousCheckpoint = pindexNew->nAccumulatorCheckpoint;
-                }
+    // Link the entries once all of them are in, predecessors missing from the
+    // database get an empty entry as before
+    for (const CBlockIndexRange& range : vRanges) {
+        for (const CLoadedBlockIndex& loaded : range.vLoaded) {
+            loaded.pindex->pprev = InsertBlockIndex(loaded.hashPrev);
+            loaded.pindex->pnext = InsertBlockIndex(loaded.hashNext);
+        }
+    }
+
+    LogPrint("bench", "%s: %u entries, decoded in %.2fms by %d threads, linked in %.2fms\n", __func__, nLoaded,
+        (nTimeDecoded - nTimeStart) * 0.001, nThreads, (GetTimeMicros() - nTimeDecoded) * 0.001);
+
+    return true;
+}
+
+CKeyImageView::CKeyImageView(CBlockTreeDB& dbIn, size_t nCacheSize) : db(dbIn),
+                                                                     fFilterLoaded(false),
+                                                                     nFilterCapacity(0),
+                                                                     nFilterElements(0),
+                                                                     nMaxCacheEntries(std::max(nCacheSize / 200, (size_t)1))
+{
+}
+
+bool CKeyImageView::LoadFilter(unsigned int nMinCapacity)
+{
+    unsigned int nCount = 0;
+    if (!db.ForEachKeyImage([&nCount](const CKeyImage&) { nCount++; }))
+        return false;
+    nCount += mapDirty.size();
+
+    // Leave room for the filter to double before it has to be rebuilt
+    nFilterCapacity = std::max(std::max(nMinCapacity, 2 * nCount), (unsigned int)100000);
+    filter = CBloomFilter(nFilterCapacity, 0.001, GetRand(std::numeric_limits<unsigned int>::max()));
+    nFilterElements = 0;
+    std::function<void(const CKeyImage&)> insert = [this](const CKeyImage& keyImage) {
+        filter.insert(std::vector<unsigned char>(keyImage.begin(), keyImage.end()));
+        nFilterElements++;
+    };
+    if (!db.ForEachKeyImage(insert))
+        return false;
+    for (const std::pair<const CKeyImage, std::vector<CKeyImageSpend> >& item : mapDirty)
+        insert(item.first);
+    fFilterLoaded = true;
+    LogPrint("coindb", "%s: %u key images, capacity %u\n", __func__, nFilterElements, nFilterCapacity);
+    return true;
+}
+
+bool CKeyImageView::Load()
+{
+    LOCK(cs_keyimages);
+    return LoadFilter(0);
+}
+
+void CKeyImageView::CacheSpends(const CKeyImage& keyImage, const std::vector<CKeyImageSpend>& vSpends)
+{
+    std::map<CKeyImage, CCacheEntry>::iterator it = mapCache.find(keyImage);
+    if (it != mapCache.end()) {
+        it->second.vSpends = vSpends;
+        listLRU.splice(listLRU.begin(), listLRU, it->second.itLRU);
+        return;
+    }
+    while (mapCache.size() >= nMaxCacheEntries) {
+        mapCache.erase(listLRU.back());
+        listLRU.pop_back();
+    }
+    listLRU.push_front(keyImage);
+    CCacheEntry& entry = mapCache[keyImage];
+    entry.vSpends = vSpends;
+    entry.itLRU = listLRU.begin();
+}
 
-                pcursor->Next();
-            } else {
-                break; // if shutdown requested or finished loading block index
+bool CKeyImageView::GetSpends(const CKeyImage& keyImage, std::vector<CKeyImageSpend>& vSpends)
+{
+    LOCK(cs_keyimages);
+    std::map<CKeyImage, std::vector<CKeyImageSpend> >::const_iterator itDirty = mapDirty.find(keyImage);
+    if (itDirty != mapDirty.end()) {
+        vSpends = itDirty->second;
+        return true;
+    }
+    if (fFilterLoaded && !filter.contains(std::vector<unsigned char>(keyImage.begin(), keyImage.end())))
+        return false;
+    std::map<CKeyImage, CCacheEntry>::iterator it = mapCache.find(keyImage);
+    if (it != mapCache.end()) {
+        listLRU.splice(listLRU.begin(), listLRU, it->second.itLRU);
+        vSpends = it->second.vSpends;
+        return true;
+    }
+    if (!db.ReadKeyImageSpends(keyImage, vSpends))
+        return false;
+    CacheSpends(keyImage, vSpends);
+    return true;
+}
+
+void CKeyImageView::AddSpends(const std::vector<std::pair<CKeyImage, CKeyImageSpend> >& vSpends)
+{
+    LOCK(cs_keyimages);
+    for (const std::pair<CKeyImage, CKeyImageSpend>& item : vSpends) {
+        std::map<CKeyImage, std::vector<CKeyImageSpend> >::iterator it = mapDirty.find(item.first);
+        if (it == mapDirty.end()) {
+            std::vector<CKeyImageSpend> vExisting;
+            GetSpends(item.first, vExisting);
+            if (vExisting.empty()) {
+                filter.insert(std::vector<unsigned char>(item.first.begin(), item.first.end()));
+                nFilterElements++;
             }
-        } catch (const std::exception& e) {
-            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+            it = mapDirty.insert(std::make_pair(item.first, vExisting)).first;
         }
+        bool fKnown = false;
+        for (const CKeyImageSpend& spend : it->second)
+            fKnown |= spend.hashBlock == item.second.hashBlock;
+        if (!fKnown)
+            it->second.push_back(item.second);
     }
+}
 
+bool CKeyImageView::Flush()
+{
+    LOCK(cs_keyimages);
+    if (!mapDirty.empty()) {
+        if (!db.WriteKeyImageIndex(mapDirty))
+            return false;
+        for (const std::pair<const CKeyImage, std::vector<CKeyImageSpend> >& item : mapDirty)
+            CacheSpends(item.first, item.second);
+        mapDirty.clear();
+    }
+    // The false positive rate grows past the capacity, rebuild a larger filter
+    if (fFilterLoaded && nFilterElements > nFilterCapacity)
+        return LoadFilter(2 * nFilterElements);
     return true;
 }
@@ -8,9 +8,13 @@
 #ifndef BITCOIN_TXDB_H
 #define BITCOIN_TXDB_H
 
+#include "bloom.h"
 #include "leveldbwrapper.h"
 #include "main.h"
+#include "sync.h"
 
+#include <functional>
+#include <list>
 #include <map>
 #include <string>
 #include <utility>
@@ -25,6 +29,28 @@ static const int64_t nDefaultDbCache = 100;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 4096 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! -keyimagecache default (MiB)
+static const int64_t nDefaultKeyImageCache = 16;
+//! Maximum number of threads decoding the block index at startup
+static const int MAX_BLOCK_INDEX_LOAD_THREADS = 8;
+
+/** A block spending a key image, as recorded in the key image index */
+struct CKeyImageSpend {
+    uint256 hashBlock;
+    int nHeight;
+
+    CKeyImageSpend() : nHeight(-1) {}
+    CKeyImageSpend(const uint256& hashBlockIn, int nHeightIn) : hashBlock(hashBlockIn), nHeight(nHeightIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+    }
+};
 
 /** CCoinsView backed by the LevelDB coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
@@ -42,6 +68,44 @@ public:
     bool GetStats(CCoinsStats& stats) const;
 };
 
+/**
+ * The parts of a confirmed output needed to use it as a ring member, so that
+ * ring signatures can be checked without reading the whole transaction.
+ */
+struct CRingMemberOutput {
+    enum {
+        //! Output of a coinbase, coinstake or audit transaction, subject to maturity
+        COINBASE = (1 << 0),
+        HAS_PUBKEY = (1 << 1),
+        HAS_COMMITMENT = (1 << 2),
+    };
+
+    unsigned char vchPubKey[33];
+    unsigned char vchCommitment[33];
+    uint256 hashBlock;
+    int nHeight;
+    unsigned char nFlags;
+
+    CRingMemberOutput();
+    CRingMemberOutput(const CTransaction& tx, unsigned int n, const uint256& hashBlockIn, int nHeightIn);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(FLATDATA(vchPubKey));
+        READWRITE(FLATDATA(vchCommitment));
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+        READWRITE(nFlags);
+    }
+
+    bool IsCoinBase() const { return nFlags & COINBASE; }
+    bool HasPubKey() const { return nFlags & HAS_PUBKEY; }
+    bool HasCommitment() const { return nFlags & HAS_COMMITMENT; }
+};
+
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CLevelDBWrapper
 {
@@ -52,6 +116,8 @@ private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
 
+    void BatchWriteKeyImageSpends(CLevelDBBatch& batch, const std::vector<std::pair<CKeyImage, CKeyImageSpend> >& vSpends);
+
 public:
     bool WriteBlockIndex(const CDiskBlockIndex& blockindex);
     bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
@@ -67,9 +133,54 @@ public:
     bool ReadInt(const std::string& name, int& nValue);
     bool LoadBlockIndexGuts();
 
-    bool ReadKeyImage(const string& keyImage, uint256& bh);
-    bool ReadKeyImages(const string& keyImage, std::vector<uint256>& bhs);
+    bool ReadRingMemberOutput(const COutPoint& outpoint, CRingMemberOutput& output);
+    bool WriteRingMemberOutputs(const std::vector<std::pair<COutPoint, CRingMemberOutput> >& vOutputs);
+    bool ReadKeyImageSpends(const CKeyImage& keyImage, std::vector<CKeyImageSpend>& vSpends);
+    bool WriteKeyImageIndex(const std::map<CKeyImage, std::vector<CKeyImageSpend> >& mapSpends);
+    bool ForEachKeyImage(const std::function<void(const CKeyImage&)>& func);
+    bool UpgradeKeyImageIndex();
+};
+
+/**
+ * Cache of the key image index in front of the block tree database. A bloom
+ * filter over every indexed key image answers most lookups for unspent images
+ * without touching disk, recently read spends are kept in an LRU, and new
+ * spends are buffered until the next FlushStateToDisk.
+ */
+class CKeyImageView
+{
+private:
+    typedef std::list<CKeyImage> KeyImageList;
+    struct CCacheEntry {
+        std::vector<CKeyImageSpend> vSpends;
+        KeyImageList::iterator itLRU;
+    };
+
+    CBlockTreeDB& db;
+    RecursiveMutex cs_keyimages;
+
+    //! Contains every key image in db or mapDirty once loaded, so a miss means unspent
+    CBloomFilter filter;
+    bool fFilterLoaded;
+    unsigned int nFilterCapacity;
+    unsigned int nFilterElements;
+
+    size_t nMaxCacheEntries;
+    KeyImageList listLRU;
+    std::map<CKeyImage, CCacheEntry> mapCache;
+    std::map<CKeyImage, std::vector<CKeyImageSpend> > mapDirty;
+
+    bool LoadFilter(unsigned int nMinCapacity);
+    void CacheSpends(const CKeyImage& keyImage, const std::vector<CKeyImageSpend>& vSpends);
+
+public:
+    CKeyImageView(CBlockTreeDB& dbIn, size_t nCacheSize);
 
-    bool WriteKeyImage(const string& keyImage, const uint256& height);
+    //! Build the bloom filter from the index, which must be in its current format
+    bool Load();
+    bool GetSpends(const CKeyImage& keyImage, std::vector<CKeyImageSpend>& vSpends);
+    void AddSpends(const std::vector<std::pair<CKeyImage, CKeyImageSpend> >& vSpends);
+    //! Write the buffered spends to the block tree database
+    bool Flush();
 };
 #endif // BITCOIN_TXDB_H
@@ -414,6 +414,10 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry)
                 for (unsigned int i = 0; i < tx.vin.size(); i++)
                     mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
             }
+            for (const CTxIn& txin : tx.vin) {
+                if (txin.keyImage.IsValid())
+                    mapKeyImages[txin.keyImage] = &tx;
+            }
         }
         nTransactionsUpdated++;
         totalTxSize += entry.GetTxSize();
@@ -455,8 +459,12 @@ void CTxMemPool::remove(const CTransaction& origTx, std::list<CTransaction>& rem
                     txToRemove.push_back(it->second.ptx->GetHash());
                 }
             }
-            for (const CTxIn& txin : tx.vin)
+            for (const CTxIn& txin : tx.vin) {
                 mapNextTx.erase(txin.prevout);
+                std::map<CKeyImage, const CTransaction*>::iterator it = mapKeyImages.find(txin.keyImage);
+                if (it != mapKeyImages.end() && it->second == &tx)
+                    mapKeyImages.erase(it);
+            }
 
             removed.push_back(tx);
             totalTxSize -= mapTx[hash].GetTxSize();
@@ -493,7 +501,7 @@ void CTxMemPool::removeCoinbaseSpends(const CCoinsViewCache* pcoins, unsigned in
 
 void CTxMemPool::removeConflicts(const CTransaction& tx, std::list<CTransaction>& removed)
 {
-    // Remove transactions which depend on inputs of tx, recursively
+    // Remove transactions which depend on inputs of tx, or spend the same key images, recursively
     list<CTransaction> result;
     LOCK(cs);
     for (const CTxIn& txin : tx.vin) {
@@ -504,6 +512,13 @@ void CTxMemPool::removeConflicts(const CTransaction& tx, std::list<CTransaction>
                 remove(txConflict, removed, true);
             }
         }
+        std::map<CKeyImage, const CTransaction*>::iterator itKeyImage = mapKeyImages.find(txin.keyImage);
+        if (itKeyImage != mapKeyImages.end()) {
+            const CTransaction txConflict = *itKeyImage->second;
+            if (txConflict != tx) {
+                remove(txConflict, removed, true);
+            }
+        }
     }
 }
 
@@ -534,6 +549,7 @@ void CTxMemPool::clear()
     LOCK(cs);
     mapTx.clear();
     mapNextTx.clear();
+    mapKeyImages.clear();
     totalTxSize = 0;
     ++nTransactionsUpdated;
 }
@@ -608,6 +624,19 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
         assert(tx.vin.size() > it->second.n);
         assert(it->first == it->second.ptx->vin[it->second.n].prevout);
     }
+    unsigned int nKeyImages = 0;
+    for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+        const CTransaction& tx = it->second.GetTx();
+        for (const CTxIn& txin : tx.vin) {
+            if (!txin.keyImage.IsValid())
+                continue;
+            std::map<CKeyImage, const CTransaction*>::const_iterator it2 = mapKeyImages.find(txin.keyImage);
+            assert(it2 != mapKeyImages.end());
+            assert(it2->second == &tx);
+            nKeyImages++;
+        }
+    }
+    assert(nKeyImages == mapKeyImages.size());
 
     assert(totalTxSize == checkTotal);
 }
@@ -135,6 +135,8 @@ public:
     mutable RecursiveMutex cs;
     std::map<uint256, CTxMemPoolEntry> mapTx;
     std::map<COutPoint, CInPoint> mapNextTx;
+    //! Key images spent by transactions in the pool; prevouts are decoys under RingCT
+    std::map<CKeyImage, const CTransaction*> mapKeyImages;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
     CTxMemPool(const CFeeRate& _minRelayFee);
@@ -142,8 +144,9 @@ public:
 
     /**
      * If sanity-checking is turned on, check makes sure the pool is
-     * consistent (does not contain two transactions that spend the same inputs,
-     * all inputs are in the mapNextTx array). If sanity-checking is turned off,
+     * consistent (does not contain two transactions that spend the same inputs
+     * or key images, all inputs are in the mapNextTx array and all key images in
+     * mapKeyImages). If sanity-checking is turned off,
      * check does nothing.
      */
     void check(const CCoinsViewCache* pcoins) const;
@@ -184,6 +187,12 @@ public:
 
     bool lookup(uint256 hash, CTransaction& result) const;
 
+    bool existsKeyImage(const CKeyImage& keyImage)
+    {
+        LOCK(cs);
+        return (mapKeyImages.count(keyImage) != 0);
+    }
+
     /** Estimate fee rate needed to get into the next nBlocks */
     CFeeRate estimateFee(int nBlocks) const;
 
@@ -0,0 +1,180 @@
+// Copyright (c) 2018-2020 The DAPS Project developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/decoypool.h"
+
+#include "random.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+/** Number of random picks GetRandom makes before it lists the matching entries of the edge buckets */
+static const int MAX_RANDOM_PICKS = 64;
+
+/** Gamma distribution of the log of the age in seconds of spent outputs, as measured on Monero */
+static const double DECOY_AGE_GAMMA_SHAPE = 19.28;
+static const double DECOY_AGE_GAMMA_SCALE = 1 / 1.61;
+
+/** Uniform random bit generator over GetRand, for the <random> distributions */
+struct CDecoyRandomGenerator {
+    typedef uint32_t result_type;
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return 0xffffffff; }
+    result_type operator()() { return GetRand(0x100000000ULL); }
+};
+
+static int BucketOf(int nHeight)
+{
+    return std::max(nHeight, 0) / CDecoyPool::BUCKET_HEIGHT_SPAN;
+}
+
+bool CDecoyPool::Add(const COutPoint& outpoint, const uint256& hashBlock, int nHeight)
+{
+    LOCK(cs);
+    if (nMaxSize == 0 || mapIndex.count(outpoint))
+        return false;
+    if (vEntries.size() >= nMaxSize)
+        Erase(GetRand(vEntries.size()));
+
+    std::vector<size_t>& vBucket = mapBuckets[BucketOf(nHeight)];
+    Entry entry(outpoint, hashBlock, nHeight);
+    entry.nBucketPos = vBucket.size();
+    vBucket.push_back(vEntries.size());
+    mapIndex[outpoint] = vEntries.size();
+    vEntries.push_back(entry);
+    return true;
+}
+
+bool CDecoyPool::Remove(const COutPoint& outpoint)
+{
+    LOCK(cs);
+    boost::unordered_map<COutPoint, size_t, CDecoyOutPointHasher>::const_iterator it = mapIndex.find(outpoint);
+    if (it == mapIndex.end())
+        return false;
+    Erase(it->second);
+    return true;
+}
+
+void CDecoyPool::Erase(size_t nPos)
+{
+    // Take the entry out of its bucket, moving the last one of the bucket in its place
+    const int nBucket = BucketOf(vEntries[nPos].nHeight);
+    std::vector<size_t>& vBucket = mapBuckets[nBucket];
+    const size_t nBucketPos = vEntries[nPos].nBucketPos;
+    vBucket[nBucketPos] = vBucket.back();
+    vEntries[vBucket[nBucketPos]].nBucketPos = nBucketPos;
+    vBucket.pop_back();
+    if (vBucket.empty())
+        mapBuckets.erase(nBucket);
+
+    // Same for the entry vector, which moves the last entry to nPos
+    mapIndex.erase(vEntries[nPos].outpoint);
+    if (nPos != vEntries.size() - 1) {
+        Entry& moved = vEntries[nPos];
+        moved = vEntries.back();
+        mapIndex[moved.outpoint] = nPos;
+        mapBuckets[BucketOf(moved.nHeight)][moved.nBucketPos] = nPos;
+    }
+    vEntries.pop_back();
+}
+
+bool CDecoyPool::Contains(const COutPoint& outpoint) const
+{
+    LOCK(cs);
+    return mapIndex.count(outpoint) != 0;
+}
+
+size_t CDecoyPool::Size() const
+{
+    LOCK(cs);
+    return vEntries.size();
+}
+
+void CDecoyPool::Clear()
+{
+    LOCK(cs);
+    vEntries.clear();
+    mapIndex.clear();
+    mapBuckets.clear();
+}
+
+CDecoyPool::Entry CDecoyPool::At(size_t nPos) const
+{
+    LOCK(cs);
+    return vEntries[nPos];
+}
+
+bool CDecoyPool::GetRandom(int nMinHeight, int nMaxHeight, Entry& entry) const
+{
+    LOCK(cs);
+    if (vEntries.empty() || nMaxHeight < nMinHeight || nMaxHeight < 0)
+        return false;
+
+    typedef std::map<int, std::vector<size_t> >::const_iterator BucketIt;
+    const BucketIt first = mapBuckets.lower_bound(BucketOf(nMinHeight));
+    const BucketIt last = mapBuckets.upper_bound(BucketOf(nMaxHeight));
+    size_t nTotal = 0;
+    for (BucketIt it = first; it != last; ++it)
+        nTotal += it->second.size();
+    if (nTotal == 0)
+        return false;
+
+    // Only entries of the first and last bucket can be out of range
+    for (int nTry = 0; nTry < MAX_RANDOM_PICKS; nTry++) {
+        size_t nPick = GetRand(nTotal);
+        BucketIt it = first;
+        while (nPick >= it->second.size()) {
+            nPick -= it->second.size();
+            ++it;
+        }
+        const Entry& candidate = vEntries[it->second[nPick]];
+        if (candidate.nHeight >= nMinHeight && candidate.nHeight <= nMaxHeight) {
+            entry = candidate;
+            return true;
+        }
+    }
+
+    std::vector<size_t> vMatches;
+    for (BucketIt it = first; it != last; ++it) {
+        for (size_t nPos : it->second) {
+            if (vEntries[nPos].nHeight >= nMinHeight && vEntries[nPos].nHeight <= nMaxHeight)
+                vMatches.push_back(nPos);
+        }
+    }
+    if (vMatches.empty())
+        return false;
+    entry = vEntries[vMatches[GetRand(vMatches.size())]];
+    return true;
+}
+
+bool CDecoyPool::GetRandomByAge(int nMaxHeight, int64_t nBlockSpacing, Entry& entry) const
+{
+    LOCK(cs);
+    if (vEntries.empty() || nMaxHeight < 0 || nBlockSpacing <= 0)
+        return false;
+
+    CDecoyRandomGenerator rng;
+    std::gamma_distribution<double> logAge(DECOY_AGE_GAMMA_SHAPE, DECOY_AGE_GAMMA_SCALE);
+    typedef std::map<int, std::vector<size_t> >::const_iterator BucketIt;
+    for (int nTry = 0; nTry < MAX_RANDOM_PICKS; nTry++) {
+        // Ages older than the chain are drawn again
+        const double nAgeBlocks = std::exp(logAge(rng)) / nBlockSpacing;
+        if (nAgeBlocks > nMaxHeight)
+            continue;
+        const int nTargetHeight = nMaxHeight - (int)nAgeBlocks;
+
+        // An empty bucket hands its share to the closest older one
+        BucketIt it = mapBuckets.upper_bound(BucketOf(nTargetHeight));
+        if (it == mapBuckets.begin())
+            continue;
+        --it;
+        const Entry& candidate = vEntries[it->second[GetRand(it->second.size())]];
+        if (candidate.nHeight <= nMaxHeight) {
+            entry = candidate;
+            return true;
+        }
+    }
+    return GetRandom(0, nMaxHeight, entry);
+}
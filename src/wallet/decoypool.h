@@ -0,0 +1,78 @@
+// Copyright (c) 2018-2020 The DAPS Project developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef PRCYCOIN_DECOYPOOL_H
+#define PRCYCOIN_DECOYPOOL_H
+
+#include "primitives/transaction.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <map>
+#include <vector>
+
+#include <boost/unordered_map.hpp>
+
+struct CDecoyOutPointHasher {
+    size_t operator()(const COutPoint& outpoint) const
+    {
+        return outpoint.hash.GetLow64() ^ outpoint.n;
+    }
+};
+
+/**
+ * Outputs that ring signatures can take as decoys. Entries are kept in a vector
+ * for O(1) uniform selection, indexed by outpoint for lookups and removal, and
+ * listed per bucket of BUCKET_HEIGHT_SPAN blocks so a selection can be limited
+ * to an age range or follow the age distribution of real spends. A full pool
+ * evicts a random entry to make room.
+ */
+class CDecoyPool
+{
+public:
+    struct Entry {
+        COutPoint outpoint;
+        uint256 hashBlock;
+        int nHeight;
+        //! position of this entry in its height bucket
+        size_t nBucketPos;
+
+        Entry() : nHeight(0), nBucketPos(0) {}
+        Entry(const COutPoint& outpointIn, const uint256& hashBlockIn, int nHeightIn) : outpoint(outpointIn), hashBlock(hashBlockIn), nHeight(nHeightIn), nBucketPos(0) {}
+    };
+
+    static const int BUCKET_HEIGHT_SPAN = 1000;
+
+    //! Taken by the pool itself, hold it to get consistent results over several calls
+    mutable RecursiveMutex cs;
+
+    explicit CDecoyPool(size_t nMaxSizeIn) : nMaxSize(nMaxSizeIn) {}
+
+    //! Add an output found in the block hashBlock at nHeight, false if it is already in the pool
+    bool Add(const COutPoint& outpoint, const uint256& hashBlock, int nHeight);
+    bool Remove(const COutPoint& outpoint);
+    bool Contains(const COutPoint& outpoint) const;
+    size_t Size() const;
+    void Clear();
+
+    Entry At(size_t nPos) const;
+    //! Uniformly pick an entry whose height is within [nMinHeight, nMaxHeight]
+    bool GetRandom(int nMinHeight, int nMaxHeight, Entry& entry) const;
+    /**
+     * Pick an entry found at most at nMaxHeight, its age drawn from the spend age
+     * distribution (gamma over the log of the age in seconds) so recent outputs are
+     * favoured the way real spends are. Falls back to GetRandom(0, nMaxHeight).
+     */
+    bool GetRandomByAge(int nMaxHeight, int64_t nBlockSpacing, Entry& entry) const;
+
+private:
+    size_t nMaxSize;
+    std::vector<Entry> vEntries;
+    boost::unordered_map<COutPoint, size_t, CDecoyOutPointHasher> mapIndex;
+    std::map<int, std::vector<size_t> > mapBuckets;
+
+    void Erase(size_t nPos);
+};
+
+#endif // PRCYCOIN_DECOYPOOL_H
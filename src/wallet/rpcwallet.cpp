@@ -2685,6 +2685,7 @@ UniValue createprivacysubaddress(const UniValue& params, bool fHelp)
             account.viewAccount = viewAccount;
             account.spendAccount = spendAccount;
             walletdb.AppendStealthAccountList(label);
+            pwalletMain->InvalidateStealthScanKeys();
             break;
         }
     }
@@ -390,4 +390,102 @@ BOOST_AUTO_TEST_CASE(test_StealthSend)
     // check stealth sending on not enough balance wallet
     SelectParams(CBaseChainParams::MAIN);
 }
+
+/** A wallet that is crypted without a master key, so it stays locked */
+class CLockedWallet : public CWallet
+{
+public:
+    CLockedWallet() { SetCrypted(); }
+};
+
+BOOST_AUTO_TEST_CASE(balance_dirty_on_key_image_spend)
+{
+    CLockedWallet wallet;
+    BOOST_CHECK(wallet.IsLocked());
+
+    CMutableTransaction txPrev;
+    txPrev.vout.resize(1);
+    txPrev.vout[0].nValue = 1;
+    const uint256 hashPrev = txPrev.GetHash();
+    wallet.mapWallet[hashPrev] = CWalletTx(&wallet, txPrev);
+    CKey key;
+    key.MakeNewKey(true);
+    CWalletOutputInfo info;
+    info.keyImage = key.GetPubKey();
+    wallet.LoadOutputInfo(COutPoint(hashPrev, 0), info);
+
+    // Our output is a decoy of the ring, as any real input looks to the wallet
+    CMutableTransaction txSpend;
+    txSpend.vin.resize(1);
+    txSpend.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txSpend.vin[0].decoys.push_back(COutPoint(GetRandHash(), 1));
+    txSpend.vin[0].decoys.push_back(COutPoint(hashPrev, 0));
+    txSpend.vin[0].keyImage = info.keyImage;
+    txSpend.vout.resize(1);
+
+    // Connected and disconnected blocks
+    const CWalletTx& wtxPrev = wallet.mapWallet[hashPrev];
+    CBlock block;
+    wtxPrev.fAvailableCreditCached = true;
+    wallet.SyncTransaction(txSpend, &block);
+    BOOST_CHECK(!wtxPrev.fAvailableCreditCached);
+    wtxPrev.fAvailableCreditCached = true;
+    wallet.SyncTransaction(txSpend, NULL);
+    BOOST_CHECK(!wtxPrev.fAvailableCreditCached);
+
+    // Another key image leaves the transaction alone
+    key.MakeNewKey(true);
+    txSpend.vin[0].keyImage = key.GetPubKey();
+    wtxPrev.fAvailableCreditCached = true;
+    wallet.SyncTransaction(txSpend, &block);
+    BOOST_CHECK(wtxPrev.fAvailableCreditCached);
+}
+
+BOOST_AUTO_TEST_CASE(output_amount_stored_after_key_image)
+{
+    CWallet wallet;
+    CKey key;
+    key.MakeNewKey(true);
+    {
+        LOCK(wallet.cs_wallet);
+        BOOST_CHECK(wallet.AddKeyPubKey(key, key.GetPubKey()));
+    }
+
+    CMutableTransaction mtx;
+    mtx.vout.resize(1);
+    mtx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey());
+    CWalletTx wtx(&wallet, mtx);
+    const COutPoint outpoint(wtx.GetHash(), 0);
+
+    // The amount was revealed before; decoding it needs the view key of a full account
+    CKey blind;
+    blind.MakeNewKey(true);
+    wallet.amountMap[mtx.vout[0].scriptPubKey] = 5 * COIN;
+    wallet.blindMap[mtx.vout[0].scriptPubKey] = blind;
+
+    // An upgraded wallet knows the key image of the output but not its amount
+    CKey image;
+    image.MakeNewKey(true);
+    CWalletOutputInfo info;
+    info.keyImage = image.GetPubKey();
+    wallet.LoadOutputInfo(outpoint, info);
+    CAmount amount;
+    CKey blindStored;
+    BOOST_CHECK(!wallet.ReadOutputAmount(outpoint, amount, blindStored));
+
+    wallet.AddToWallet(wtx, true);
+    BOOST_CHECK(wallet.ReadOutputAmount(outpoint, amount, blindStored));
+    BOOST_CHECK_EQUAL(amount, 5 * COIN);
+    BOOST_CHECK(blindStored == blind);
+    BOOST_CHECK(wallet.outpointToKeyImages[outpoint] == info.keyImage);
+
+    // Outputs added while the wallet was locked are stored once it is unlocked
+    wallet.mapOutputInfo.erase(outpoint);
+    wallet.LoadOutputInfo(outpoint, info);
+    BOOST_CHECK(!wallet.ReadOutputAmount(outpoint, amount, blindStored));
+    wallet.StoreMissingOutputAmounts();
+    BOOST_CHECK(wallet.ReadOutputAmount(outpoint, amount, blindStored));
+    BOOST_CHECK_EQUAL(amount, 5 * COIN);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -11,6 +11,8 @@
 #include "base58.h"
 #include "checkpoints.h"
 #include "coincontrol.h"
+#include "crypto/common.h"
+#include "hash.h"
 #include "kernel.h"
 #include "masternode-budget.h"
 #include "net.h"
@@ -24,6 +26,7 @@
 
 #include "secp256k1.h"
 #include <assert.h>
+#include <atomic>
 #include <boost/algorithm/string.hpp>
 
 #include "ecdhutil.h"
@@ -35,6 +38,7 @@
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <boost/thread.hpp>
+#include <boost/thread/barrier.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include "masternodeconfig.h"
 
@@ -52,6 +56,7 @@ bool bSpendZeroConfChange = true;
 bool bdisableSystemnotifications = false; // Those bubbles can be annoying and slow down the UI when you get lots of trx
 bool fSendFreeTransactions = false;
 bool fPayAtLeastCustomFee = true;
+bool fCheckWalletBalances = false;
 int64_t nStartupTime = GetTime();
 int64_t nReserveBalance = 0;
 int64_t nDefaultConsolidateTime;
@@ -489,8 +494,11 @@ bool CWallet::RescanAfterUnlock(int fromHeight)
     if (fromHeight == 0) {
         LOCK2(cs_main, cs_wallet);
         //rescan from scanned position stored in database
-        int scannedHeight = 0;
-        CWalletDB(strWalletFile).ReadScannedBlockHeight(scannedHeight);
+        int scannedHeight = nScannedHeight;
+        if (scannedHeight < 0) {
+            scannedHeight = 0;
+            CWalletDB(strWalletFile).ReadScannedBlockHeight(scannedHeight);
+        }
         if (scannedHeight > chainActive.Height() || scannedHeight == 0) {
             pindex = chainActive.Genesis();
         } else {
@@ -528,6 +536,37 @@ bool CWallet::RescanAfterUnlock(int fromHeight)
     return true;
 }
 
+/**
+ * Record the height of the last block scanned for wallet transactions. It is written
+ * to the wallet database every SCANNED_HEIGHT_WRITE_INTERVAL blocks, at the end of a
+ * rescan and at shutdown, or right away with fFlush.
+ */
+void CWallet::SetScannedHeight(int nHeight, bool fFlush)
+{
+    LOCK(cs_wallet);
+    if (IsLocked())
+        return;
+    nScannedHeight = nHeight;
+    if (fFlush || abs(nScannedHeight - nScannedHeightWritten) >= SCANNED_HEIGHT_WRITE_INTERVAL)
+        FlushScannedHeight();
+}
+
+bool CWallet::FlushScannedHeight()
+{
+    LOCK(cs_wallet);
+    if (!fFileBacked || nScannedHeight < 0 || nScannedHeight == nScannedHeightWritten)
+        return true;
+    try {
+        if (!CWalletDB(strWalletFile).WriteScannedBlockHeight(nScannedHeight))
+            return false;
+    } catch (const std::exception& e) {
+        LogPrintf("%s : cannot write the scanned block height: %s\n", __func__, e.what());
+        return false;
+    }
+    nScannedHeightWritten = nScannedHeight;
+    return true;
+}
+
 bool CWallet::Unlock(const SecureString& strWalletPassphrase, bool anonymizeOnly)
 {
     CCrypter crypter;
@@ -543,6 +582,9 @@ bool CWallet::Unlock(const SecureString& strWalletPassphrase, bool anonymizeOnly
                 continue; // try another master key
             if (CCryptoKeyStore::Unlock(vMasterKey)) {
                 fWalletUnlockAnonymizeOnly = anonymizeOnly;
+                // amounts that could not be revealed while locked count now
+                MarkBalancesDirty();
+                StoreMissingOutputAmounts();
                 rescanNeeded = true;
                 break;
             }
@@ -558,6 +600,12 @@ bool CWallet::Unlock(const SecureString& strWalletPassphrase, bool anonymizeOnly
     return false;
 }
 
+bool CWallet::Lock()
+{
+    InvalidateStealthScanKeys();
+    return CCryptoKeyStore::Lock();
+}
+
 bool CWallet::ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase, const SecureString& strNewWalletPassphrase)
 {
     bool fWasLocked = IsLocked();
@@ -732,9 +780,8 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n)
         }
     }
 
-    std::string outString = outpoint.hash.GetHex() + std::to_string(outpoint.n);
-    CKeyImage ki = outpointToKeyImages[outString];
-    if (IsKeyImageSpend1(ki.GetHex(), uint256())) {
+    CKeyImage ki = outpointToKeyImages[outpoint];
+    if (IsKeyImageSpend1(ki, uint256())) {
         return true;
     }
 
@@ -748,6 +795,7 @@ void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
     range = mapTxSpends.equal_range(outpoint);
     SyncMetaData(range);
     inSpendQueueOutpoints.erase(outpoint);
+    MarkBalanceDirty(outpoint.hash);
 }
 
 std::string CWallet::GetTransactionType(const CTransaction& tx)
@@ -796,16 +844,14 @@ void CWallet::AddToSpends(const uint256& wtxid)
     if (thisTx.IsCoinStake()) {
         COutPoint prevout = thisTx.vin[0].prevout;
         AddToSpends(prevout, wtxid);
-        std::string outpoint = prevout.hash.GetHex() + std::to_string(prevout.n);
-        outpointToKeyImages[outpoint] = thisTx.vin[0].keyImage;
+        outpointToKeyImages[prevout] = thisTx.vin[0].keyImage;
     }
 }
 
 bool CWallet::isMatchMyKeyImage(const CKeyImage& ki, const COutPoint& out)
 {
     if (mapWallet.count(out.hash) == 0) return false;
-    std::string outpoint = out.hash.GetHex() + std::to_string(out.n);
-    CKeyImage computed = outpointToKeyImages[outpoint];
+    CKeyImage computed = outpointToKeyImages[out];
     bool ret = (computed == ki);
     return ret;
 }
@@ -874,6 +920,12 @@ bool CWallet::GetVinAndKeysFromOutput(COutput out, CTxIn& txinRet, CPubKey& pubK
     return true;
 }
 
+/** The amount and blind of an output are encrypted under an IV derived from the outpoint */
+static uint256 GetOutputInfoIV(const COutPoint& outpoint)
+{
+    return SerializeHash(outpoint);
+}
+
 bool CWallet::EncryptWallet(const SecureString& strWalletPassphrase)
 {
     if (IsCrypted())
@@ -949,6 +1001,28 @@ bool CWallet::EncryptWallet(const SecureString& strWalletPassphrase)
             assert(SetCryptedHDChain(hdChainCrypted, false));
         }
 
+        // Revealed amounts and blinds are encrypted along with the keys
+        for (std::map<COutPoint, CWalletOutputInfo>::iterator it = mapOutputInfo.begin(); it != mapOutputInfo.end(); ++it) {
+            CWalletOutputInfo& info = it->second;
+            if (info.fCrypted || info.vchAmountBlind.empty())
+                continue;
+            CKeyingMaterial vchPlaintext(info.vchAmountBlind.begin(), info.vchAmountBlind.end());
+            std::vector<unsigned char> vchCiphertext;
+            const bool fEncrypted = EncryptSecret(vMasterKey, vchPlaintext, GetOutputInfoIV(it->first), vchCiphertext);
+            if (fEncrypted) {
+                info.vchAmountBlind = vchCiphertext;
+                info.fCrypted = true;
+            }
+            if (!fEncrypted || (fFileBacked && !pwalletdbEncryption->WriteOutputInfo(it->first, info))) {
+                if (fFileBacked) {
+                    pwalletdbEncryption->TxnAbort();
+                    delete pwalletdbEncryption;
+                }
+                // Same as a key that fails to encrypt
+                assert(false);
+            }
+        }
+
         // Encryption was introduced in version 0.4.0
         SetMinVersion(FEATURE_WALLETCRYPT, pwalletdbEncryption, true);
 
@@ -1002,29 +1076,29 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
     const uint256& hashBlock = wtxIn.hashBlock;
     CBlockIndex* p = mapBlockIndex[hashBlock];
     if (p) {
-        for (CTxIn in : wtxIn.vin) {
-            pblocktree->WriteKeyImage(in.keyImage.GetHex(), hashBlock);
+        std::vector<std::pair<CKeyImage, CKeyImageSpend> > vKeyImageSpends;
+        for (const CTxIn& in : wtxIn.vin) {
+            vKeyImageSpends.push_back(std::make_pair(in.keyImage, CKeyImageSpend(hashBlock, p->nHeight)));
         }
+        pkeyimages->AddSpends(vKeyImageSpends);
     }
 
-    CWalletDB db(strWalletFile);
+    CWalletDB walletdb(strWalletFile);
     for (size_t i = 0; i < wtxIn.vout.size(); i++) {
-        std::string outpoint = hash.GetHex() + std::to_string(i);
-        if (outpointToKeyImages.count(outpoint) == 1 && outpointToKeyImages[outpoint].IsValid()) continue;
-        CKeyImage ki;
-        //reading key image
-        if (db.ReadKeyImage(outpoint, ki)) {
-            if (ki.IsFullyValid()) {
-                outpointToKeyImages[outpoint] = ki;
-                continue;
-            }
-        }
-        if (IsMine(wtxIn.vout[i])) {
-            if (generateKeyImage(wtxIn.vout[i].scriptPubKey, ki)) {
-                outpointToKeyImages[outpoint] = ki;
-                db.WriteKeyImage(outpoint, ki);
+        COutPoint outpoint(hash, i);
+        if (outpointToKeyImages.count(outpoint) == 0 || !outpointToKeyImages[outpoint].IsValid()) {
+            CKeyImage ki;
+            //key images stored before output info records existed
+            const std::string strLegacyKey = hash.GetHex() + std::to_string(i);
+            if (walletdb.ReadKeyImage(strLegacyKey, ki) && ki.IsFullyValid()) {
+                StoreOutputKeyImage(walletdb, outpoint, ki);
+                if (fFileBacked)
+                    walletdb.EraseKeyImage(strLegacyKey);
+            } else if (IsMine(wtxIn.vout[i]) && generateKeyImage(wtxIn.vout[i].scriptPubKey, ki)) {
+                StoreOutputKeyImage(walletdb, outpoint, ki);
             }
         }
+        StoreRevealedAmount(walletdb, wtxIn, outpoint);
     }
 
     if (fFromLoadWallet) {
@@ -1097,23 +1171,16 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
  * Add a transaction to the wallet, or update it.
  * pblock is optional, but should be provided if the transaction is known to be in a block.
  * If fUpdate is true, existing transactions will be updated.
+ * If fScanOutputs is false, the outputs are known not to pay to any of our stealth accounts.
  */
-bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate)
+bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate, bool fScanOutputs)
 {
     {
         AssertLockHeld(cs_wallet);
         bool fExisted = mapWallet.count(tx.GetHash()) != 0;
         if (fExisted && !fUpdate) return false;
-        IsTransactionForMe(tx);
-        if (pblock && mapBlockIndex.count(pblock->GetHash()) == 1) {
-            if (!IsLocked()) {
-                try {
-                    CWalletDB(strWalletFile).WriteScannedBlockHeight(mapBlockIndex[pblock->GetHash()]->nHeight);
-                } catch (const std::exception& e) {
-                    LogPrintf("Cannot open data base or wallet is locked\n");
-                }
-            }
-        }
+        if (fScanOutputs)
+            IsTransactionForMe(tx);
         if (fExisted || IsMine(tx) || IsFromMe(tx)) {
             CWalletTx wtx(this, tx);
             // Get merkle branch if transaction was found in a block
@@ -1127,8 +1194,24 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
 
 void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
 {
+    // Blocks are connected and disconnected starting with their coinbase
+    if (tx.IsCoinBase()) {
+        LOCK(cs_wallet);
+        if (pblock)
+            fBalanceTipChanged = true;
+        else
+            fBalanceRebuild = true;
+    }
+    // Our outputs can be spent by a block while the wallet is locked, or from another wallet
+    if (!tx.IsCoinBase())
+        MarkKeyImageSpendsDirty(tx);
     if (IsLocked()) return;
     LOCK2(cs_main, cs_wallet);
+    if (pblock && tx.IsCoinBase()) {
+        BlockMap::const_iterator mi = mapBlockIndex.find(pblock->GetHash());
+        if (mi != mapBlockIndex.end())
+            SetScannedHeight(mi->second->nHeight);
+    }
     if (!AddToWalletIfInvolvingMe(tx, pblock, true)) {
         return; // Not one of ours
     }
@@ -1150,6 +1233,7 @@ void CWallet::EraseFromWallet(const uint256& hash)
         LOCK(cs_wallet);
         if (mapWallet.erase(hash))
             CWalletDB(strWalletFile).EraseTx(hash);
+        MarkBalanceDirty(hash);
     }
     return;
 }
@@ -1172,12 +1256,10 @@ isminetype CWallet::IsMine(const CTxIn& txin) const
 
 COutPoint CWallet::findMyOutPoint(const CTxIn& txin) const
 {
-    std::string prevout = txin.prevout.hash.GetHex() + std::to_string(txin.prevout.n);
-    if (outpointToKeyImages.count(prevout) == 1 && outpointToKeyImages[prevout] == txin.keyImage) return txin.prevout;
+    if (outpointToKeyImages.count(txin.prevout) == 1 && outpointToKeyImages[txin.prevout] == txin.keyImage) return txin.prevout;
 
     for (size_t i = 0; i < txin.decoys.size(); i++) {
-        std::string out = txin.decoys[i].hash.GetHex() + std::to_string(txin.decoys[i].n);
-        if (outpointToKeyImages.count(out) == 1 && outpointToKeyImages[out] == txin.keyImage) return txin.decoys[i];
+        if (outpointToKeyImages.count(txin.decoys[i]) == 1 && outpointToKeyImages[txin.decoys[i]] == txin.keyImage) return txin.decoys[i];
     }
 
     COutPoint outpoint;
@@ -1194,8 +1276,7 @@ COutPoint CWallet::findMyOutPoint(const CTxIn& txin) const
             if (generateKeyImage(prev.vout[txin.prevout.n].scriptPubKey, ki)) {
                 if (ki == txin.keyImage) {
                     outpoint = txin.prevout;
-                    prevout = txin.prevout.hash.GetHex() + std::to_string(txin.prevout.n);
-                    outpointToKeyImages[prevout] = ki;
+                    outpointToKeyImages[outpoint] = ki;
                     return outpoint;
                 }
             }
@@ -1213,8 +1294,7 @@ COutPoint CWallet::findMyOutPoint(const CTxIn& txin) const
                 if (generateKeyImage(prev.vout[txin.decoys[i].n].scriptPubKey, ki)) {
                     if (ki == txin.keyImage) {
                         outpoint = txin.decoys[i];
-                        std::string out = txin.decoys[i].hash.GetHex() + std::to_string(txin.decoys[i].n);
-                        outpointToKeyImages[out] = ki;
+                        outpointToKeyImages[outpoint] = ki;
                         return outpoint;
                     }
                 }
@@ -1610,17 +1690,82 @@ bool CWalletTx::WriteToDisk()
     return CWalletDB(pwallet->strWalletFile).WriteTx(GetHash(), *this);
 }
 
+/**
+ * Whether out pays to the stealth account with view key view and spend public key pubSpend,
+ * that is whether its destination is P' = Hs(aR)G + B. Hs(aR) is returned in HS.
+ */
+static bool IsStealthOutputForAccount(const CTxOut& out, const CKey& view, const CPubKey& pubSpend, uint256& HS)
+{
+    CPubKey txPub(out.txPub);
+    //P' = Hs(aR)G+B, a = view private, B = spend pub, R = tx public key
+    unsigned char aR[65];
+    //copy R into a
+    memcpy(aR, txPub.begin(), txPub.size());
+    if (!secp256k1_ec_pubkey_tweak_mul(aR, txPub.size(), view.begin()))
+        return false;
+    HS = Hash(aR, aR + txPub.size());
+    unsigned char expectedDestination[65];
+    memcpy(expectedDestination, pubSpend.begin(), pubSpend.size());
+    if (!secp256k1_ec_pubkey_tweak_add(expectedDestination, pubSpend.size(), HS.begin()))
+        return false;
+    CPubKey expectedDes(expectedDestination, expectedDestination + 33);
+    return GetScriptForDestination(expectedDes) == out.scriptPubKey;
+}
+
+/** Blocks read and tested for outputs to our stealth accounts by the rescan threads */
+struct CRescanBatch {
+    std::vector<CDiskBlockPos> vPos;
+    std::vector<CBlock> vBlocks;
+    //! Per block, per transaction: whether some output pays to one of our stealth accounts
+    std::vector<std::vector<bool> > vMatches;
+    std::atomic<size_t> nNext;
+
+    explicit CRescanBatch(const std::vector<CDiskBlockPos>& vPosIn) : vPos(vPosIn), vBlocks(vPosIn.size()), vMatches(vPosIn.size()), nNext(0) {}
+};
+
+/** Rescan thread body, takes no lock: the keys are a snapshot and every block has its own slot */
+static void RescanBatchWorker(CRescanBatch* batch, const CStealthScanKeys* keys)
+{
+    size_t i;
+    while ((i = batch->nNext++) < batch->vPos.size()) {
+        CBlock& block = batch->vBlocks[i];
+        if (!ReadBlockFromDisk(block, batch->vPos[i]))
+            block.SetNull();
+        std::vector<bool>& vMatch = batch->vMatches[i];
+        vMatch.assign(block.vtx.size(), false);
+        for (size_t j = 0; j < block.vtx.size(); j++) {
+            for (const CTxOut& out : block.vtx[j].vout) {
+                if (out.IsEmpty())
+                    continue;
+                for (size_t k = 0; k < keys->views.size() && !vMatch[j]; k++) {
+                    uint256 HS;
+                    vMatch[j] = IsStealthOutputForAccount(out, keys->views[k], keys->pubSpends[k], HS);
+                }
+                if (vMatch[j])
+                    break;
+            }
+        }
+    }
+}
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
+ * Blocks are read and their outputs tested against our stealth accounts by
+ * -rescanthreads threads without any lock, only the wallet update that follows
+ * for each batch of RESCAN_BATCH_SIZE blocks runs under cs_main and cs_wallet.
  * @returns -1 if process was cancelled or the number of tx added to the wallet.
  */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate, bool fromStartup, int height)
 {
     int ret = 0;
     int64_t nNow = GetTime();
+    int64_t nTimeStart = GetTimeMicros();
+    int nBlocks = 0;
     CBlockIndex* pindex = pindexStart;
+    double dProgressStart, dProgressTip;
+    std::shared_ptr<const CStealthScanKeys> pKeys;
     {
         LOCK2(cs_main, cs_wallet);
         if (pindexStart == chainActive.Genesis()) {
@@ -1633,35 +1778,78 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate, b
             }
         }
 
+        // the keys IsTransactionForMe tests the outputs with
+        pKeys = GetStealthScanKeys();
+        if (!pKeys)
+            pKeys = std::make_shared<CStealthScanKeys>();
+
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
-        while (!IsLocked() && pindex) {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+        dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
+    }
+
+    int nThreads = GetArg("-rescanthreads", DEFAULT_RESCAN_THREADS);
+    if (nThreads <= 0)
+        nThreads += boost::thread::hardware_concurrency();
+    nThreads = std::max(1, std::min(nThreads, MAX_RESCAN_THREADS));
+
+    while (!IsLocked() && pindex) {
+        std::vector<CBlockIndex*> vIndex;
+        std::vector<CDiskBlockPos> vPos;
+        {
+            LOCK(cs_main);
+            for (; pindex && vIndex.size() < (size_t)RESCAN_BATCH_SIZE; pindex = chainActive.Next(pindex)) {
+                vIndex.push_back(pindex);
+                vPos.push_back(pindex->GetBlockPos());
+            }
+        }
+
+        CRescanBatch batch(vPos);
+        {
+            boost::thread_group threadGroup;
+            for (int i = 1; i < nThreads && (size_t)i < vPos.size(); i++)
+                threadGroup.create_thread(boost::bind(&RescanBatchWorker, &batch, pKeys.get()));
+            RescanBatchWorker(&batch, pKeys.get());
+            threadGroup.join_all();
+        }
+
+        LOCK2(cs_main, cs_wallet);
+        for (size_t i = 0; i < vIndex.size(); i++) {
+            CBlockIndex* pindexBlock = vIndex[i];
+            if (IsLocked()) {
+                pindex = NULL;
+                break;
+            }
+            if (pindexBlock->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(pindexBlock, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
 
             if (fromStartup && ShutdownRequested()) {
+                FlushScannedHeight();
                 return -1;
             }
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex);
-            for (CTransaction& tx : block.vtx) {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
+            const CBlock& block = batch.vBlocks[i];
+            for (size_t j = 0; j < block.vtx.size(); j++) {
+                if (AddToWalletIfInvolvingMe(block.vtx[j], &block, fUpdate, batch.vMatches[i][j]))
                     ret++;
             }
-            pindex = chainActive.Next(pindex);
+            SetScannedHeight(pindexBlock->nHeight);
+            nBlocks++;
             if (GetTime() >= nNow + 60) {
                 nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(pindex));
+                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindexBlock->nHeight, Checkpoints::GuessVerificationProgress(pindexBlock));
             }
             if (ShutdownRequested()) {
-                LogPrintf("Rescan aborted at block %d. Please rescanwallettransactions %f from the Debug Console to continue.\n", pindex->nHeight, pindex->nHeight);
+                FlushScannedHeight();
+                LogPrintf("Rescan aborted at block %d. Please rescanwallettransactions %f from the Debug Console to continue.\n", pindexBlock->nHeight, pindexBlock->nHeight);
                 return false;
             }
         }
-        ShowProgress(_("Rescanning... Please do not interrupt this process as it could lead to a corrupt wallet."), 100); // hide progress dialog in GUI
     }
+    FlushScannedHeight();
+    int64_t nTimeScan = GetTimeMicros() - nTimeStart;
+    LogPrint("bench", "Rescanned %d blocks: %.2fms (%.3fms/blk)\n", nBlocks, 0.001 * nTimeScan, nBlocks ? 0.001 * nTimeScan / nBlocks : 0.0);
+    ShowProgress(_("Rescanning... Please do not interrupt this process as it could lead to a corrupt wallet."), 100); // hide progress dialog in GUI
     return ret;
 }
 
@@ -1766,107 +1954,171 @@ void CWallet::ResendWalletTransactions()
  * @{
  */
 
-CAmount CWallet::GetBalance()
+CWalletTxBalance CWallet::ComputeTxBalance(const CWalletTx& wtx) const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted()) {
-                CAmount ac = pcoin->GetAvailableCredit();
-                nTotal += ac;
-            }
-        }
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    CWalletTxBalance balance;
+    const bool fTrusted = wtx.IsTrusted();
+    const int nDepth = wtx.GetDepthInMainChain();
+    if (fTrusted) {
+        balance.nTrusted = wtx.GetAvailableCredit();
+        if (!((wtx.IsCoinBase() || wtx.IsCoinStake()) && wtx.GetBlocksToMaturity() > 0 && wtx.IsInMainChain()))
+            balance.nSpendable = balance.nTrusted;
     }
-    dirtyCachedBalance = nTotal;
-    return nTotal;
+    if (!IsFinalTx(wtx) || (!fTrusted && nDepth == 0))
+        balance.nUnconfirmed = wtx.GetAvailableCredit(false);
+    balance.nImmature = wtx.GetImmatureCredit(false);
+    if (!fLiteMode && fTrusted && nDepth > 0) {
+        balance.nLocked = wtx.GetLockedCredit();
+        balance.nUnlocked = wtx.GetUnlockedCredit();
+    }
+    return balance;
 }
 
-CAmount CWallet::GetSpendableBalance()
+void CWallet::UpdateBalanceLedger() const
 {
-    CAmount nLockedBalance = 0;
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted()) {
-                if (!((pcoin->IsCoinBase() || pcoin->IsCoinStake()) && pcoin->GetBlocksToMaturity() > 0 && pcoin->IsInMainChain())) {
-                    nTotal += pcoin->GetAvailableCredit();
-                }
-            }
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    if (fBalanceRebuild) {
+        mapTxBalances.clear();
+        balanceTotals = CWalletTxBalance();
+        setVolatileBalances.clear();
+        setDirtyBalances.clear();
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            setDirtyBalances.insert(it->first);
+        fBalanceRebuild = false;
+        fBalanceTipChanged = false;
+    }
+    if (fBalanceTipChanged) {
+        // Only unconfirmed and immature transactions change balance as blocks are connected,
+        // a disconnected block rebuilds the whole ledger
+        setDirtyBalances.insert(setVolatileBalances.begin(), setVolatileBalances.end());
+        fBalanceTipChanged = false;
+    }
+
+    std::set<uint256> setDirty;
+    setDirty.swap(setDirtyBalances);
+    for (const uint256& hash : setDirty) {
+        std::map<uint256, CWalletTxBalance>::iterator bi = mapTxBalances.find(hash);
+        if (bi != mapTxBalances.end()) {
+            balanceTotals -= bi->second;
+            mapTxBalances.erase(bi);
+        }
+        setVolatileBalances.erase(hash);
+
+        map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+        if (it == mapWallet.end())
+            continue;
+        const CWalletTx& wtx = it->second;
+        CWalletTxBalance balance = ComputeTxBalance(wtx);
+        if (balance != CWalletTxBalance()) {
+            balanceTotals += balance;
+            mapTxBalances[hash] = balance;
         }
+        if (wtx.GetDepthInMainChain(false) <= 0 || wtx.GetBlocksToMaturity() > 0)
+            setVolatileBalances.insert(hash);
     }
+}
 
-    nLockedBalance = pwalletMain->GetLockedCoins();
-    nTotal = nTotal - nLockedBalance;
-    return nTotal;
+void CWallet::CheckBalanceLedger() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    CWalletTxBalance totals;
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        totals += ComputeTxBalance(it->second);
+    if (totals != balanceTotals) {
+        LogPrintf("%s : ledger (%d %d %d %d %d %d) does not match wallet (%d %d %d %d %d %d)\n", __func__,
+            balanceTotals.nTrusted, balanceTotals.nSpendable, balanceTotals.nUnconfirmed, balanceTotals.nImmature, balanceTotals.nLocked, balanceTotals.nUnlocked,
+            totals.nTrusted, totals.nSpendable, totals.nUnconfirmed, totals.nImmature, totals.nLocked, totals.nUnlocked);
+        assert(!"balance ledger out of sync");
+    }
 }
 
+CWalletTxBalance CWallet::GetBalanceTotals() const
+{
+    {
+        LOCK(cs_wallet);
+        if (!fBalanceRebuild && !fBalanceTipChanged && setDirtyBalances.empty() && !fCheckWalletBalances)
+            return balanceTotals;
+    }
+    LOCK2(cs_main, cs_wallet);
+    UpdateBalanceLedger();
+    if (fCheckWalletBalances)
+        CheckBalanceLedger();
+    return balanceTotals;
+}
 
-CAmount CWallet::GetUnlockedCoins() const
+void CWallet::MarkBalanceDirty(const uint256& hash) const
 {
-    if (fLiteMode) return 0;
+    LOCK(cs_wallet);
+    setDirtyBalances.insert(hash);
+}
 
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+void CWallet::MarkBalancesDirty() const
+{
+    LOCK(cs_wallet);
+    fBalanceRebuild = true;
+}
 
-            if (pcoin->IsTrusted() && pcoin->GetDepthInMainChain() > 0)
-                nTotal += pcoin->GetUnlockedCredit();
+void CWallet::MarkKeyImageSpendsDirty(const CTransaction& tx)
+{
+    LOCK(cs_wallet);
+    // Only the key images already stored are looked up, generating them needs the wallet unlocked
+    for (const CTxIn& txin : tx.vin) {
+        if (!txin.keyImage.IsValid())
+            continue;
+        for (size_t i = 0; i <= txin.decoys.size(); i++) {
+            const COutPoint& outpoint = i == 0 ? txin.prevout : txin.decoys[i - 1];
+            std::map<COutPoint, CKeyImage>::const_iterator ki = outpointToKeyImages.find(outpoint);
+            if (ki == outpointToKeyImages.end() || ki->second != txin.keyImage)
+                continue;
+            map<uint256, CWalletTx>::iterator mi = mapWallet.find(outpoint.hash);
+            if (mi != mapWallet.end())
+                mi->second.MarkDirty();
+            break;
         }
     }
+}
 
+CAmount CWallet::GetBalance()
+{
+    CAmount nTotal = GetBalanceTotals().nTrusted;
+    dirtyCachedBalance = nTotal;
     return nTotal;
 }
 
-CAmount CWallet::GetLockedCoins() const
+CAmount CWallet::GetSpendableBalance()
+{
+    CWalletTxBalance totals = GetBalanceTotals();
+    return totals.nSpendable - totals.nLocked;
+}
+
+
+CAmount CWallet::GetUnlockedCoins() const
 {
     if (fLiteMode) return 0;
 
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+    return GetBalanceTotals().nUnlocked;
+}
 
-            if (pcoin->IsTrusted() && pcoin->GetDepthInMainChain() > 0)
-                nTotal += pcoin->GetLockedCredit();
-        }
-    }
+CAmount CWallet::GetLockedCoins() const
+{
+    if (fLiteMode) return 0;
 
-    return nTotal;
+    return GetBalanceTotals().nLocked;
 }
 
 
 CAmount CWallet::GetUnconfirmedBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableCredit(false);
-        }
-    }
-    return nTotal;
+    return GetBalanceTotals().nUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit(false);
-        }
-    }
-    return nTotal;
+    return GetBalanceTotals().nImmature;
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const
@@ -2465,6 +2717,7 @@ void CWallet::resetPendingOutPoints()
             LOCK(mempool.cs);
             {
                 inSpendQueueOutpoints.clear();
+                MarkBalancesDirty();
                 for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mempool.mapTx.begin(); it != mempool.mapTx.end(); ++it) {
                     const CTransaction& tx = it->second.GetTx();
                     for (size_t i = 0; i < tx.vin.size(); i++) {
@@ -3101,11 +3354,92 @@ bool CWallet::generateBulletProofAggregate(CTransaction& tx)
         blind_ptr[i] = blinds[i];
         values[i] = tx.vout[i].nValue;
     }
-    int ret = secp256k1_bulletproof_rangeproof_prove(GetContext(), GetScratch(), GetGenerator(), proof, &len, values, NULL, blind_ptr, tx.vout.size(), &secp256k1_generator_const_h, 64, nonce, NULL, 0);
+    int ret = secp256k1_bulletproof_rangeproof_prove(GetContext(), GetProveScratch(tx.vout.size()), GetGenerator(), proof, &len, values, NULL, blind_ptr, tx.vout.size(), &secp256k1_generator_const_h, 64, nonce, NULL, 0);
     std::copy(proof, proof + len, std::back_inserter(tx.bulletproofs));
     return ret;
 }
 
+/** Fewest ring rows worth a signing thread of their own */
+static const size_t MIN_RING_ROWS_PER_THREAD = 4;
+/** Maximum number of threads makeRingCT evaluates the ring columns with */
+static const int MAX_RING_SIGNING_THREADS = 8;
+
+/**
+ * The ring columns of a signature being made. The threads first hash the ring
+ * members to their curve points, then evaluate the rows of one column after the
+ * other: each column's challenge is the hash of the L and R points of the column
+ * before it, which the last thread to finish that column computes.
+ */
+struct CRingSigningJob {
+    const size_t nRows;
+    const size_t nCols;
+    const int nRealIndex;
+    const size_t nChunk;
+    const uint256 hashSig;
+    //! ring members, their curve points and hashed points, and the responses, column after column
+    std::vector<unsigned char> vPubKeys;
+    std::vector<secp256k1_pubkey2> vPoints;
+    std::vector<secp256k1_pubkey2> vHashPoints;
+    std::vector<unsigned char> vS;
+    secp256k1_pubkey2 keyImages[SECP256K1_MLSAG_MAX_ROWS];
+    //! challenge of every column
+    std::vector<uint256> vC;
+    //! the column being evaluated and its L and R points
+    int nCol;
+    unsigned char L[SECP256K1_MLSAG_MAX_ROWS * 33];
+    unsigned char R[SECP256K1_MLSAG_MAX_ROWS * 33];
+    std::atomic<size_t> nNext;
+    std::atomic<bool> fOk;
+    boost::barrier barrier;
+
+    CRingSigningJob(size_t nRowsIn, size_t nColsIn, int nRealIndexIn, const uint256& hashSigIn, int nThreads)
+        : nRows(nRowsIn), nCols(nColsIn), nRealIndex(nRealIndexIn), nChunk((nRowsIn + nThreads - 1) / nThreads), hashSig(hashSigIn),
+          vPubKeys(nRowsIn * nColsIn * 33), vPoints(nRowsIn * nColsIn), vHashPoints(nRowsIn * nColsIn), vS(nRowsIn * nColsIn * 32),
+          vC(nColsIn), nCol((nRealIndexIn + 1) % nColsIn), nNext(0), fOk(true), barrier(nThreads) {}
+};
+
+/** Signing thread body, takes no lock: the threads only share the job, and meet at its barrier between steps */
+static void RingSigningWorker(CRingSigningJob* job)
+{
+    secp256k1_context2* both = GetContext();
+    size_t i;
+    while ((i = job->nNext++) < job->vPoints.size()) {
+        if ((int)(i / job->nRows) != job->nRealIndex && !ParseRingPoint(&job->vPubKeys[33 * i], job->vPoints[i], job->vHashPoints[i]))
+            job->fOk = false;
+    }
+    if (job->barrier.wait()) {
+        job->nNext = 0;
+        if (!job->fOk) job->nCol = job->nRealIndex;
+    }
+    job->barrier.wait();
+
+    while (job->nCol != job->nRealIndex) {
+        const size_t nFirst = job->nCol * job->nRows;
+        while (job->fOk && (i = job->nNext.fetch_add(job->nChunk)) < job->nRows) {
+            const size_t n = std::min(job->nChunk, job->nRows - i);
+            if (!secp256k1_mlsag_compute_column(both, job->L + 33 * i, job->R + 33 * i, job->vC[job->nCol].begin(), &job->vS[32 * (nFirst + i)],
+                    &job->vPoints[nFirst + i], &job->vHashPoints[nFirst + i], job->keyImages + i, n))
+                job->fOk = false;
+        }
+        if (job->barrier.wait()) {
+            unsigned char tempForHash[2 * SECP256K1_MLSAG_MAX_ROWS * 33 + 32];
+            unsigned char* tempForHashPtr = tempForHash;
+            for (i = 0; i < job->nRows; i++) {
+                memcpy(tempForHashPtr, job->L + 33 * i, 33);
+                tempForHashPtr += 33;
+                memcpy(tempForHashPtr, job->R + 33 * i, 33);
+                tempForHashPtr += 33;
+            }
+            memcpy(tempForHashPtr, job->hashSig.begin(), 32);
+            job->nCol = (job->nCol + 1) % job->nCols;
+            job->vC[job->nCol] = Hash(tempForHash, tempForHash + 2 * job->nRows * 33 + 32);
+            job->nNext = 0;
+            if (!job->fOk) job->nCol = job->nRealIndex;
+        }
+        job->barrier.wait();
+    }
+}
+
 bool CWallet::makeRingCT(CTransaction& wtxNew, int ringSize, std::string& strFailReason)
 {
     LogPrintf("Making RingCT using ring size=%d\n", ringSize);
@@ -3315,18 +3649,16 @@ bool CWallet::makeRingCT(CTransaction& wtxNew, int ringSize, std::string& strFai
         }
         for (int j = 0; j < (int)wtxNew.vin[0].decoys.size() + 1; j++) {
             if (j != PI) {
-                CTransaction txPrev;
-                uint256 hashBlock;
-                if (!GetTransaction(decoysForIn[j].hash, txPrev, hashBlock)) {
+                CRingMemberOutput member;
+                if (!GetRingMemberOutput(decoysForIn[j], member)) {
                     return false;
                 }
-                CPubKey extractedPub;
-                if (!ExtractPubKey(txPrev.vout[decoysForIn[j].n].scriptPubKey, extractedPub)) {
+                if (!member.HasPubKey()) {
                     strFailReason = _("Cannot extract public key from script pubkey");
                     return false;
                 }
-                memcpy(allInPubKeys[i][j], extractedPub.begin(), 33);
-                memcpy(allInCommitments[i][j], &(txPrev.vout[decoysForIn[j].n].commitment[0]), 33);
+                memcpy(allInPubKeys[i][j], member.vchPubKey, 33);
+                memcpy(allInCommitments[i][j], member.vchCommitment, 33);
             }
         }
     }
@@ -3386,15 +3718,17 @@ bool CWallet::makeRingCT(CTransaction& wtxNew, int ringSize, std::string& strFai
         }
     }
 
-    //Computing C
-    int PI_interator = PI + 1; //PI_interator: PI + 1 .. wtxNew.vin[0].decoys.size() + 1 .. PI
-    //unsigned char SIJ[wtxNew.vin.size() + 1][wtxNew.vin[0].decoys.size() + 1][32];
-    //unsigned char LIJ[wtxNew.vin.size() + 1][wtxNew.vin[0].decoys.size() + 1][33];
-    //unsigned char RIJ[wtxNew.vin.size() + 1][wtxNew.vin[0].decoys.size() + 1][33];
-    unsigned char CI[MAX_DECOYS + 1][32];
+    //Computing C: the L and R points of the columns other than PI only depend on the
+    //challenge of their column, so the rows of each column are spread over several threads
+    const int nRows = wtxNew.vin.size() + 1;
+    const int nCols = wtxNew.vin[0].decoys.size() + 1;
+    int nThreads = std::min((int)boost::thread::hardware_concurrency(), MAX_RING_SIGNING_THREADS);
+    nThreads = std::max(1, std::min(nThreads, (int)((nRows + MIN_RING_ROWS_PER_THREAD - 1) / MIN_RING_ROWS_PER_THREAD)));
+    int64_t nTimeStart = GetTimeMicros();
+
     unsigned char tempForHash[2 * (MAX_VIN + 1) * 33 + 32];
     unsigned char* tempForHashPtr = tempForHash;
-    for (size_t i = 0; i < wtxNew.vin.size() + 1; i++) {
+    for (int i = 0; i < nRows; i++) {
         memcpy(tempForHashPtr, &LIJ[i][PI][0], 33);
         tempForHashPtr += 33;
         memcpy(tempForHashPtr, &RIJ[i][PI][0], 33);
@@ -3403,86 +3737,34 @@ bool CWallet::makeRingCT(CTransaction& wtxNew, int ringSize, std::string& strFai
     uint256 ctsHash = GetTxSignatureHash(wtxNew);
     memcpy(tempForHashPtr, ctsHash.begin(), 32);
 
-    if (PI_interator == (int)wtxNew.vin[0].decoys.size() + 1) PI_interator = 0;
-    uint256 temppi1 = Hash(tempForHash, tempForHash + 2 * (wtxNew.vin.size() + 1) * 33 + 32);
-    if (PI_interator == 0) {
-        memcpy(CI[0], temppi1.begin(), 32);
-    } else {
-        memcpy(CI[PI_interator], temppi1.begin(), 32);
-    }
-
-    while (PI_interator != PI) {
-        for (int j = 0; j < (int)wtxNew.vin.size() + 1; j++) {
-            //compute LIJ
-            unsigned char CP[33];
-            memcpy(CP, allInPubKeys[j][PI_interator], 33);
-            if (!secp256k1_ec_pubkey_tweak_mul(CP, 33, CI[PI_interator])) {
-                strFailReason = _("Cannot compute LIJ for ring signature in secp256k1_ec_pubkey_tweak_mul");
-                return false;
-            }
-            if (!secp256k1_ec_pubkey_tweak_add(CP, 33, SIJ[j][PI_interator])) {
-                strFailReason = _("Cannot compute LIJ for ring signature in secp256k1_ec_pubkey_tweak_add");
-                return false;
-            }
-            memcpy(LIJ[j][PI_interator], CP, 33);
-
-            //compute RIJ
-            //first compute CI * I
-            memcpy(RIJ[j][PI_interator], allKeyImages[j], 33);
-            if (!secp256k1_ec_pubkey_tweak_mul(RIJ[j][PI_interator], 33, CI[PI_interator])) {
-                strFailReason = _("Cannot compute RIJ for ring signature in secp256k1_ec_pubkey_tweak_mul");
-                return false;
-            }
-
-            //compute S*H(P)
-            unsigned char SHP[33];
-            CPubKey tempP;
-            tempP.Set(allInPubKeys[j][PI_interator], allInPubKeys[j][PI_interator] + 33);
-            PointHashingSuccessively(tempP, SIJ[j][PI_interator], SHP);
-            //convert shp into commitment
-            secp256k1_pedersen_commitment SHP_commitment;
-            secp256k1_pedersen_serialized_pubkey_to_commitment(SHP, 33, &SHP_commitment);
-
-            //convert CI*I into commitment
-            secp256k1_pedersen_commitment cii_commitment;
-            secp256k1_pedersen_serialized_pubkey_to_commitment(RIJ[j][PI_interator], 33, &cii_commitment);
-
-            const secp256k1_pedersen_commitment* twoElements[2];
-            twoElements[0] = &SHP_commitment;
-            twoElements[1] = &cii_commitment;
-
-            secp256k1_pedersen_commitment sum;
-            if (!secp256k1_pedersen_commitment_sum_pos(both, twoElements, 2, &sum))
-                throw runtime_error("Cannot compute sum of commitments");
-            size_t tempLength;
-            if (!secp256k1_pedersen_commitment_to_serialized_pubkey(&sum, RIJ[j][PI_interator], &tempLength)) {
-                strFailReason = _("Cannot compute two elements and serialize it to pubkey");
-            }
-        }
-
-        PI_interator++;
-        if (PI_interator == (int)wtxNew.vin[0].decoys.size() + 1) PI_interator = 0;
-
-        int prev, ciIdx;
-        if (PI_interator == 0) {
-            prev = wtxNew.vin[0].decoys.size();
-            ciIdx = 0;
-        } else {
-            prev = PI_interator - 1;
-            ciIdx = PI_interator;
+    CRingSigningJob job(nRows, nCols, PI, ctsHash, nThreads);
+    job.vC[job.nCol] = Hash(tempForHash, tempForHash + 2 * nRows * 33 + 32);
+    for (int i = 0; i < nRows; i++) {
+        if (!secp256k1_ec_pubkey_parse2(both, &job.keyImages[i], allKeyImages[i], 33)) {
+            strFailReason = _("Cannot parse the key images for ring signature");
+            return false;
         }
-
-        tempForHashPtr = tempForHash;
-        for (int i = 0; i < (int)wtxNew.vin.size() + 1; i++) {
-            memcpy(tempForHashPtr, LIJ[i][prev], 33);
-            tempForHashPtr += 33;
-            memcpy(tempForHashPtr, RIJ[i][prev], 33);
-            tempForHashPtr += 33;
+        for (int j = 0; j < nCols; j++) {
+            memcpy(&job.vPubKeys[33 * (j * nRows + i)], allInPubKeys[i][j], 33);
+            memcpy(&job.vS[32 * (j * nRows + i)], SIJ[i][j], 32);
         }
-        memcpy(tempForHashPtr, ctsHash.begin(), 32);
-        uint256 ciHashTmp = Hash(tempForHash, tempForHash + 2 * (wtxNew.vin.size() + 1) * 33 + 32);
-        memcpy(CI[ciIdx], ciHashTmp.begin(), 32);
     }
+    {
+        boost::thread_group threadGroup;
+        for (int i = 1; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&RingSigningWorker, &job));
+        RingSigningWorker(&job);
+        threadGroup.join_all();
+    }
+    if (!job.fOk) {
+        strFailReason = _("Cannot compute the ring signature");
+        return false;
+    }
+    LogPrint("bench", "Ring signature of %d rows x %d columns: %.2fms (%d threads)\n", nRows, nCols, 0.001 * (GetTimeMicros() - nTimeStart), nThreads);
+
+    unsigned char CI[MAX_DECOYS + 1][32];
+    for (int j = 0; j < nCols; j++)
+        memcpy(CI[j], job.vC[j].begin(), 32);
 
     //compute S[j][PI] = alpha_j - c_pi * x_j, x_j = private key corresponding to key image I
     for (size_t j = 0; j < wtxNew.vin.size() + 1; j++) {
@@ -3557,44 +3839,159 @@ bool CWallet::MakeShnorrSignatureTxIn(CTxIn& txin, uint256 cts)
     return true;
 }
 
-bool CWallet::selectDecoysAndRealIndex(CTransaction& tx, int& myIndex, int ringSize)
+static boost::mutex csDecoyPoolRefill;
+static boost::condition_variable condDecoyPoolRefill;
+static bool fDecoyPoolRefill = true;
+
+void NotifyDecoyPoolRefill()
 {
-    LogPrintf("Selecting coinbase decoys for transaction\n");
-    if (coinbaseDecoysPool.size() <= 100) {
-        for (int i = chainActive.Height() - Params().COINBASE_MATURITY(); i > 0; i--) {
-            if (coinbaseDecoysPool.size() > 100) break;
-            CBlockIndex* p = chainActive[i];
-            CBlock b;
-            if (ReadBlockFromDisk(b, p)) {
-                int coinbaseIdx = 0;
-                if (p->IsProofOfStake()) {
-                    coinbaseIdx = 1;
-                }
-                //dont select poa as decoy
-                if (b.posBlocksAudited.size() > 0) continue;
-                CTransaction& coinbase = b.vtx[coinbaseIdx];
-
-                for (size_t i = 0; i < coinbase.vout.size(); i++) {
-                    if (!coinbase.vout[i].IsNull() && !coinbase.vout[i].commitment.empty() && coinbase.vout[i].nValue > 0 && !coinbase.vout[i].IsEmpty()) {
-                        if ((secp256k1_rand32() % 100) <= CWallet::PROBABILITY_NEW_COIN_SELECTED) {
-                            COutPoint newOutPoint(coinbase.GetHash(), i);
-                            if (pwalletMain->coinbaseDecoysPool.count(newOutPoint) == 1) {
-                                continue;
-                            }
-                            //add new coinbase transaction to the pool
-                            if (pwalletMain->coinbaseDecoysPool.size() >= CWallet::MAX_DECOY_POOL) {
-                                int selected = secp256k1_rand32() % CWallet::MAX_DECOY_POOL;
-                                map<COutPoint, uint256>::const_iterator it = std::next(coinbaseDecoysPool.begin(), selected);
-                                pwalletMain->coinbaseDecoysPool[newOutPoint] = p->GetBlockHash();
-                            } else {
-                                pwalletMain->coinbaseDecoysPool[newOutPoint] = p->GetBlockHash();
-                            }
-                        }
-                    }
-                }
-            }
+    {
+        boost::unique_lock<boost::mutex> lock(csDecoyPoolRefill);
+        fDecoyPoolRefill = true;
+    }
+    condDecoyPoolRefill.notify_one();
+}
+
+void ThreadDecoyPoolRefill()
+{
+    int nLastHeight = -1;
+    int nBackfillHeight = -1;
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(csDecoyPoolRefill);
+            while (!fDecoyPoolRefill)
+                condDecoyPoolRefill.wait(lock);
+            fDecoyPoolRefill = false;
         }
+        if (pwalletMain && !fImporting && !fReindex)
+            pwalletMain->RefillDecoyPools(nLastHeight, nBackfillHeight);
+    }
+}
+
+void CWallet::UpdatedBlockTip(const CBlockIndex* pindex)
+{
+    NotifyDecoyPoolRefill();
+}
+
+static bool ReadActiveChainBlock(int nHeight, CBlock& block, uint256& hashBlock)
+{
+    CDiskBlockPos pos;
+    {
+        LOCK(cs_main);
+        if (nHeight < 0 || nHeight > chainActive.Height())
+            return false;
+        pos = chainActive[nHeight]->GetBlockPos();
+        hashBlock = chainActive[nHeight]->GetBlockHash();
+    }
+    return ReadBlockFromDisk(block, pos);
+}
+
+static void AddUserDecoys(CDecoyPool& userPool, CDecoyPool& coinbasePool, const CBlock& block, const uint256& hashBlock, int nHeight)
+{
+    size_t nStart = 1;
+    if (block.IsProofOfStake()) {
+        nStart = 2;
+        // the staked output is spent
+        userPool.Remove(block.vtx[1].vin[0].prevout);
+        coinbasePool.Remove(block.vtx[1].vin[0].prevout);
+    }
+    for (size_t i = nStart; i < block.vtx.size(); i++) {
+        for (size_t j = 0; j < block.vtx[i].vout.size(); j++) {
+            if (!block.vtx[i].vout[j].commitment.empty() && GetRand(100) <= (uint64_t)CWallet::PROBABILITY_NEW_COIN_SELECTED)
+                userPool.Add(COutPoint(block.vtx[i].GetHash(), j), hashBlock, nHeight);
+        }
+    }
+}
+
+static void AddCoinbaseDecoys(CDecoyPool& coinbasePool, const CBlock& block, const uint256& hashBlock, int nHeight)
+{
+    //dont select poa as decoy
+    if (!block.posBlocksAudited.empty())
+        return;
+    const CTransaction& coinbase = block.vtx[block.IsProofOfStake() ? 1 : 0];
+    for (size_t i = 0; i < coinbase.vout.size(); i++) {
+        const CTxOut& out = coinbase.vout[i];
+        if (!out.IsNull() && !out.commitment.empty() && out.nValue > 0 && !out.IsEmpty()) {
+            if (GetRand(100) <= (uint64_t)CWallet::PROBABILITY_NEW_COIN_SELECTED)
+                coinbasePool.Add(COutPoint(coinbase.GetHash(), i), hashBlock, nHeight);
+        }
+    }
+}
+
+/**
+ * Add the outputs of the blocks connected since nLastHeight to the decoy pools, and
+ * walk the chain back from nBackfillHeight while there are few coinbase decoys.
+ * Blocks are read without cs_main or cs_wallet, the pools take their own locks.
+ */
+void CWallet::RefillDecoyPools(int& nLastHeight, int& nBackfillHeight)
+{
+    int nTip;
+    {
+        LOCK(cs_main);
+        nTip = chainActive.Height();
     }
+    const int nMaturity = Params().COINBASE_MATURITY();
+    // entries of disconnected blocks are skipped when decoys are selected
+    nLastHeight = std::min(nLastHeight, nTip);
+
+    CBlock block;
+    uint256 hashBlock;
+    for (int nHeight = std::max(nLastHeight + 1, nTip - MAX_DECOY_REFILL_BLOCKS + 1); nHeight <= nTip; nHeight++) {
+        boost::this_thread::interruption_point();
+        if (ReadActiveChainBlock(nHeight, block, hashBlock))
+            AddUserDecoys(userDecoysPool, coinbaseDecoysPool, block, hashBlock, nHeight);
+        if (nHeight - nMaturity > 0 && ReadActiveChainBlock(nHeight - nMaturity, block, hashBlock))
+            AddCoinbaseDecoys(coinbaseDecoysPool, block, hashBlock, nHeight - nMaturity);
+    }
+    nLastHeight = nTip;
+
+    if (nBackfillHeight < 0)
+        nBackfillHeight = nTip - nMaturity;
+    while (nBackfillHeight > 0 && coinbaseDecoysPool.Size() <= (size_t)MIN_COINBASE_DECOY_POOL) {
+        boost::this_thread::interruption_point();
+        if (ReadActiveChainBlock(nBackfillHeight, block, hashBlock))
+            AddCoinbaseDecoys(coinbaseDecoysPool, block, hashBlock, nBackfillHeight);
+        nBackfillHeight--;
+    }
+    LogPrint("selectcoins", "%s: Coinbase decoys = %d, user decoys = %d\n", __func__, coinbaseDecoysPool.Size(), userDecoysPool.Size());
+}
+
+/** Random picks selectDecoysAndRealIndex makes per decoy before giving up */
+static const int MAX_DECOY_PICKS = 100;
+
+static bool IsDecoyInActiveChain(const CDecoyPool::Entry& entry)
+{
+    AssertLockHeld(cs_main);
+    return entry.nHeight <= chainActive.Height() && chainActive[entry.nHeight]->GetBlockHash() == entry.hashBlock;
+}
+
+/** Pick an entry of vPools, each pool weighted by its size, found at most at nMaxHeight and favouring recent outputs */
+static bool SelectDecoy(const std::vector<const CDecoyPool*>& vPools, int nMaxHeight, COutPoint& outpoint)
+{
+    size_t nTotal = 0;
+    for (const CDecoyPool* pool : vPools)
+        nTotal += pool->Size();
+    if (nTotal == 0)
+        return false;
+    size_t nPick = GetRand(nTotal);
+    for (const CDecoyPool* pool : vPools) {
+        if (nPick >= pool->Size()) {
+            nPick -= pool->Size();
+            continue;
+        }
+        CDecoyPool::Entry entry;
+        if (!pool->GetRandomByAge(nMaxHeight, Params().TargetSpacing(), entry) || !IsDecoyInActiveChain(entry))
+            return false;
+        outpoint = entry.outpoint;
+        return true;
+    }
+    return false;
+}
+
+bool CWallet::selectDecoysAndRealIndex(CTransaction& tx, int& myIndex, int ringSize)
+{
+    LogPrintf("Selecting decoys for transaction\n");
+    LOCK2(userDecoysPool.cs, coinbaseDecoysPool.cs);
     //Choose decoys
     myIndex = -1;
     for (size_t i = 0; i < tx.vin.size(); i++) {
@@ -3635,89 +4032,43 @@ bool CWallet::selectDecoysAndRealIndex(CTransaction& tx, int& myIndex, int ringS
 
         pendingKeyImages.push_back(ki.GetHex());
         int numDecoys = 0;
-        if (txPrev.IsCoinAudit() || txPrev.IsCoinBase() || txPrev.IsCoinStake()) {
-            if ((int)coinbaseDecoysPool.size() >= ringSize * 5) {
-                while (numDecoys < ringSize) {
-                    bool duplicated = false;
-                    map<COutPoint, uint256>::const_iterator it = std::next(coinbaseDecoysPool.begin(), secp256k1_rand32() % coinbaseDecoysPool.size());
-                    if (mapBlockIndex.count(it->second) < 1) continue;
-                    CBlockIndex* atTheblock = mapBlockIndex[it->second];
-                    if (!atTheblock || !chainActive.Contains(atTheblock)) continue;
-                    if (!chainActive.Contains(atTheblock)) continue;
-                    if (1 + chainActive.Height() - atTheblock->nHeight < DecoyConfirmationMinimum) continue;
-                    COutPoint outpoint = it->first;
-                    for (size_t d = 0; d < tx.vin[i].decoys.size(); d++) {
-                        if (tx.vin[i].decoys[d] == outpoint) {
-                            duplicated = true;
-                            break;
-                        }
-                    }
-                    if (duplicated) {
-                        continue;
-                    }
-                    tx.vin[i].decoys.push_back(outpoint);
-                    numDecoys++;
-                }
-            } else if ((int)coinbaseDecoysPool.size() >= ringSize) {
-                for (size_t j = 0; j < coinbaseDecoysPool.size(); j++) {
-                    map<COutPoint, uint256>::const_iterator it = std::next(coinbaseDecoysPool.begin(), j);
-                    if (mapBlockIndex.count(it->second) < 1) continue;
-                    CBlockIndex* atTheblock = mapBlockIndex[it->second];
-                    if (!atTheblock || !chainActive.Contains(atTheblock)) continue;
-                    if (!chainActive.Contains(atTheblock)) continue;
-                    if (1 + chainActive.Height() - atTheblock->nHeight < DecoyConfirmationMinimum) continue;
-                    COutPoint outpoint = it->first;
-                    tx.vin[i].decoys.push_back(outpoint);
-                    numDecoys++;
-                    if (numDecoys == ringSize) break;
-                }
-            } else {
-                LogPrintf("Not enough decoys. Please wait approximately 10 minutes and try again.\n");
-                return false;
+        std::vector<const CDecoyPool*> vPools;
+        if (!(txPrev.IsCoinAudit() || txPrev.IsCoinBase() || txPrev.IsCoinStake()))
+            vPools.push_back(&userDecoysPool);
+        vPools.push_back(&coinbaseDecoysPool);
+        size_t nPoolSize = 0;
+        for (const CDecoyPool* pool : vPools)
+            nPoolSize += pool->Size();
+        const int nMaxHeight = 1 + chainActive.Height() - DecoyConfirmationMinimum;
+        std::vector<COutPoint>& decoys = tx.vin[i].decoys;
+        if ((int)nPoolSize >= ringSize * 5) {
+            for (int nTry = 0; numDecoys < ringSize && nTry < ringSize * MAX_DECOY_PICKS; nTry++) {
+                COutPoint outpoint;
+                if (!SelectDecoy(vPools, nMaxHeight, outpoint))
+                    continue;
+                if (outpoint == tx.vin[i].prevout || std::find(decoys.begin(), decoys.end(), outpoint) != decoys.end())
+                    continue;
+                decoys.push_back(outpoint);
+                numDecoys++;
             }
-        } else {
-            std::map<COutPoint, uint256> decoySet = userDecoysPool;
-            decoySet.insert(coinbaseDecoysPool.begin(), coinbaseDecoysPool.end());
-            if ((int)decoySet.size() >= ringSize * 5) {
-                while (numDecoys < ringSize) {
-                    bool duplicated = false;
-                    map<COutPoint, uint256>::const_iterator it = std::next(decoySet.begin(), secp256k1_rand32() % decoySet.size());
-                    if (mapBlockIndex.count(it->second) < 1) continue;
-                    CBlockIndex* atTheblock = mapBlockIndex[it->second];
-                    if (!atTheblock || !chainActive.Contains(atTheblock)) continue;
-                    if (!chainActive.Contains(atTheblock)) continue;
-                    if (1 + chainActive.Height() - atTheblock->nHeight < DecoyConfirmationMinimum) continue;
-                    COutPoint outpoint = it->first;
-                    for (size_t d = 0; d < tx.vin[i].decoys.size(); d++) {
-                        if (tx.vin[i].decoys[d] == outpoint) {
-                            duplicated = true;
-                            break;
-                        }
-                    }
-                    if (duplicated) {
+        } else if ((int)nPoolSize >= ringSize) {
+            for (const CDecoyPool* pool : vPools) {
+                for (size_t j = 0; j < pool->Size() && numDecoys < ringSize; j++) {
+                    CDecoyPool::Entry entry = pool->At(j);
+                    if (entry.nHeight > nMaxHeight || !IsDecoyInActiveChain(entry))
                         continue;
-                    }
-                    tx.vin[i].decoys.push_back(outpoint);
-                    numDecoys++;
-                }
-            } else if ((int)decoySet.size() >= ringSize) {
-                for (size_t j = 0; j < decoySet.size(); j++) {
-                    map<COutPoint, uint256>::const_iterator it = std::next(decoySet.begin(), j);
-                    if (mapBlockIndex.count(it->second) < 1) continue;
-                    CBlockIndex* atTheblock = mapBlockIndex[it->second];
-                    if (!atTheblock || !chainActive.Contains(atTheblock)) continue;
-                    if (!chainActive.Contains(atTheblock)) continue;
-                    if (1 + chainActive.Height() - atTheblock->nHeight < DecoyConfirmationMinimum) continue;
-                    COutPoint outpoint = it->first;
-                    tx.vin[i].decoys.push_back(outpoint);
+                    if (entry.outpoint == tx.vin[i].prevout || std::find(decoys.begin(), decoys.end(), entry.outpoint) != decoys.end())
+                        continue;
+                    decoys.push_back(entry.outpoint);
                     numDecoys++;
-                    if (numDecoys == ringSize) break;
                 }
-            } else {
-                LogPrintf("Not enough decoys. Please wait approximately 10 minutes and try again.\n");
-                return false;
             }
         }
+        if (numDecoys < ringSize) {
+            LogPrintf("Not enough decoys. Please wait approximately 10 minutes and try again.\n");
+            NotifyDecoyPoolRefill();
+            return false;
+        }
     }
     myIndex = secp256k1_rand32() % (tx.vin[0].decoys.size() + 1) - 1;
 
@@ -3920,13 +4271,17 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
                 COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
                 nTxNewTime = GetAdjustedTime();
 
-                CKey view, spend;
-                myViewPrivateKey(view);
-                mySpendPrivateKey(spend);
-                CPubKey sharedSec;
-                computeSharedSec(*pcoin.first, pcoin.first->vout[pcoin.second], sharedSec);
+                //the kernel weighs coinbase and coinstake outputs by their public value, as CheckProofOfStake does
+                const CTxOut& outStake = pcoin.first->vout[pcoin.second];
+                CAmount nValueIn = (pcoin.first->IsCoinBase() || pcoin.first->IsCoinStake()) ? outStake.nValue : getCTxOutValue(*pcoin.first, outStake);
                 //iterates each utxo inside of CheckStakeKernelHash()
-                if (CheckStakeKernelHash(nBits, block, *pcoin.first, prevoutStake, sharedSec.begin(), nTxNewTime, nHashDrift, false, hashProofOfStake, true)) {
+                if (CheckStakeKernelHash(nBits, block, prevoutStake, nValueIn, nTxNewTime, nHashDrift, false, hashProofOfStake, true)) {
+                    CKey view, spend;
+                    myViewPrivateKey(view);
+                    mySpendPrivateKey(spend);
+                    CPubKey sharedSec;
+                    computeSharedSec(*pcoin.first, outStake, sharedSec);
+
                     //Double check that this will pass time requirements
                     if (nTxNewTime <= chainActive.Tip()->GetMedianTimePast()) {
                         LogPrintf("CreateCoinStake() : kernel found, but it is too far in the past\n");
@@ -4441,6 +4796,7 @@ void CWallet::CreatePrivacyAccount(bool forceNew)
             }
 
             walletdb.AppendStealthAccountList("masteraccount");
+            InvalidateStealthScanKeys();
             break;
         }
     }
@@ -4698,17 +5054,21 @@ void CWallet::LockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.insert(output);
+    MarkBalanceDirty(output.hash);
 }
 
 void CWallet::UnlockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.erase(output);
+    MarkBalanceDirty(output.hash);
 }
 
 void CWallet::UnlockAllCoins()
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
+    for (const COutPoint& output : setLockedCoins)
+        MarkBalanceDirty(output.hash);
     setLockedCoins.clear();
 }
 
@@ -5742,9 +6102,13 @@ void CWallet::SetNull()
     nOrderPosNext = 0;
     nNextResend = 0;
     nLastResend = 0;
+    nScannedHeight = -1;
+    nScannedHeightWritten = -1;
     nTimeFirstKey = 0;
     fWalletUnlockAnonymizeOnly = false;
     walletStakingInProgress = false;
+    fBalanceTipChanged = false;
+    fBalanceRebuild = true;
     fBackupMints = false;
 
     // Stake Settings
@@ -5976,6 +6340,8 @@ void CWalletTx::MarkDirty()
     fImmatureWatchCreditCached = false;
     fDebitCached = false;
     fChangeCached = false;
+    if (pwallet)
+        pwallet->MarkBalanceDirty(GetHash());
 }
 
 void CWalletTx::BindWallet(CWallet* pwalletIn)
@@ -6350,50 +6716,17 @@ bool CWallet::IsTransactionForMe(const CTransaction& tx)
 {
     LOCK(cs_wallet);
     {
-        std::vector<CKey> spends, views;
-        if (!allMyPrivateKeys(spends, views) || spends.size() != views.size()) {
-            spends.clear();
-            views.clear();
-            CKey spend, view;
-            if (!mySpendPrivateKey(spend) || !myViewPrivateKey(view)) {
-                LogPrintf("Failed to find private keys\n");
-                return false;
-            }
-            spends.push_back(spend);
-            views.push_back(view);
-        }
+        std::shared_ptr<const CStealthScanKeys> keys = GetStealthScanKeys();
+        if (!keys)
+            return false;
         for (const CTxOut& out : tx.vout) {
             if (out.IsEmpty()) {
                 continue;
             }
-            CPubKey txPub(out.txPub);
-            for (size_t i = 0; i < spends.size(); i++) {
-                CKey& spend = spends[i];
-                CKey& view = views[i];
-                const CPubKey& pubSpendKey = spend.GetPubKey();
-                bool ret = false;
-
-                //compute the tx destination
-                //P' = Hs(aR)G+B, a = view private, B = spend pub, R = tx public key
-                unsigned char aR[65];
-                //copy R into a
-                memcpy(aR, txPub.begin(), txPub.size());
-                if (!secp256k1_ec_pubkey_tweak_mul(aR, txPub.size(), view.begin())) {
-                    return false;
-                }
-                uint256 HS = Hash(aR, aR + txPub.size());
-                unsigned char* pHS = HS.begin();
-                unsigned char expectedDestination[65];
-                memcpy(expectedDestination, pubSpendKey.begin(), pubSpendKey.size());
-                if (!secp256k1_ec_pubkey_tweak_add(expectedDestination, pubSpendKey.size(), pHS)) {
-                    continue;
-                }
-                CPubKey expectedDes(expectedDestination, expectedDestination + 33);
-                CScript scriptPubKey = GetScriptForDestination(expectedDes);
-
-                if (scriptPubKey == out.scriptPubKey) {
-                    ret = true;
-                }
+            for (size_t i = 0; i < keys->spends.size(); i++) {
+                const CKey& spend = keys->spends[i];
+                uint256 HS;
+                bool ret = IsStealthOutputForAccount(out, keys->views[i], keys->pubSpends[i], HS);
 
                 if (ret) {
                     LOCK(cs_wallet);
@@ -6451,6 +6784,40 @@ bool CWallet::AllMyPublicAddresses(std::vector<std::string>& addresses, std::vec
     return true;
 }
 
+std::shared_ptr<const CStealthScanKeys> CWallet::GetStealthScanKeys()
+{
+    AssertLockHeld(cs_wallet);
+    if (IsLocked()) {
+        pStealthScanKeys.reset();
+        return pStealthScanKeys;
+    }
+    if (pStealthScanKeys)
+        return pStealthScanKeys;
+
+    std::shared_ptr<CStealthScanKeys> keys = std::make_shared<CStealthScanKeys>();
+    if (!allMyPrivateKeys(keys->spends, keys->views) || keys->spends.size() != keys->views.size()) {
+        keys->spends.clear();
+        keys->views.clear();
+        CKey spend, view;
+        if (!mySpendPrivateKey(spend) || !myViewPrivateKey(view)) {
+            LogPrintf("Failed to find private keys\n");
+            return NULL;
+        }
+        keys->spends.push_back(spend);
+        keys->views.push_back(view);
+    }
+    for (const CKey& spend : keys->spends)
+        keys->pubSpends.push_back(spend.GetPubKey());
+    pStealthScanKeys = keys;
+    return pStealthScanKeys;
+}
+
+void CWallet::InvalidateStealthScanKeys()
+{
+    LOCK(cs_wallet);
+    pStealthScanKeys.reset();
+}
+
 bool CWallet::allMyPrivateKeys(std::vector<CKey>& spends, std::vector<CKey>& views)
 {
     if (IsLocked()) {
@@ -6713,35 +7080,47 @@ bool CWallet::RevealTxOutAmount(const CTransaction& tx, const CTxOut& out, CAmou
         return true;
     }
 
-    std::set<CKeyID> keyIDs;
-    GetKeys(keyIDs);
+    // Callers pass an element of tx.vout, or a copy of one
+    COutPoint outpoint;
+    if (!tx.vout.empty() && &out >= &tx.vout.front() && &out <= &tx.vout.back()) {
+        outpoint = COutPoint(tx.GetHash(), &out - &tx.vout.front());
+    } else {
+        for (size_t i = 0; i < tx.vout.size(); i++) {
+            if (tx.vout[i] == out && tx.vout[i].commitment == out.commitment) {
+                outpoint = COutPoint(tx.GetHash(), i);
+                break;
+            }
+        }
+    }
+    if (!outpoint.IsNull() && ReadOutputAmount(outpoint, amount, blind)) {
+        amountMap[out.scriptPubKey] = amount;
+        blindMap[out.scriptPubKey] = blind;
+        return true;
+    }
+
+    CKeyID keyID;
     CPubKey sharedSec;
-    for (const CKeyID& keyID : keyIDs) {
-        CKey privKey;
-        GetKey(keyID, privKey);
-        CScript scriptPubKey = GetScriptForDestination(privKey.GetPubKey());
-        if (scriptPubKey == out.scriptPubKey) {
-            CPubKey txPub(&(out.txPub[0]), &(out.txPub[0]) + 33);
-            CKey view;
-            if (myViewPrivateKey(view)) {
-                computeSharedSec(tx, out, sharedSec);
-                uint256 val = out.maskValue.amount;
-                uint256 mask = out.maskValue.mask;
-                CKey decodedMask;
-                ECDHInfo::Decode(mask.begin(), val.begin(), sharedSec, decodedMask, amount);
-                std::vector<unsigned char> commitment;
-                if (CreateCommitment(decodedMask.begin(), amount, commitment)) {
-                    //make sure the amount and commitment are matched
-                    if (commitment == out.commitment) {
-                        amountMap[out.scriptPubKey] = amount;
-                        blindMap[out.scriptPubKey] = decodedMask;
-                        blind.Set(blindMap[out.scriptPubKey].begin(), blindMap[out.scriptPubKey].end(), true);
-                        return true;
-                    } else {
-                        amount = 0;
-                        amountMap[out.scriptPubKey] = amount;
-                        return false;
-                    }
+    if (GetKeyIDForScript(out.scriptPubKey, keyID)) {
+        CPubKey txPub(&(out.txPub[0]), &(out.txPub[0]) + 33);
+        CKey view;
+        if (myViewPrivateKey(view)) {
+            computeSharedSec(tx, out, sharedSec);
+            uint256 val = out.maskValue.amount;
+            uint256 mask = out.maskValue.mask;
+            CKey decodedMask;
+            ECDHInfo::Decode(mask.begin(), val.begin(), sharedSec, decodedMask, amount);
+            std::vector<unsigned char> commitment;
+            if (CreateCommitment(decodedMask.begin(), amount, commitment)) {
+                //make sure the amount and commitment are matched
+                if (commitment == out.commitment) {
+                    amountMap[out.scriptPubKey] = amount;
+                    blindMap[out.scriptPubKey] = decodedMask;
+                    blind.Set(blindMap[out.scriptPubKey].begin(), blindMap[out.scriptPubKey].end(), true);
+                    return true;
+                } else {
+                    amount = 0;
+                    amountMap[out.scriptPubKey] = amount;
+                    return false;
                 }
             }
         }
@@ -6750,20 +7129,107 @@ bool CWallet::RevealTxOutAmount(const CTransaction& tx, const CTxOut& out, CAmou
     return false;
 }
 
-bool CWallet::findCorrespondingPrivateKey(const CTxOut& txout, CKey& key) const
+bool CWallet::GetKeyIDForScript(const CScript& scriptPubKey, CKeyID& keyID) const
 {
-    std::set<CKeyID> keyIDs;
-    GetKeys(keyIDs);
-    for (const CKeyID& keyID : keyIDs) {
-        CBitcoinAddress address(keyID);
-        GetKey(keyID, key);
-        CPubKey pub = key.GetPubKey();
-        CScript script = GetScriptForDestination(pub);
-        if (script == txout.scriptPubKey) {
-            return true;
-        }
+    // Outputs pay to GetScriptForDestination(pubkey), the key store is indexed by pubkey.GetID()
+    CPubKey pub;
+    if (!ExtractPubKey(scriptPubKey, pub))
+        return false;
+    keyID = pub.GetID();
+    return HaveKey(keyID);
+}
+
+void CWallet::LoadOutputInfo(const COutPoint& outpoint, const CWalletOutputInfo& info)
+{
+    mapOutputInfo[outpoint] = info;
+    if (info.keyImage.IsValid())
+        outpointToKeyImages[outpoint] = info.keyImage;
+}
+
+void CWallet::StoreOutputKeyImage(CWalletDB& walletdb, const COutPoint& outpoint, const CKeyImage& keyImage)
+{
+    outpointToKeyImages[outpoint] = keyImage;
+    CWalletOutputInfo& info = mapOutputInfo[outpoint];
+    if (info.keyImage == keyImage)
+        return;
+    info.keyImage = keyImage;
+    if (fFileBacked)
+        walletdb.WriteOutputInfo(outpoint, info);
+}
+
+void CWallet::StoreOutputAmount(CWalletDB& walletdb, const COutPoint& outpoint, CAmount amount, const CKey& blind)
+{
+    CKeyingMaterial vchPlaintext(8 + 32);
+    WriteLE64(&vchPlaintext[0], amount);
+    memcpy(&vchPlaintext[8], blind.begin(), 32);
+
+    CWalletOutputInfo info = mapOutputInfo[outpoint];
+    info.fCrypted = IsCrypted();
+    if (info.fCrypted) {
+        if (!EncryptWalletData(vchPlaintext, GetOutputInfoIV(outpoint), info.vchAmountBlind))
+            return;
+    } else {
+        info.vchAmountBlind.assign(vchPlaintext.begin(), vchPlaintext.end());
+    }
+    mapOutputInfo[outpoint] = info;
+    if (fFileBacked)
+        walletdb.WriteOutputInfo(outpoint, info);
+}
+
+void CWallet::StoreRevealedAmount(CWalletDB& walletdb, const CTransaction& tx, const COutPoint& outpoint)
+{
+    if (IsLocked())
+        return;
+    std::map<COutPoint, CWalletOutputInfo>::const_iterator it = mapOutputInfo.find(outpoint);
+    if (it != mapOutputInfo.end() && !it->second.vchAmountBlind.empty())
+        return;
+    const CTxOut& out = tx.vout[outpoint.n];
+    if (!IsMine(out))
+        return;
+    CAmount amount;
+    CKey blind;
+    if (RevealTxOutAmount(tx, out, amount, blind) && blind.IsValid())
+        StoreOutputAmount(walletdb, outpoint, amount, blind);
+}
+
+void CWallet::StoreMissingOutputAmounts()
+{
+    LOCK(cs_wallet);
+    if (IsLocked())
+        return;
+    CWalletDB walletdb(strWalletFile);
+    for (const std::pair<const uint256, CWalletTx>& item : mapWallet) {
+        for (size_t i = 0; i < item.second.vout.size(); i++)
+            StoreRevealedAmount(walletdb, item.second, COutPoint(item.first, i));
     }
-    return false;
+}
+
+bool CWallet::ReadOutputAmount(const COutPoint& outpoint, CAmount& amount, CKey& blind) const
+{
+    std::map<COutPoint, CWalletOutputInfo>::const_iterator it = mapOutputInfo.find(outpoint);
+    if (it == mapOutputInfo.end() || it->second.vchAmountBlind.empty())
+        return false;
+    const CWalletOutputInfo& info = it->second;
+    CKeyingMaterial vchPlaintext;
+    if (info.fCrypted) {
+        if (!DecryptWalletData(info.vchAmountBlind, GetOutputInfoIV(outpoint), vchPlaintext))
+            return false;
+    } else {
+        vchPlaintext.assign(info.vchAmountBlind.begin(), info.vchAmountBlind.end());
+    }
+    if (vchPlaintext.size() != 8 + 32)
+        return false;
+    amount = ReadLE64(&vchPlaintext[0]);
+    blind.Set(vchPlaintext.begin() + 8, vchPlaintext.end(), true);
+    return true;
+}
+
+bool CWallet::findCorrespondingPrivateKey(const CTxOut& txout, CKey& key) const
+{
+    CKeyID keyID;
+    if (!GetKeyIDForScript(txout.scriptPubKey, keyID))
+        return false;
+    return GetKey(keyID, key);
 }
 
 bool CWallet::generateKeyImage(const CScript& scriptPubKey, CKeyImage& img) const
@@ -6771,37 +7237,31 @@ bool CWallet::generateKeyImage(const CScript& scriptPubKey, CKeyImage& img) cons
     if (IsLocked()) {
         return false;
     }
-    std::set<CKeyID> keyIDs;
-    GetKeys(keyIDs);
+    // Outputs pay to GetScriptForDestination(pubkey), the key store is indexed by pubkey.GetID()
+    CPubKey pub;
     CKey key;
-    unsigned char pubData[65];
-    for (const CKeyID& keyID : keyIDs) {
-        CBitcoinAddress address(keyID);
-        GetKey(keyID, key);
-        CPubKey pub = key.GetPubKey();
-        CScript script = GetScriptForDestination(pub);
-        if (script == scriptPubKey) {
-            uint256 hash = pub.GetHash();
-            pubData[0] = *(pub.begin());
-            memcpy(pubData + 1, hash.begin(), 32);
-            CPubKey newPubKey(pubData, pubData + 33);
-            //P' = Hs(aR)G+B, a = view private, B = spend pub, R = tx public key
-            unsigned char ki[65];
-            //copy newPubKey into ki
-            memcpy(ki, newPubKey.begin(), newPubKey.size());
-            while (!secp256k1_ec_pubkey_tweak_mul(ki, newPubKey.size(), key.begin())) {
-                hash = newPubKey.GetHash();
-                pubData[0] = *(newPubKey.begin());
-                memcpy(pubData + 1, hash.begin(), 32);
-                newPubKey.Set(pubData, pubData + 33);
-                memcpy(ki, newPubKey.begin(), newPubKey.size());
-            }
-
-            img = CKeyImage(ki, ki + 33);
-            return true;
-        }
+    if (!ExtractPubKey(scriptPubKey, pub) || !GetKey(pub.GetID(), key)) {
+        return false;
     }
-    return false;
+    unsigned char pubData[65];
+    uint256 hash = pub.GetHash();
+    pubData[0] = *(pub.begin());
+    memcpy(pubData + 1, hash.begin(), 32);
+    CPubKey newPubKey(pubData, pubData + 33);
+    //P' = Hs(aR)G+B, a = view private, B = spend pub, R = tx public key
+    unsigned char ki[65];
+    //copy newPubKey into ki
+    memcpy(ki, newPubKey.begin(), newPubKey.size());
+    while (!secp256k1_ec_pubkey_tweak_mul(ki, newPubKey.size(), key.begin())) {
+        hash = newPubKey.GetHash();
+        pubData[0] = *(newPubKey.begin());
+        memcpy(pubData + 1, hash.begin(), 32);
+        newPubKey.Set(pubData, pubData + 33);
+        memcpy(ki, newPubKey.begin(), newPubKey.size());
+    }
+
+    img = CKeyImage(ki, ki + 33);
+    return true;
 }
 
 bool CWallet::generateKeyImage(const CPubKey& pub, CKeyImage& img) const
@@ -21,6 +21,7 @@
 #include "guiinterface.h"
 #include "util.h"
 #include "validationinterface.h"
+#include "wallet/decoypool.h"
 #include "wallet/wallet_ismine.h"
 #include "wallet/walletdb.h"
 
@@ -57,6 +58,11 @@ extern bool fSendFreeTransactions;
 extern bool fPayAtLeastCustomFee;
 extern int64_t nReserveBalance;
 extern int64_t nDefaultConsolidateTime;
+extern bool fCheckWalletBalances;
+
+/** Wake the decoy pool refill thread, after a new block or when a transaction ran short of decoys */
+void NotifyDecoyPoolRefill();
+void ThreadDecoyPoolRefill();
 
 //! -paytxfee default
 static const CAmount DEFAULT_TRANSACTION_FEE = 0.1 * COIN;//
@@ -71,6 +77,14 @@ static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
 
 // 6666 = 1*5000 + 1*1000 + 1*500 + 1*100 + 1*50 + 1*10 + 1*5 + 1
 static const int ZQ_6666 = 6666;
+//! -rescanthreads default, 0 = one per core
+static const int DEFAULT_RESCAN_THREADS = 0;
+//! Maximum number of rescan threads
+static const int MAX_RESCAN_THREADS = 32;
+//! Number of blocks the rescan threads read and test ahead of the wallet update
+static const int RESCAN_BATCH_SIZE = 1000;
+//! Number of scanned blocks after which the scanned block height is written to the wallet database
+static const int SCANNED_HEIGHT_WRITE_INTERVAL = 100;
 
 class CAccountingEntry;
 class CCoinControl;
@@ -205,6 +219,47 @@ public:
     }
 };
 
+/**
+ * What the wallet derived for one of its outputs: the key image, and the revealed
+ * amount and blinding factor, encrypted with the master key in an encrypted wallet.
+ * Stored so that they are not recomputed after every restart.
+ */
+class CWalletOutputInfo
+{
+public:
+    static const int CURRENT_VERSION = 1;
+    int nVersion;
+    CKeyImage keyImage;
+    //! amount (8 bytes, little endian) followed by the blinding factor (32 bytes), empty if unknown
+    std::vector<unsigned char> vchAmountBlind;
+    bool fCrypted;
+
+    CWalletOutputInfo()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        nVersion = CWalletOutputInfo::CURRENT_VERSION;
+        keyImage = CKeyImage();
+        vchAmountBlind.clear();
+        fCrypted = false;
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(this->nVersion);
+        nVersion = this->nVersion;
+        READWRITE(keyImage);
+        READWRITE(vchAmountBlind);
+        READWRITE(fCrypted);
+    }
+};
+
 //in any case consolidation needed, call estimateConsolidationFees function to estimate fees
 enum StakingStatusError
 {
@@ -224,6 +279,59 @@ enum StakingMode {
     STAKING_WITH_CONSOLIDATION_WITH_STAKING_NEWW_FUNDS
 };
 
+/** The decrypted stealth account keys that outputs are tested against, see CWallet::GetStealthScanKeys */
+struct CStealthScanKeys {
+    std::vector<CKey> spends;
+    std::vector<CKey> views;
+    //! spends[i].GetPubKey(), so scanning an output needs no base point multiplication
+    std::vector<CPubKey> pubSpends;
+};
+
+/** What a single wallet transaction adds to each of the balances kept by the wallet balance ledger */
+struct CWalletTxBalance {
+    CAmount nTrusted;     //!< GetBalance
+    CAmount nSpendable;   //!< GetSpendableBalance before locked coins are taken off
+    CAmount nUnconfirmed; //!< GetUnconfirmedBalance
+    CAmount nImmature;    //!< GetImmatureBalance
+    CAmount nLocked;      //!< GetLockedCoins
+    CAmount nUnlocked;    //!< GetUnlockedCoins
+
+    CWalletTxBalance() : nTrusted(0), nSpendable(0), nUnconfirmed(0), nImmature(0), nLocked(0), nUnlocked(0) {}
+
+    CWalletTxBalance& operator+=(const CWalletTxBalance& b)
+    {
+        nTrusted += b.nTrusted;
+        nSpendable += b.nSpendable;
+        nUnconfirmed += b.nUnconfirmed;
+        nImmature += b.nImmature;
+        nLocked += b.nLocked;
+        nUnlocked += b.nUnlocked;
+        return *this;
+    }
+
+    CWalletTxBalance& operator-=(const CWalletTxBalance& b)
+    {
+        nTrusted -= b.nTrusted;
+        nSpendable -= b.nSpendable;
+        nUnconfirmed -= b.nUnconfirmed;
+        nImmature -= b.nImmature;
+        nLocked -= b.nLocked;
+        nUnlocked -= b.nUnlocked;
+        return *this;
+    }
+
+    friend bool operator==(const CWalletTxBalance& a, const CWalletTxBalance& b)
+    {
+        return a.nTrusted == b.nTrusted && a.nSpendable == b.nSpendable && a.nUnconfirmed == b.nUnconfirmed &&
+               a.nImmature == b.nImmature && a.nLocked == b.nLocked && a.nUnlocked == b.nUnlocked;
+    }
+
+    friend bool operator!=(const CWalletTxBalance& a, const CWalletTxBalance& b)
+    {
+        return !(a == b);
+    }
+};
+
 /**
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -245,6 +353,10 @@ private:
     int64_t nNextResend;
     int64_t nLastResend;
 
+    //! Height of the last block scanned for wallet transactions, and the one last written to the database
+    int nScannedHeight;
+    int nScannedHeightWritten;
+
     /**
      * Used to keep track of spent outpoints, and
      * detect and report conflicts (double-spends or
@@ -257,12 +369,38 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    //! Cached result of GetStealthScanKeys, dropped on Lock and on account creation
+    std::shared_ptr<const CStealthScanKeys> pStealthScanKeys;
+
+    /**
+     * Balance ledger: the balance entry of every wallet transaction and their sum.
+     * Entries are recomputed only for transactions marked dirty, and for the
+     * unconfirmed or immature ones (setVolatileBalances) when the chain tip moves.
+     */
+    mutable std::map<uint256, CWalletTxBalance> mapTxBalances;
+    mutable CWalletTxBalance balanceTotals;
+    mutable std::set<uint256> setDirtyBalances;
+    mutable std::set<uint256> setVolatileBalances;
+    mutable bool fBalanceTipChanged;
+    mutable bool fBalanceRebuild;
+
+    CWalletTxBalance ComputeTxBalance(const CWalletTx& wtx) const;
+    void UpdateBalanceLedger() const;
+    void CheckBalanceLedger() const;
+    CWalletTxBalance GetBalanceTotals() const;
+
 public:
     static const CAmount MINIMUM_STAKE_AMOUNT = 2500 * COIN;
     static const CAmount DEFAULT_STAKE_SPLIT_THRESHOLD = 100000;
     static const int32_t MAX_DECOY_POOL = 500;
     static const int32_t PROBABILITY_NEW_COIN_SELECTED = 70;
+    //! the refill thread walks the chain back for coinbase decoys while the pool has no more than this
+    static const int32_t MIN_COINBASE_DECOY_POOL = 100;
+    //! most recent blocks the refill thread takes user decoys from when it falls behind
+    static const int32_t MAX_DECOY_REFILL_BLOCKS = 100;
     bool RescanAfterUnlock(int fromHeight);
+    void SetScannedHeight(int nHeight, bool fFlush = false);
+    bool FlushScannedHeight();
     bool MintableCoins();
     StakingStatusError StakingCoinStatus(CAmount& minFee, CAmount& maxFee);
     bool SelectStakeCoins(std::set<std::pair<const CWalletTx*, unsigned int> >& setCoins, CAmount nTargetAmount) ;
@@ -355,7 +493,7 @@ public:
     StakingMode stakingMode = STOPPED;
     int64_t DecoyConfirmationMinimum = 15;
 
-    mutable std::map<std::string, CKeyImage> outpointToKeyImages;
+    mutable std::map<COutPoint, CKeyImage> outpointToKeyImages;
     std::map<std::string, bool> keyImagesSpends;
     std::map<std::string, std::string> keyImageMap;//mapping from: txhashHex-n to key image str, n = index
     std::list<std::string> pendingKeyImages;
@@ -363,8 +501,9 @@ public:
     std::vector<COutPoint> inSpendQueueOutpointsPerSession;
     mutable std::map<CScript, CAmount> amountMap;
     mutable std::map<CScript, CKey> blindMap;
-    mutable std::map<COutPoint, uint256> userDecoysPool;	//used in transaction spending user transaction
-    mutable std::map<COutPoint, uint256> coinbaseDecoysPool; //used in transction spending coinbase
+    mutable std::map<COutPoint, CWalletOutputInfo> mapOutputInfo;
+    CDecoyPool userDecoysPool{MAX_DECOY_POOL};     //used in transaction spending user transaction
+    CDecoyPool coinbaseDecoysPool{MAX_DECOY_POOL}; //used in transction spending coinbase
 
     CAmount dirtyCachedBalance = 0;
 
@@ -444,6 +583,7 @@ public:
     bool LoadWatchOnly(const CScript& dest);
 
     bool Unlock(const SecureString& strWalletPassphrase, bool anonimizeOnly = false);
+    bool Lock();
     bool ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase, const SecureString& strNewWalletPassphrase);
     bool EncryptWallet(const SecureString& strWalletPassphrase);
 
@@ -460,7 +600,7 @@ public:
     void MarkDirty();
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet = false);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
-    bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
+    bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate, bool fScanOutputs = true);
     void EraseFromWallet(const uint256& hash);
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false, bool fromStartup = false, int height = -1);
     void ReacceptWalletTransactions();
@@ -551,6 +691,8 @@ public:
     CAmount GetCredit(const CTransaction& tx, const isminefilter& filter) const;
     CAmount GetChange(const CTransaction& tx) const;
     void SetBestChain(const CBlockLocator& loc);
+    void UpdatedBlockTip(const CBlockIndex* pindex);
+    void RefillDecoyPools(int& nLastHeight, int& nBackfillHeight);
 
     DBErrors LoadWallet(bool& fFirstRunRet);
     DBErrors ZapWalletTx(std::vector<CWalletTx>& vWtx);
@@ -609,6 +751,14 @@ public:
     bool SendToStealthAddress(const std::string& stealthAddr, CAmount nValue, CWalletTx& wtxNew, bool fUseIX = false, int ringSize = 5);
     bool GenerateAddress(CPubKey& pub, CPubKey& txPub, CKey& txPriv) const;
     bool IsTransactionForMe(const CTransaction& tx);
+    /** The keys of all stealth accounts, decrypted once and kept until the wallet is locked. NULL if unavailable. */
+    std::shared_ptr<const CStealthScanKeys> GetStealthScanKeys();
+    void InvalidateStealthScanKeys();
+    //! Have the balance ledger recompute the entry of one transaction, or of all of them
+    void MarkBalanceDirty(const uint256& hash) const;
+    void MarkBalancesDirty() const;
+    //! Mark dirty the transactions whose outputs tx spends by one of our key images, even while locked
+    void MarkKeyImageSpendsDirty(const CTransaction& tx);
     bool ReadAccountList(std::string& accountList);
     bool ReadStealthAccount(const std::string& strAccount, CStealthAccount& account);
     bool EncodeIntegratedAddress(const CPubKey& pubViewKey, const CPubKey& pubSpendKey, uint64_t paymentID, std::string& pubAddr);
@@ -623,6 +773,18 @@ public:
     CAmount getCOutPutValue(const COutput& output) const;
     CAmount getCTxOutValue(const CTransaction &tx, const CTxOut &out) const;
     bool findCorrespondingPrivateKey(const CTxOut &txout, CKey &key) const;
+    //! Adds an output info record to the wallet, without saving it to disk (used by LoadWallet)
+    void LoadOutputInfo(const COutPoint& outpoint, const CWalletOutputInfo& info);
+    //! Remember the key image, or the amount and blind, of one of our outputs, in memory and in walletdb
+    void StoreOutputKeyImage(CWalletDB& walletdb, const COutPoint& outpoint, const CKeyImage& keyImage);
+    void StoreOutputAmount(CWalletDB& walletdb, const COutPoint& outpoint, CAmount amount, const CKey& blind);
+    //! Reveal and store the amount of one of our outputs, unless it is already stored or the wallet is locked
+    void StoreRevealedAmount(CWalletDB& walletdb, const CTransaction& tx, const COutPoint& outpoint);
+    //! Store the amounts of our outputs added while the wallet was locked or before output info records existed
+    void StoreMissingOutputAmounts();
+    bool ReadOutputAmount(const COutPoint& outpoint, CAmount& amount, CKey& blind) const;
+    /** The wallet key a pay-to-pubkey script pays to, found through the key store index instead of deriving every key */
+    bool GetKeyIDForScript(const CScript& scriptPubKey, CKeyID& keyID) const;
     bool AvailableCoins(const uint256 wtxid, const CWalletTx* pcoin, vector<COutput>& vCoins, int cannotSpend, bool fOnlyConfirmed = true, const CCoinControl* coinControl = NULL, bool fIncludeZeroValue = false, AvailableCoinsType nCoinType = ALL_COINS, bool fUseIX = false);
     void CreatePrivacyAccount(bool force = false);
     bool mySpendPrivateKey(CKey& spend) const;
@@ -645,11 +807,12 @@ public:
     bool computeSharedSec(const CTransaction& tx, const CTxOut& out, CPubKey& sharedSec) const;
     void AddComputedPrivateKey(const CTxOut& out);
     bool IsCollateralized(const COutPoint& outpoint);
+    /** Prove the ranges of tx's outputs. Uses no wallet state, several threads can prove at once. */
+    static bool generateBulletProofAggregate(CTransaction& tx);
 private:
     bool encodeStealthBase58(const std::vector<unsigned char>& raw, std::string& stealth);
     bool allMyPrivateKeys(std::vector<CKey>& spends, std::vector<CKey>& views);
     void createMasterKey() const;
-    bool generateBulletProofAggregate(CTransaction& tx);
     bool selectDecoysAndRealIndex(CTransaction& tx, int& myIndex, int ringSize);
     bool makeRingCT(CTransaction& wtxNew, int ringSize, std::string& strFailReason);
     int walletIdxCache = 0;
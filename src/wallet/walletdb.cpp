@@ -688,6 +688,12 @@ bool ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue, CW
             if (!pwallet->nTimeFirstKey ||
                 (keyMeta.nCreateTime < pwallet->nTimeFirstKey))
                 pwallet->nTimeFirstKey = keyMeta.nCreateTime;
+        } else if (strType == "outputinfo") {
+            COutPoint outpoint;
+            ssKey >> outpoint;
+            CWalletOutputInfo info;
+            ssValue >> info;
+            pwallet->LoadOutputInfo(outpoint, info);
         } else if (strType == "defaultkey") {
             ssValue >> pwallet->vchDefaultKey;
         } else if (strType == "pool") {
@@ -1263,15 +1269,23 @@ bool CWalletDB::ReadTxPrivateKey(const std::string& outpointKey, std::string& k)
     return Read(std::make_pair(std::string("txpriv"), outpointKey), k);
 }
 
-bool CWalletDB::WriteKeyImage(const std::string& outpointKey, const CKeyImage& k)
-{
-    return Write(std::make_pair(std::string("outpointkeyimage"), outpointKey), k);
-}
 bool CWalletDB::ReadKeyImage(const std::string& outpointKey, CKeyImage& k)
 {
     return Read(std::make_pair(std::string("outpointkeyimage"), outpointKey), k);
 }
 
+bool CWalletDB::EraseKeyImage(const std::string& outpointKey)
+{
+    nWalletDBUpdated++;
+    return Erase(std::make_pair(std::string("outpointkeyimage"), outpointKey));
+}
+
+bool CWalletDB::WriteOutputInfo(const COutPoint& outpoint, const CWalletOutputInfo& info)
+{
+    nWalletDBUpdated++;
+    return Write(std::make_pair(std::string("outputinfo"), outpoint), info);
+}
+
 
 bool CWalletDB::EraseDestData(const std::string& address, const std::string& key)
 {
@@ -28,6 +28,8 @@ class CKeyPool;
 class CMasterKey;
 class CScript;
 class CWallet;
+class COutPoint;
+class CWalletOutputInfo;
 class CWalletTx;
 class uint160;
 class uint256;
@@ -117,8 +119,9 @@ public:
     bool WriteTxPrivateKey(const std::string& outpointKey, const std::string& k);
     bool ReadTxPrivateKey(const std::string& outpointKey, std::string& k);
 
-    bool WriteKeyImage(const std::string& outpointKey, const CKeyImage& k);
     bool ReadKeyImage(const std::string& outpointKey, CKeyImage& k);
+    bool EraseKeyImage(const std::string& outpointKey);
+    bool WriteOutputInfo(const COutPoint& outpoint, const CWalletOutputInfo& info);
 
     bool WriteKey(const CPubKey& vchPubKey, const CPrivKey& vchPrivKey, const CKeyMetadata& keyMeta);
     bool WriteCryptedKey(const CPubKey& vchPubKey, const std::vector<unsigned char>& vchCryptedSecret, const CKeyMetadata& keyMeta);